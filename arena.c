@@ -0,0 +1,111 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "arena.h"
+#include "stats.h"
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+}
+
+static struct arena_block *new_block(size_t size) {
+    struct arena_block *block;
+
+    block = malloc(sizeof(struct arena_block) + size);
+    if (!block) {
+        return NULL;
+    }
+    STATS_ADD(arena_blocks, 1);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+/* Initialize an empty arena. The first block is allocated lazily */
+void arena_init(struct arena *a, size_t block_size) {
+    a->head = NULL;
+    a->block_size = block_size ? align_up(block_size) : ARENA_DEFAULT_BLOCK;
+    a->total = 0;
+}
+
+/* Get size bytes from the arena. The memory is aligned to ARENA_ALIGN and it
+ * is valid until the next arena_reset() or arena_free().
+ * Returns NULL if the memory can't be allocated.
+ */
+void *arena_alloc(struct arena *a, size_t size) {
+    struct arena_block *block = a->head;
+    void *ptr;
+
+    STATS_ADD(allocs, 1);
+    size = align_up(size ? size : 1);
+    if (!block || block->size - block->used < size) {
+        size_t bsize = size > a->block_size ? size : a->block_size;
+
+        block = new_block(bsize);
+        if (!block) {
+            return NULL;
+        }
+        block->next = a->head;
+        a->head = block;
+        a->total += bsize;
+    }
+    ptr = block->mem + block->used;
+    block->used += size;
+    return ptr;
+}
+
+/* Same as arena_alloc() but the memory is zeroed. It checks for overflow of
+ * nmemb * size like calloc does.
+ */
+void *arena_calloc(struct arena *a, size_t nmemb, size_t size) {
+    void *ptr;
+
+    if (size && nmemb > SIZE_MAX / size) {
+        return NULL;
+    }
+    ptr = arena_alloc(a, nmemb * size);
+    if (ptr) {
+        memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
+}
+
+/* Drop every allocation at once. If the last record needed more than one
+ * block, they are merged in a single block big enough for it, so that the
+ * next records of the same size don't have to allocate at all.
+ */
+void arena_reset(struct arena *a) {
+    struct arena_block *block = a->head;
+
+    if (!block) {
+        return;
+    }
+    if (block->next) {
+        size_t total = a->total;
+
+        arena_free(a);
+        a->block_size = align_up(total);
+        block = new_block(a->block_size);
+        if (!block) {
+            return;
+        }
+        a->head = block;
+        a->total = a->block_size;
+    }
+    block->used = 0;
+}
+
+/* Give all the memory back to the system. The arena can be used again */
+void arena_free(struct arena *a) {
+    struct arena_block *block = a->head;
+
+    while (block) {
+        struct arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    a->head = NULL;
+    a->total = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+#include <stddef.h>
+
+#define ARENA_DEFAULT_BLOCK             4096
+#define ARENA_ALIGN                     16
+
+/* A chunk of memory owned by an arena. Allocations are carved out of it
+ * sequentially.
+ */
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    unsigned char mem[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+/* Bump allocator owning everything decoded for a single record.
+ * Nothing is freed individually: arena_reset() drops all the allocations
+ * in one step and arena_free() gives the memory back to the system.
+ */
+struct arena {
+    struct arena_block *head;
+    size_t block_size;
+    size_t total;
+};
+
+void arena_init(struct arena *a, size_t block_size);
+void *arena_alloc(struct arena *a, size_t size);
+void *arena_calloc(struct arena *a, size_t nmemb, size_t size);
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
+#endif
@@ -0,0 +1,189 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "data.h"
+#include "parser.h"
+#include "pool.h"
+#include "load.h"
+
+#define BENCH_RUNS                      5
+
+/* Benchmark of the scan of many small ccaches, on each of the ways
+ * load_run() gets them in memory: mapped one at a time by cc_open() (the
+ * scan as it was), read by each thread, or batched through io_uring. The
+ * corpus is a copy of the same ccache many times, in a directory that should
+ * be on a tmpfs (like /dev/shm), so that the syscalls are measured and not
+ * the disk. Every credential is decoded, nothing is printed.
+ */
+
+static const int bench_backends[] = { LOAD_MMAP, LOAD_PREAD, LOAD_URING };
+
+struct bench_state {
+    char **paths;
+    uint64_t *sums;                     /* per worker, so that nothing is shared */
+    size_t *counts;
+    int failures;
+};
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *bench_path(void *arg, size_t job) {
+    struct bench_state *st = arg;
+
+    return st->paths[job];
+}
+
+static void bench_file(void *arg, const struct load_file *file, int worker) {
+    struct bench_state *st = arg;
+    struct ccache *cc;
+    struct credential *cred;
+    int rc;
+
+    if (file->data) {
+        rc = cc_memopen(&cc, file->data, file->size);
+    } else {
+        rc = cc_open(&cc, file->path);
+    }
+    while (rc == CC_OK && (rc = cc_next(cc, &cred)) == CC_OK) {
+        st->sums[worker] += cred->endtime + cred->server.comp_count + cred->ticket.length;
+        st->counts[worker]++;
+    }
+    cc_close(cc);
+    if (rc < 0) {
+        __atomic_fetch_add(&st->failures, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Write count copies of the template (at most 64 KiB) in dir
+static char **make_corpus(const char *template, const char *dir, size_t count, off_t *size) {
+    char buf[64 * 1024], **paths;
+    ssize_t n, length = 0;
+    size_t i;
+    int fd;
+
+    fd = open(template, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    n = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (n <= 0 || n == sizeof(buf)) {
+        errno = n < 0 ? errno : EFBIG;
+        return NULL;
+    }
+    length = n;
+    *size = length;
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        return NULL;
+    }
+    paths = calloc(count, sizeof(char *));
+    if (!paths) {
+        return NULL;
+    }
+    for (i = 0; i < count; i++) {
+        paths[i] = malloc(strlen(dir) + 32);
+        if (!paths[i]) {
+            return NULL;
+        }
+        sprintf(paths[i], "%s/cc%06zu", dir, i);
+        fd = open(paths[i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || write(fd, buf, length) != length) {
+            return NULL;
+        }
+        close(fd);
+    }
+    return paths;
+}
+
+// The best of BENCH_RUNS scans of the corpus
+static double measure(struct bench_state *st, size_t count, int backend, int nthreads, int *used,
+                      size_t *creds) {
+    double best = 0;
+    int i, w;
+
+    for (i = 0; i < BENCH_RUNS; i++) {
+        double start = now(), t;
+
+        memset(st->counts, 0, nthreads * sizeof(size_t));
+        *used = load_run(backend, nthreads, count, bench_path, bench_file, st);
+        t = now() - start;
+        if (*used < 0 || st->failures) {
+            printf("Error scanning with %s: %s\n", load_name(backend),
+                   *used < 0 ? strerror(errno) : "files failed to decode");
+            exit(EXIT_FAILURE);
+        }
+        if (!i || t < best) {
+            best = t;
+        }
+    }
+    *creds = 0;
+    for (w = 0; w < nthreads; w++) {
+        *creds += st->counts[w];
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    struct bench_state st;
+    double t, base[64];
+    off_t size;
+    size_t count, creds, b;
+    int max_threads, nthreads, used, step;
+
+    if (argc < 4) {
+        printf("Usage: %s template_ccache corpus_dir count [max_threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    count = strtoul(argv[3], NULL, 10);
+    max_threads = argc > 4 ? atoi(argv[4]) : pool_default_threads();
+    if (max_threads <= 0) {
+        max_threads = 1;
+    }
+    if (!count) {
+        printf("Error: no files to scan\n");
+        return EXIT_FAILURE;
+    }
+    memset(&st, 0, sizeof(st));
+    st.paths = make_corpus(argv[1], argv[2], count, &size);
+    st.sums = calloc(max_threads, sizeof(uint64_t));
+    st.counts = calloc(max_threads, sizeof(size_t));
+    if (!st.paths || !st.sums || !st.counts) {
+        printf("Error writing the corpus to %s: %s\n", argv[2], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: %zu copies of %s (%lld bytes)\n", argv[2], count, argv[1], (long long) size);
+    printf("%-9s %7s %9s %11s %11s %9s %8s\n", "load", "threads", "seconds", "files/s", "creds/s",
+           "MB/s", "speedup");
+    for (b = 0; b < sizeof(bench_backends) / sizeof(bench_backends[0]); b++) {
+        for (nthreads = 1, step = 0; step < 64; nthreads *= 2, step++) {
+            if (nthreads > max_threads) {
+                nthreads = max_threads;
+            }
+            t = measure(&st, count, bench_backends[b], nthreads, &used, &creds);
+            // Against the mapped files on as many threads
+            if (!b) {
+                base[step] = t;
+            }
+            printf("%-9s %7d %9.4f %11.0f %11.0f %9.1f %7.2fx\n", load_name(used), nthreads, t,
+                   count / t, creds / t, (double) size * count / t / 1e6, base[step] / t);
+            if (nthreads == max_threads) {
+                break;
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
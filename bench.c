@@ -0,0 +1,346 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "data.h"
+#include "parser.h"
+#include "out.h"
+#include "print.h"
+#include "pool.h"
+#include "encode.h"
+
+#define BENCH_RUNS                      5
+
+/* Benchmark of the decoding of a single ccache, on each of the paths of the
+ * parser: the serial cc_next() loop, cc_decode_parallel() on more and more
+ * threads, the summary, and the same streamed through a pipe. Each is run
+ * decoding only and decoding and printing (to /dev/null); the serial loop is
+ * also printed with the payloads dumped in hex and base64 (-v).
+ *
+ * Every measure runs in its own process, for its peak RSS. The allocations
+ * are counted by wrapping malloc() and friends at link time (see the
+ * Makefile): those of the library and of the printing code are seen, not
+ * those made inside the C library.
+ */
+
+struct bench_path {
+    const char *name;
+    int parallel;
+    int summary;
+    int stream;
+    int dump;                           /* ENCODE_* */
+};
+
+static const struct bench_path bench_paths[] = {
+    { "serial",         0, 0, 0, ENCODE_NONE },
+    { "parallel",       1, 0, 0, ENCODE_NONE },
+    { "summary",        0, 1, 0, ENCODE_NONE },
+    { "stream",         0, 0, 1, ENCODE_NONE },
+    { "stream-summary", 0, 1, 1, ENCODE_NONE },
+    { "dump-hex",       0, 0, 0, ENCODE_HEX },
+    { "dump-base64",    0, 0, 0, ENCODE_BASE64 },
+};
+
+struct bench_state {
+    struct outbuf out;                  /* to /dev/null */
+    struct outbuf *chunk_outs;          /* per chunk, like cccache -j */
+    size_t chunks;
+    int print;
+    struct print_options opts;
+    uint64_t *sums;                     /* per chunk, so that nothing is shared */
+};
+
+/* What a measure sends back from its process */
+struct bench_result {
+    double seconds;                     /* best run */
+    size_t count;                       /* credentials */
+    uint64_t allocs;                    /* in one run */
+};
+
+static uint64_t allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Something depending on the decoded data, so that it is not optimized out
+static uint64_t touch(const struct credential *cred) {
+    return cred->endtime + cred->server.comp_count + cred->ticket.length;
+}
+
+static int bench_chunk(void *arg, size_t chunk, size_t n, struct credential *cred) {
+    struct bench_state *st = arg;
+
+    st->sums[chunk] += touch(cred);
+    if (st->print) {
+        print_credential(&st->chunk_outs[chunk], &st->opts, "bench", cred, n);
+    }
+    return 0;
+}
+
+// A child process writes the file to a pipe, like cat file | cccache -
+static int stream_file(const char *filename, pid_t *pid) {
+    int fds[2];
+    char buf[64 * 1024];
+    ssize_t n;
+    int fd;
+
+    if (pipe(fds) < 0) {
+        return -1;
+    }
+    *pid = fork();
+    if (*pid < 0) {
+        return -1;
+    }
+    if (*pid) {
+        close(fds[1]);
+        return fds[0];
+    }
+    close(fds[0]);
+    fd = open(filename, O_RDONLY);
+    while (fd >= 0 && (n = read(fd, buf, sizeof(buf))) > 0) {
+        if (write(fds[1], buf, n) != n) {
+            break;
+        }
+    }
+    _exit(0);
+}
+
+static void fail(const char *what, const char *filename, int rc) {
+    printf("Error %s %s: %s\n", what, filename, cc_strerror(rc));
+    exit(EXIT_FAILURE);
+}
+
+// cc_next() on the mapped file or on a pipe
+static double run_serial(const char *filename, const struct bench_path *path,
+                         struct bench_state *st, size_t *count) {
+    struct ccache *cc;
+    struct credential *cred;
+    double start = now();
+    pid_t pid = 0;
+    int rc, fd;
+
+    if (path->stream) {
+        fd = stream_file(filename, &pid);
+        rc = fd < 0 ? CC_ERR_IO : cc_fdopen(&cc, fd);
+    } else {
+        rc = cc_open(&cc, filename);
+    }
+    if (rc < 0) {
+        fail("opening", filename, rc);
+    }
+    cc_set_summary(cc, path->summary);
+    while ((rc = cc_next(cc, &cred)) == CC_OK) {
+        st->sums[0] += touch(cred);
+        if (st->print) {
+            print_credential(&st->out, &st->opts, filename, cred, cc->count - 1);
+        }
+    }
+    *count = cc->count;
+    out_flush(&st->out);
+    cc_close(cc);
+    if (pid) {
+        waitpid(pid, NULL, 0);
+    }
+    if (rc < 0) {
+        fail("decoding", filename, rc);
+    }
+    return now() - start;
+}
+
+// cc_decode_parallel() printing every chunk to its own buffer, like cccache -j
+static double run_parallel(const char *filename, struct bench_state *st, int nthreads,
+                           size_t *count) {
+    struct ccache *cc;
+    double start = now();
+    size_t i;
+    int rc;
+
+    rc = cc_open(&cc, filename);
+    if (rc == CC_OK) {
+        rc = cc_index_build(cc);
+    }
+    if (rc < 0) {
+        fail("opening", filename, rc);
+    }
+    *count = cc->index.count;
+    st->chunks = cc->index.count / CC_CHUNK_SIZE + 1;
+    st->sums = calloc(st->chunks, sizeof(uint64_t));
+    st->chunk_outs = calloc(st->chunks, sizeof(struct outbuf));
+    if (!st->sums || !st->chunk_outs) {
+        fail("decoding", filename, CC_ERR_NOMEM);
+    }
+    for (i = 0; i < st->chunks; i++) {
+        if (out_init(&st->chunk_outs[i], -1, 0) < 0) {
+            fail("decoding", filename, CC_ERR_NOMEM);
+        }
+    }
+
+    rc = cc_decode_parallel(cc, 0, SIZE_MAX, CC_CHUNK_SIZE, nthreads, bench_chunk, st);
+    for (i = 0; i < st->chunks; i++) {
+        out_buf(&st->out, &st->chunk_outs[i]);
+        out_free(&st->chunk_outs[i]);
+    }
+    out_flush(&st->out);
+    free(st->chunk_outs);
+    free(st->sums);
+    cc_close(cc);
+    if (rc < 0) {
+        fail("decoding", filename, rc);
+    }
+    return now() - start;
+}
+
+// The best of BENCH_RUNS runs, in the calling process
+static void measure(const char *filename, const struct bench_path *path, int nthreads,
+                    int print, struct bench_result *res) {
+    struct bench_state st;
+    uint64_t sum = 0;
+    int fd, i;
+
+    fd = open("/dev/null", O_WRONLY);
+    if (fd < 0 || out_init(&st.out, fd, OUTBUF_SIZE) < 0) {
+        printf("Error opening /dev/null: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    print_options_init(&st.opts);
+    st.opts.summary = path->summary;
+    st.opts.dump = path->dump;
+    st.print = print;
+    for (i = 0; i < BENCH_RUNS; i++) {
+        uint64_t before = allocs;
+        double t;
+
+        if (path->parallel) {
+            t = run_parallel(filename, &st, nthreads, &res->count);
+        } else {
+            st.sums = &sum;
+            t = run_serial(filename, path, &st, &res->count);
+        }
+        res->allocs = allocs - before;
+        if (!i || t < res->seconds) {
+            res->seconds = t;
+        }
+    }
+    out_free(&st.out);
+    close(fd);
+}
+
+// Run a measure in a child process, and get its peak RSS (in KiB)
+static void measure_child(const char *filename, const struct bench_path *path, int nthreads,
+                          int print, struct bench_result *res, long *rss) {
+    struct rusage ru;
+    int fds[2], status;
+    pid_t pid;
+
+    if (pipe(fds) < 0 || (pid = fork()) < 0) {
+        printf("Error starting a measure: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (!pid) {
+        close(fds[0]);
+        measure(filename, path, nthreads, print, res);
+        if (write(fds[1], res, sizeof(*res)) != sizeof(*res)) {
+            _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    close(fds[1]);
+    if (read(fds[0], res, sizeof(*res)) != sizeof(*res) ||
+        wait4(pid, &status, 0, &ru) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+        printf("Error running the %s measure\n", path->name);
+        exit(EXIT_FAILURE);
+    }
+    close(fds[0]);
+    *rss = ru.ru_maxrss;
+}
+
+static void report(const char *work, const struct bench_path *path, int nthreads,
+                   const struct bench_result *res, long rss, double size, double serial) {
+    printf("%-7s %-15s %7d %9.4f %11.0f %9.1f %11.2f %9ld %7.2fx\n", work, path->name,
+           nthreads, res->seconds, res->count / res->seconds, size / res->seconds / 1e6,
+           res->count ? (double) res->allocs / res->count : 0, rss, serial / res->seconds);
+}
+
+int main(int argc, char *argv[]) {
+    struct bench_result res;
+    struct stat sb;
+    double serial = 0;
+    size_t p;
+    long rss;
+    int max_threads, nthreads, print;
+
+    if (argc < 2) {
+        printf("Usage: %s ccache_file [max_threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    max_threads = argc > 2 ? atoi(argv[2]) : pool_default_threads();
+    if (max_threads <= 0) {
+        max_threads = 1;
+    }
+    if (stat(argv[1], &sb) < 0) {
+        printf("Error opening %s: %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: %.1f MB, %s encoding\n", argv[1], sb.st_size / 1e6, encode_kernel());
+    printf("%-7s %-15s %7s %9s %11s %9s %11s %9s %8s\n", "output", "path", "threads",
+           "seconds", "creds/s", "MB/s", "allocs/cred", "RSS (KiB)", "speedup");
+    for (print = 0; print <= 1; print++) {
+        const char *work = print ? "print" : "none";
+
+        for (p = 0; p < sizeof(bench_paths) / sizeof(bench_paths[0]); p++) {
+            const struct bench_path *path = &bench_paths[p];
+
+            // Nothing is dumped without printing
+            if (path->dump && !print) {
+                continue;
+            }
+            for (nthreads = 1; ; nthreads *= 2) {
+                if (nthreads > max_threads) {
+                    nthreads = max_threads;
+                }
+                measure_child(argv[1], path, nthreads, print, &res, &rss);
+                if (!p) {
+                    serial = res.seconds;
+                }
+                report(work, path, nthreads, &res, rss, sb.st_size, serial);
+                if (!path->parallel || nthreads == max_threads) {
+                    break;
+                }
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -8,501 +8,812 @@
 #include <stdint.h>
 #include <byteswap.h>
 #include <errno.h>
-#include <sys/mman.h>
+#include <getopt.h>
 #include "data.h"
+#include "arena.h"
+#include "io.h"
+#include "parser.h"
+#include "print.h"
+#include "scan.h"
+#include "watch.h"
+#include "expire.h"
+#include "export.h"
+#include "metrics.h"
+#include "compact.h"
+#include "snap.h"
+#include "filter.h"
+#include "stats.h"
+#include "timefmt.h"
+#include "encode.h"
+#include "load.h"
 #include <time.h>
 
 #define BUFFERSIZE 1024
-#define ENABLE_ERROR_LOG    0
-
-#if ENABLE_ERROR_LOG
-#define LOG(x, ...) \
-do \
-    { \
-        printf("%s: ", __progname); \
-        printf(x, __VA_ARGS__); \
-    } \
-while (0)
-#else
-#define LOG(x, ...) \
-do ;\
-while (0)
-#endif
-
-extern const char* __progname;
-
-void print_bytes(void *data, ssize_t size) {
-    char test[size];
-    ssize_t i;
-
-    memcpy(test, data, size);
-    for (i = 0; i < size; i++) {
-        printf("%d%s", test[i], (((i+1) % 2) > 0) ? "" : "\n");
+
+void usage(char *exe) {
+    printf("Usage: %s [-v] [--dump=encoding] [-o format] [-n num|first-last] [-j threads] [-f filter]... [-S] ccache_file\n", exe);
+    printf("       %s --retrieve=server [-v] [-o format] [-f filter]... [-S] ccache_file\n", exe);
+    printf("       %s -s [-o format] [-j threads] [--count=key] [--io=method] <directory|glob|file|->...\n", exe);
+    printf("       %s -w [-o format] ccache_file...\n", exe);
+    printf("       %s -e [-o format] [-f filter]... [--warn=duration] [--interval=seconds]\n", exe);
+    printf("          [--hook=command] ccache_file...\n");
+    printf("       %s --export=file [-f filter]... ccache_file...\n", exe);
+    printf("       %s --serve=address [-f filter]... [-j threads] [--io=method]\n", exe);
+    printf("          [--interval=seconds] <directory|glob|file>...\n");
+    printf("       %s --compact [-o format] ccache_file...\n", exe);
+    printf("       %s --snapshot=file [-o format] [<directory|glob|file|->...]\n", exe);
+    printf("       %s --snapshot=file --query=server [-o format]\n", exe);
+    printf("\n");
+    printf("  -v            dump the keys, tickets, addresses and authdata in hex\n");
+    printf("  --dump=hex|base64\n");
+    printf("                same as -v, in the encoding given\n");
+    printf("  -n num        print only credential num (from 0), or a range of them\n");
+    printf("  --retrieve=server\n");
+    printf("                print only the credentials for a server principal, as\n");
+    printf("                comp/comp@REALM, newest first; only those are decoded\n");
+    printf("  -o format     output format: text (default), json (a document per\n");
+    printf("                file) or ndjson (a line per credential)\n");
+    printf("  -t times      how times are printed: local (default for text), utc\n");
+    printf("                (ISO 8601) or raw (seconds since the epoch, default for json)\n");
+    printf("  -s            scan mode: parse every ccache in the directories, globs\n");
+    printf("                and files given, or listed one per line on stdin (-)\n");
+    printf("  --count=server|client|realm\n");
+    printf("                with -s, count the credentials by server or client principal,\n");
+    printf("                or server realm, across all the files instead of printing them\n");
+    printf("  --io=uring|pread|mmap\n");
+    printf("                with -s or --serve, how the files are read: batched through\n");
+    printf("                io_uring (default, pread where it isn't available), opened\n");
+    printf("                and read by each thread, or mapped one at a time\n");
+    printf("  --compact     rewrite the ccaches without the credentials that have ended\n");
+    printf("                or that a newer one for the same client and server\n");
+    printf("                supersedes, and atomically replace them\n");
+    printf("  --export=file write the credentials of all the ccaches to a columnar file,\n");
+    printf("                to be mapped by analytics readers (see ccol.h)\n");
+    printf("  --snapshot=file\n");
+    printf("                write the credentials of the ccaches in the directories,\n");
+    printf("                globs and files given to a snapshot, to be mapped and\n");
+    printf("                queried (see snap.h); only the ccaches changed since the\n");
+    printf("                snapshot are read again, and without any path the ones it\n");
+    printf("                holds are\n");
+    printf("  --query=server\n");
+    printf("                with --snapshot, print the credentials for a server\n");
+    printf("                principal, as comp/comp@REALM, from the snapshot\n");
+    printf("  -f, --filter expr\n");
+    printf("                print only the credentials matching expr; repeated, all\n");
+    printf("                must match:\n");
+    printf("                  client=glob, server=glob (e.g. 'server=HTTP/*@REALM')\n");
+    printf("                  enctype=number|name\n");
+    printf("                  flags=name[,name...], flags!=name[,name...]\n");
+    printf("                  authtime, starttime, endtime, renew_till compared with\n");
+    printf("                  <, <=, >, >= or = to a time: seconds since the epoch,\n");
+    printf("                  now, or relative to now as +30m, -1h, +2d...\n");
+    printf("  -S, --summary only decode the principals, times, flags and enctype of the\n");
+    printf("                credentials: the keys, addresses, authdata and tickets\n");
+    printf("                are skipped by their length\n");
+    printf("  --stats[=text|json]\n");
+    printf("                print counters and timings of the parsing phases on the\n");
+    printf("                standard error at exit (in the output format by default)\n");
+    printf("  -w, --watch   print the ccaches, then the credentials added to them as\n");
+    printf("                they change (json is printed as ndjson)\n");
+    printf("  -e, --expire  stay running and report the credentials reaching their\n");
+    printf("                endtime and renew_till (json is printed as ndjson)\n");
+    printf("  --warn=duration\n");
+    printf("                with -e, also report them that long before, as 30m, 1h...\n");
+    printf("  --interval=seconds\n");
+    printf("                with -e or --serve, how often the files are checked for\n");
+    printf("                changes (default 60 with -e); they are read again when their\n");
+    printf("                mtime changes\n");
+    printf("  --hook=command\n");
+    printf("                with -e, run command with /bin/sh for each event instead of\n");
+    printf("                printing it, with CCCACHE_EVENT, CCCACHE_FILE, CCCACHE_CLIENT,\n");
+    printf("                CCCACHE_SERVER, CCCACHE_TIME, CCCACHE_ENDTIME and\n");
+    printf("                CCCACHE_RENEW_TILL in its environment\n");
+    printf("  --serve=address\n");
+    printf("                stay running and serve metrics of the ccaches in the\n");
+    printf("                directories, globs and files given over HTTP, in the\n");
+    printf("                Prometheus text format, at /metrics: credentials, earliest\n");
+    printf("                endtime and renew_till, flags and enctypes by client\n");
+    printf("                principal. address is a Unix socket path (or unix:path) or\n");
+    printf("                a port of the loopback: PORT, localhost:PORT, [::1]:PORT.\n");
+    printf("                The paths are listed again every --interval seconds\n");
+    printf("                (default 15), and only the files whose mtime, size or\n");
+    printf("                inode changed are read again, never mapped\n");
+    printf("  -j threads    threads used by the scan mode (default: one per CPU); for\n");
+    printf("                a single file, decode its credentials on that many threads\n");
+}
+
+// Parse "num" or "first-last" for -n
+int parse_range(const char *arg, struct print_options *opts) {
+    char *end;
+
+    opts->first = strtol(arg, &end, 10);
+    if (end == arg || opts->first < 0) {
+        return -1;
     }
+    opts->last = opts->first;
+    if (*end == '-') {
+        arg = end + 1;
+        opts->last = strtol(arg, &end, 10);
+        if (end == arg || opts->last < opts->first) {
+            return -1;
+        }
+    }
+    return *end ? -1 : 0;
 }
 
-// Converts date from epoc to a string
-void convert_epoch_h(uint32_t *time, const char *what) {
-    if (*time == 0)
-        printf("\t\t%s: %d\n", what, *time);
-    else {
-        time_t t = (long) *time;
-        char timebuf[100];
-        struct tm  ts;
-        ts = *localtime(&t);
-        strftime(timebuf, sizeof(timebuf), "%a %Y-%m-%d %H:%M:%S %Z", &ts);
-        printf("\t\t%s: %s\n", what, timebuf);
+// Parse "N" with an optional unit: s, m, h or d, for --warn
+int parse_duration(const char *arg, uint32_t *seconds) {
+    unsigned long long n;
+    char *end;
+
+    n = strtoull(arg, &end, 10);
+    if (end == arg || arg[0] == '-') {
+        return -1;
+    }
+    switch (*end) {
+    case 'd':
+        n *= 24;
+        // fall through
+    case 'h':
+        n *= 60;
+        // fall through
+    case 'm':
+        n *= 60;
+        // fall through
+    case 's':
+        end++;
+        break;
+    }
+    if (*end || n > UINT32_MAX) {
+        return -1;
     }
+    *seconds = n;
+    return 0;
 }
 
-// Get the size of the file.
-// It takes a file descriptor.
-int get_file_size(int fd) {
-    int ret;
-    long length = lseek(fd, 0, SEEK_END);
+// Scan mode: parse many ccaches in parallel
+int scan_main(struct outbuf *out, char **paths, int count, int nthreads, const struct print_options *opts,
+              int count_by, int io) {
+    struct scan scan;
+    int i, ret;
 
-    if (length < 0) {
-        int err = errno;
-        printf("Error while seeking to the end of the file (%s)\n", strerror(err));
+    scan_init(&scan, out, opts);
+    scan.count_by = count_by;
+    scan.io = io;
+    for (i = 0; i < count; i++) {
+        if (!strcmp(paths[i], "-")) {
+            ret = scan_add_list(&scan, stdin);
+        } else {
+            ret = scan_add_path(&scan, paths[i]);
+        }
+        if (ret < 0) {
+            int err = errno;
+            printf("Error adding %s to the scan: %s\n", paths[i], strerror(err));
+            scan_free(&scan);
+            return EXIT_FAILURE;
+        }
+    }
+    ret = scan_run(&scan, nthreads);
+    if (ret >= 0 && count_by && scan_print_counts(&scan) < 0) {
+        errno = ENOMEM;
         ret = -1;
-        goto fail;
     }
-
-    ret = lseek(fd, 0, SEEK_SET);
     if (ret < 0) {
         int err = errno;
-        printf("Error while seeking to the beginning of the file (%s)\n", strerror(err));
-        ret = -1;
-        goto fail;
+        out_lit(out, "Error starting the scan threads: ");
+        out_str(out, strerror(err));
+        out_char(out, '\n');
     }
-return length;
-fail:
-    return ret;
+    scan_free(&scan);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-// Check the file header
-void check_file_header(void **data, ssize_t *size) {
-    int rc;
-    uint8_t result;
+// Watch mode: print the ccaches again as they change
+int watch_main(struct outbuf *out, char **paths, int count, const struct print_options *opts) {
+    struct watch watch;
+    int i;
 
-    rc = getBE(data, &result, size);
-    if (rc < 0) {
-        printf("Error while reading file header number\n");
-        exit(EXIT_FAILURE);
-    }
-    if (result != 5) {
-        printf("The file doesn't seem to be a ccache file\n");
-        exit(EXIT_FAILURE);
+    if (watch_init(&watch, out, opts) < 0) {
+        int err = errno;
+        printf("Error starting to watch: %s\n", strerror(err));
+        return EXIT_FAILURE;
     }
-    LOG("File header number: %d\n", result);
-    rc = getBE(data, &result, size);
-    if (rc < 0) {
-        printf("Error while reading file header version\n");
-        exit(EXIT_FAILURE);
+    for (i = 0; i < count; i++) {
+        if (watch_add(&watch, paths[i]) < 0) {
+            int err = errno;
+            printf("Error watching %s: %s\n", paths[i], strerror(err));
+            watch_free(&watch);
+            return EXIT_FAILURE;
+        }
     }
-    if (result != 4) {
-        printf("The file doesn't seem to be a ccache file version 4\n");
-        printf("This program works only with version 4\n");
-        exit(EXIT_FAILURE);
+    watch_run(&watch);
+    // Only stops on failure
+    if (!out->error) {
+        int err = errno;
+        out_lit(out, "Error waiting for changes: ");
+        out_str(out, strerror(err));
+        out_char(out, '\n');
     }
-    LOG("File header version: %d\n", result);
+    watch_free(&watch);
+    return EXIT_FAILURE;
 }
 
-void check_field(void **data, ssize_t *size) {
-    int rc;
-    uint16_t tag;
-    uint16_t length;
-    uint32_t time1;
-    uint32_t time2;
+// Expiry mode: report the deadlines of the credentials as they come
+int expire_main(struct outbuf *out, char **paths, int count, const struct print_options *opts,
+                uint32_t warn, unsigned interval, const char *hook) {
+    struct expire expire;
+    int i;
 
-    rc = get_and_swap(data, &tag, size, 16);
-    if (rc < 0) {
-        printf("Error while reading field tag\n");
-        exit(EXIT_FAILURE);
-    }
-    LOG("Field tag: %d\n", tag);
-
-    rc = get_and_swap(data, &length, size, 16);
-    if (rc < 0) {
-        printf("Error while reading field length\n");
-        exit(EXIT_FAILURE);
+    if (expire_init(&expire, out, opts, warn, interval, hook) < 0) {
+        printf("Error allocating memory for the schedule\n");
+        return EXIT_FAILURE;
     }
-    LOG("Field length: %d\n", length);
-
-    rc = get_and_swap(data, &time1, size, 32);
-    if (rc < 0) {
-        printf("Error while reading first time\n");
-        exit(EXIT_FAILURE);
+    for (i = 0; i < count; i++) {
+        if (expire_add(&expire, paths[i]) < 0) {
+            printf("Error allocating memory for the schedule\n");
+            expire_free(&expire);
+            return EXIT_FAILURE;
+        }
     }
-    LOG("Field length: %d\n", time1);
-
-    rc = get_and_swap(data, &time2, size, 32);
-    if (rc < 0) {
-        printf("Error while reading second time\n");
-        exit(EXIT_FAILURE);
+    expire_run(&expire);
+    // Only stops on failure
+    if (!out->error) {
+        int err = errno;
+        out_lit(out, "Error waiting for the next deadline: ");
+        out_str(out, strerror(err));
+        out_char(out, '\n');
     }
-    LOG("Field length: %d\n", time2);
+    expire_free(&expire);
+    return EXIT_FAILURE;
 }
 
-void check_header(void **data, ssize_t *size) {
-    int rc;
-    uint16_t length;
+// Server mode: serve the metrics of the ccaches until a failure
+int serve_main(struct outbuf *out, char **paths, int count, const struct print_options *opts,
+               const char *address, int nthreads, int io, unsigned interval) {
+    struct metrics metrics;
 
-    rc = get_and_swap(data, &length, size, 16);
-    if (rc < 0) {
-        printf("Error while reading header length\n");
-        exit(EXIT_FAILURE);
+    if (metrics_init(&metrics, paths, count, opts, nthreads, io, interval) < 0) {
+        printf("Error allocating memory for the metrics\n");
+        metrics_free(&metrics);
+        return EXIT_FAILURE;
     }
-    LOG("Header length: %d\n", length);
-    check_field(data, size);
-}
-
-
-void check_data(void **data, struct data *result, ssize_t *size) {
-    int rc;
-    uint32_t length;
-
-    rc = get_and_swap(data, &length, size, 32);
-    if (rc < 0) {
-        printf("Error while reading data length\n");
-        exit(EXIT_FAILURE);
+    if (metrics_listen(&metrics, address) < 0) {
+        int err = errno;
+        printf("Error listening on %s: %s\n", address,
+               err == EINVAL ? "not a socket path or a port of the loopback" : strerror(err));
+        metrics_free(&metrics);
+        return EXIT_FAILURE;
     }
-    LOG("    Data length: %d\n", length);
-
-    result->length = length;
-    result->value = (char *) malloc(length);
-    memcpy(result->value, *data, length);
-    *data = (uint8_t *)*data + length;
-    *size -= length;
-    LOG("Data value: %.*s\n", result->length, result->value);
-}
-
-int check_principal(void **data, struct principal *princ, ssize_t *leftover) {
-    int rc; 
-    ssize_t i;
-    uint32_t name_type;
-    uint32_t count;
-    struct data *realm;
-
-    rc = get_and_swap(data, &name_type, leftover, 32);
-    if (rc < 0) {
-        printf("Error while reading principal name type\n");
-        return -1;
+    metrics_run(&metrics);
+    // Only stops on failure
+    if (!out->error) {
+        int err = errno;
+        out_lit(out, "Error serving the metrics: ");
+        out_str(out, strerror(err));
+        out_char(out, '\n');
     }
-    LOG("  Principal name type: %d\n", name_type);
-    princ->name_type = name_type;
+    metrics_free(&metrics);
+    return EXIT_FAILURE;
+}
 
-    rc = get_and_swap(data, &count, leftover, 32);
-    if (rc < 0) {
-        printf("Error while reading principal components count\n");
-        return -1;
-    }
-    LOG("  Principal components count %d\n", count);
-    princ->comp_count = count;
+// Export mode: write the credentials of the ccaches in columns
+int export_main(struct outbuf *out, char **paths, int count, const struct print_options *opts,
+                const char *export_path) {
+    struct export export;
+    int i, ret = EXIT_SUCCESS;
 
-    //realm
-    realm = (struct data *)malloc(sizeof(struct data));
-    if (!realm) {
-        printf("Error allocating memory for the realm\n");
-        return -1;
+    if (export_init(&export, out, opts) < 0) {
+        printf("Error allocating memory for the export\n");
+        return EXIT_FAILURE;
     }
-    check_data(data, realm, leftover);
-    princ->realm = realm;
-
-    //components
-    struct data *comp[count];
     for (i = 0; i < count; i++) {
-        comp[i] = (struct data *)malloc(sizeof(struct data));
-        check_data(data, comp[i], leftover);
+        if (export_add(&export, paths[i]) < 0) {
+            ret = EXIT_FAILURE;
+        }
     }
-    princ->components = comp;
-    return 0;
+    if (export_write(&export, export_path) < 0) {
+        int err = errno;
+        out_lit(out, "Error writing ");
+        out_str(out, export_path);
+        out_lit(out, ": ");
+        out_str(out, strerror(err));
+        out_char(out, '\n');
+        ret = EXIT_FAILURE;
+    }
+    export_free(&export);
+    return ret;
 }
 
-void check_keyblock(void **data, struct principal *princ, ssize_t *size) {
-    int rc;
-    uint16_t enc_type;
-    struct data *dt;
-    LOG("-- Keyblock%s\n", "");
-    rc = get_and_swap(data, &enc_type, size, 16);
-    if (rc < 0) {
-        printf("Error while reading enc type type\n");
-        exit(EXIT_FAILURE);
+// Print the failure of a library call on a file, with what it was doing
+static void print_failure(struct outbuf *out, const struct print_options *opts, const char *doing,
+                          const char *path, int rc, const char *where, int sys_errno) {
+    const char *msg = rc == CC_ERR_IO ? strerror(sys_errno) : cc_strerror(rc);
+
+    if (opts->format == PRINT_TEXT) {
+        out_lit(out, "Error ");
+        out_str(out, doing);
+        out_char(out, ' ');
+        out_str(out, path);
+        out_lit(out, " (");
+        out_str(out, where);
+        out_lit(out, "): ");
+        out_str(out, msg);
+        out_char(out, '\n');
+    } else {
+        out_lit(out, "{\"file\":");
+        out_json_str(out, path, strlen(path));
+        out_lit(out, ",\"error\":\"");
+        out_str(out, where);
+        out_lit(out, ": ");
+        out_str(out, msg);
+        out_lit(out, "\"}\n");
     }
-    LOG("Enc type: 0x%x\n", enc_type);
-    dt = (struct data *)malloc(sizeof(struct data));
-    check_data(data, dt, size);
 }
 
-int get_default_principal(void **data, struct principal *princ, ssize_t *size) {
-    return check_principal(data, princ, size);
+// Print what cc_compact() did to a file
+static void print_compact(struct outbuf *out, const struct print_options *opts, const char *path,
+                          int rc, const struct cc_compact_result *res) {
+    if (rc < 0) {
+        print_failure(out, opts, "compacting", path, rc, res->where, res->sys_errno);
+        return;
+    }
+    if (opts->format != PRINT_TEXT) {
+        out_lit(out, "{\"file\":");
+        out_json_str(out, path, strlen(path));
+    }
+    if (opts->format == PRINT_TEXT) {
+        out_str(out, path);
+        out_lit(out, ": kept ");
+        out_u64(out, res->kept);
+        out_lit(out, " of ");
+        out_u64(out, res->total);
+        out_lit(out, " credentials (");
+        out_u64(out, res->expired);
+        out_lit(out, " ended, ");
+        out_u64(out, res->duplicates);
+        out_lit(out, " superseded), ");
+        out_u64(out, res->size_before);
+        out_lit(out, " -> ");
+        out_u64(out, res->size_after);
+        out_lit(out, " bytes\n");
+        return;
+    }
+    out_lit(out, ",\"credentials\":");
+    out_u64(out, res->total);
+    out_lit(out, ",\"kept\":");
+    out_u64(out, res->kept);
+    out_lit(out, ",\"expired\":");
+    out_u64(out, res->expired);
+    out_lit(out, ",\"duplicates\":");
+    out_u64(out, res->duplicates);
+    out_lit(out, ",\"size_before\":");
+    out_u64(out, res->size_before);
+    out_lit(out, ",\"size_after\":");
+    out_u64(out, res->size_after);
+    out_lit(out, "}\n");
 }
 
-int check_address(void **data, struct address *addr, ssize_t *size) {
-    int rc;
-    uint16_t addr_type;
-    struct data * dt;
+// Compact mode: rewrite the ccaches without the credentials of no use
+int compact_main(struct outbuf *out, char **paths, int count, const struct print_options *opts) {
+    struct cc_compact_result res;
+    time_t now = time(NULL);
+    int i, rc, ret = EXIT_SUCCESS;
 
-    LOG("-- address%s\n", "");
-    rc = get_and_swap(data, &addr_type, size, 16);
-    if (rc < 0) {
-        printf("Error while reading address type type\n");
-        exit(EXIT_FAILURE);
+    for (i = 0; i < count; i++) {
+        rc = cc_compact(paths[i], now, &res);
+        print_compact(out, opts, paths[i], rc, &res);
+        if (rc < 0) {
+            ret = EXIT_FAILURE;
+        }
     }
-    LOG("address type: 0x%x\n", addr_type);
-    dt = (struct data *) malloc(sizeof(struct data));
-    check_data(data, dt, size);
-    printf("address type: 0x%x value: %s\n", addr_type, dt->value);
-    return 0;
+    return ret;
 }
 
-int check_addresses(void **data, struct addresses *addrs, ssize_t *size) {
-    int rc;
-    ssize_t i;
-    uint32_t count;
-    struct address *addr;
+/* Add a ccache to a snapshot. The files found in a directory or taken from
+ * the snapshot itself are skipped silently when they are not ccaches, or
+ * gone.
+ */
+static int snapshot_add(struct outbuf *out, const struct print_options *opts, struct snap_builder *b,
+                        const char *path, int discovered) {
+    int rc = snap_builder_add(b, path);
+
+    if (rc == CC_OK || (discovered && (rc == CC_ERR_NOT_CCACHE || rc == CC_ERR_VERSION ||
+                                       rc == CC_ERR_TRUNCATED ||
+                                       (rc == CC_ERR_IO && b->sys_errno == ENOENT)))) {
+        return 0;
+    }
+    print_failure(out, opts, "reading", path, rc, b->where, b->sys_errno);
+    return -1;
+}
 
-    LOG("-- addresses%s\n", "");
-    rc = get_and_swap(data, &count, size, 32);
-    if (rc < 0) {
-        printf("Error while reading enc type type\n");
-        exit(EXIT_FAILURE);
+// Snapshot mode: write, or bring up to date, the snapshot of many ccaches
+int snapshot_main(struct outbuf *out, char **paths, int count, const struct print_options *opts,
+                  const char *snapshot_path) {
+    struct snap_builder builder;
+    struct scan scan;
+    struct snap old;
+    int i, rc, has_old, ret = EXIT_SUCCESS;
+
+    // A snapshot that can't be read is written again from scratch
+    has_old = snap_open(&old, snapshot_path) == CC_OK;
+    if (!has_old && !count) {
+        printf("Error reading the snapshot %s, and no ccaches were given\n", snapshot_path);
+        return EXIT_FAILURE;
     }
-    LOG("count: %d\n", count);
-    for (i = 0; i < count; i++){
-        addr = (struct address *) malloc(sizeof(struct address));
-        check_address(data, addr, size);
+    scan_init(&scan, out, opts);
+    for (i = 0; i < count; i++) {
+        if (!strcmp(paths[i], "-")) {
+            rc = scan_add_list(&scan, stdin);
+        } else {
+            rc = scan_add_path(&scan, paths[i]);
+        }
+        if (rc < 0) {
+            int err = errno;
+            printf("Error adding %s to the snapshot: %s\n", paths[i], strerror(err));
+            scan_free(&scan);
+            if (has_old) {
+                snap_close(&old);
+            }
+            return EXIT_FAILURE;
+        }
     }
-    return 0;
-}
-
+    if (snap_builder_init(&builder, has_old ? &old : NULL) < 0) {
+        printf("Error allocating memory for the snapshot\n");
+        ret = EXIT_FAILURE;
+        goto out;
+    }
+    for (i = 0; i < (int) scan.count; i++) {
+        if (snapshot_add(out, opts, &builder, scan.files[i].path, scan.files[i].discovered) < 0) {
+            ret = EXIT_FAILURE;
+        }
+    }
+    // Without paths, the ccaches of the snapshot
+    for (i = 0; !count && i < (int) old.header->files; i++) {
+        const char *value;
+        uint32_t length;
+        char *path;
 
-int check_authdata(void **data, struct authdata *addrs, ssize_t *size) {
-    int rc;
-    uint16_t ad_type;
-    struct data * dt; 
+        if (snap_string(&old, old.files[i].path, &value, &length) < 0 || !(path = strndup(value, length))) {
+            continue;
+        }
+        snapshot_add(out, opts, &builder, path, 1);
+        free(path);
+    }
 
-    LOG("-- auth data%s\n", "");
-    rc = get_and_swap(data, &ad_type, size, 16);
+    rc = snap_builder_write(&builder, snapshot_path);
     if (rc < 0) {
-        printf("Error while reading address type type\n");
-        exit(EXIT_FAILURE);
+        print_failure(out, opts, "writing", snapshot_path, rc, builder.where, builder.sys_errno);
+        ret = EXIT_FAILURE;
+    } else if (opts->format == PRINT_TEXT) {
+        out_str(out, snapshot_path);
+        out_lit(out, ": ");
+        out_u64(out, builder.nfiles);
+        out_lit(out, " ccaches (");
+        out_u64(out, builder.parsed);
+        out_lit(out, " read, ");
+        out_u64(out, builder.reused);
+        out_lit(out, " unchanged), ");
+        out_u64(out, builder.nrecords);
+        out_lit(out, " credentials\n");
+    } else {
+        out_lit(out, "{\"snapshot\":");
+        out_json_str(out, snapshot_path, strlen(snapshot_path));
+        out_lit(out, ",\"files\":");
+        out_u64(out, builder.nfiles);
+        out_lit(out, ",\"read\":");
+        out_u64(out, builder.parsed);
+        out_lit(out, ",\"unchanged\":");
+        out_u64(out, builder.reused);
+        out_lit(out, ",\"credentials\":");
+        out_u64(out, builder.nrecords);
+        out_lit(out, "}\n");
+    }
+    snap_builder_free(&builder);
+out:
+    scan_free(&scan);
+    if (has_old) {
+        snap_close(&old);
     }
-    LOG("address type: 0x%x\n", ad_type);
-    dt = (struct data *) malloc(sizeof(struct data));
-    check_data(data, dt, size);
-    printf("address type: 0x%x value: %s\n", ad_type, dt->value);
-    return 0;
+    return ret;
 }
 
-int check_authdatas(void **data, struct authdatas *addrs, ssize_t *size) {
+// Query mode: the credentials of a server principal, from a snapshot
+int query_main(struct outbuf *out, const struct print_options *opts, const char *snapshot_path,
+               const char *server) {
+    struct snap snap;
+    uint64_t first, count;
     int rc;
-    ssize_t i;
-    uint32_t count;
-    struct authdata *auth;
 
-    LOG("-- auth datas%s\n", "");
-    rc = get_and_swap(data, &count, size, 32);
+    rc = snap_open(&snap, snapshot_path);
     if (rc < 0) {
-        printf("Error while reading auth_datatas count type\n");
-        return -1;
+        print_failure(out, opts, "reading", snapshot_path, rc, "snapshot", errno);
+        return EXIT_FAILURE;
     }
-    LOG("count: %d\n", count);
-    for (i = 0; i < count; i++){
-        auth = (struct authdata *) malloc(sizeof(struct authdata));
-        check_authdata(data, auth, size);
+    rc = snap_lookup(&snap, server, strlen(server), &first, &count);
+    if (rc == CC_OK) {
+        rc = print_snap_records(out, opts, &snap, server, first, count);
+    } else if (rc == CC_ERR_NOT_FOUND && opts->format == PRINT_JSON) {
+        print_snap_records(out, opts, &snap, server, 0, 0);
     }
-    return 0;
-}
-
-
-int check_credentials(void **data, ssize_t *size) {
-    int ret;
-    ssize_t i;
-    printf("-- Credentials\n");
-    printf("%-5s\t%-40s\t\t\t\t%s\n", "num", "Client", "Server");
-    i = 0;
-    while (*size > 0 && *size > sizeof(struct credential)) {
-        uint32_t auth_time = 0, start_time = 0, end_time = 0;
-        uint32_t renew_till = 0, ticket_flags = 0;
-        uint8_t is_skey = 0;
-        printf("%-5zd\t", i);
-        struct principal *client;
-        struct data *second_ticket;
-        struct data *ticket;
-        struct authdatas *auths;
-        struct addresses *addrs;
-
-        client = (struct principal *) malloc(sizeof(struct principal));
-        ret = check_principal(data, client, size);
-        if(ret < 0) {
-            return -1;
-        }
-        printf("client: %.*s/%.*s@%.*s\t\t", client->components[0]->length, client->components[0]->value, 
-                                           client->components[1]->length, client->components[1]->value,
-                                           client->realm->length, client->realm->value);
-
-        struct principal *server;
-        server = (struct principal *) malloc(sizeof(struct principal));
-        check_principal(data, server, size);
-        if (ret < 0) {
-            return -1;
-        }
-        printf("server: %.*s/%.*s@%.*s\n", server->components[0]->length, server->components[0]->value, 
-                                           server->components[1]->length, server->components[1]->value,
-                                           server->realm->length, server->realm->value);
-
-        check_keyblock(data, server, size);
-
-        ret = get_and_swap(data, &auth_time, size, 32);
-        if (ret < 0) {
-            printf("Error while reading auth time\n");
-            exit(EXIT_FAILURE);
-        }
-        convert_epoch_h(&auth_time, "Auth time");
-
-        ret = get_and_swap(data, &start_time, size, 32);
-        if (ret < 0) {
-            printf("Error while reading start time\n");
-            exit(EXIT_FAILURE);
-        }
-        convert_epoch_h(&start_time, "Start time");
-
-        ret = get_and_swap(data, &end_time, size, 32);
-        if (ret < 0) {
-            printf("Error while reading end time\n");
-            exit(EXIT_FAILURE);
-        }
-        convert_epoch_h(&end_time, "End time");
-
-        ret = get_and_swap(data, &renew_till, size, 32);
-        if (ret < 0) {
-            printf("Error while reading renew_till date\n");
-            exit(EXIT_FAILURE);
-        }
-        convert_epoch_h(&renew_till, "Renew till");
-
-        ret = getBE(data, &is_skey, size);
-        if (ret < 0) {
-            printf("Error while reading is_key\n");
-            exit(EXIT_FAILURE);
-        }
-        printf("\t\tis_key: %d\n", is_skey);
-
-        ret = get_and_swap(data, &ticket_flags, size, 32);
-        if (ret < 0) {
-            printf("Error while reading is_key\n");
-            exit(EXIT_FAILURE);
-        }
-        char * buffer = malloc(MAXSTRINGLEN);
-        flag_string(ticket_flags, buffer);
-        printf("\t\tFlags: %x (%s)\n", ticket_flags, buffer);
-
-        addrs = (struct addresses *) malloc(sizeof(struct addresses));
-        check_addresses(data, addrs, size);
-        if (ret < 0) {
-            return -1;
-        }
-
-        auths = (struct authdatas *) malloc(sizeof(struct authdatas));
-        check_authdatas(data, auths, size);
-        if (ret < 0) {
-            return -1;
-        }
-
-        ticket = (struct data *) malloc(sizeof(struct data));
-        check_data(data, ticket, size);
-
-        second_ticket = (struct data *) malloc(sizeof(struct data));
-        check_data(data, second_ticket, size);
-
-        printf("\n");
-        // Clean up before restarting
-        free(client);
-        free(server);
-        free(addrs);
-        free(auths);
-        free(ticket);
-        free(second_ticket);
-        i++;
+    if (rc == CC_ERR_INVALID) {
+        print_failure(out, opts, "reading", snapshot_path, rc, "snapshot", 0);
     }
-    return 0;
+    snap_close(&snap);
+    return rc == CC_OK ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-void usage(char *exe) {
-    printf("Usage: %s [-v] ccache_file\n", exe);
-}
+/* Long options without a short one */
+#define OPT_STATS                       256
+#define OPT_WARN                        257
+#define OPT_INTERVAL                    258
+#define OPT_HOOK                        259
+#define OPT_COUNT                       260
+#define OPT_EXPORT                      261
+#define OPT_COMPACT                     262
+#define OPT_SNAPSHOT                    263
+#define OPT_QUERY                       264
+#define OPT_RETRIEVE                    265
+#define OPT_DUMP                        266
+#define OPT_IO                          267
+#define OPT_SERVE                       268
+
+#define STATS_FORMAT_OUTPUT             -2      /* --stats: as the output */
+
+static const struct option long_options[] = {
+    { "compact",    no_argument,        NULL, OPT_COMPACT },
+    { "count",      required_argument,  NULL, OPT_COUNT },
+    { "dump",       required_argument,  NULL, OPT_DUMP },
+    { "expire",     no_argument,        NULL, 'e' },
+    { "export",     required_argument,  NULL, OPT_EXPORT },
+    { "filter",     required_argument,  NULL, 'f' },
+    { "hook",       required_argument,  NULL, OPT_HOOK },
+    { "interval",   required_argument,  NULL, OPT_INTERVAL },
+    { "io",         required_argument,  NULL, OPT_IO },
+    { "query",      required_argument,  NULL, OPT_QUERY },
+    { "retrieve",   required_argument,  NULL, OPT_RETRIEVE },
+    { "serve",      required_argument,  NULL, OPT_SERVE },
+    { "snapshot",   required_argument,  NULL, OPT_SNAPSHOT },
+    { "stats",      optional_argument,  NULL, OPT_STATS },
+    { "summary",    no_argument,        NULL, 'S' },
+    { "warn",       required_argument,  NULL, OPT_WARN },
+    { "watch",      no_argument,        NULL, 'w' },
+    { NULL,         0,                  NULL, 0 }
+};
 
 int main(int argc, char *argv[]) {
-    ssize_t size;
-    int ret, fd, err, opt, verbose = 0; 
-    char *buffer;
+    int ret, opt, scan = 0, watch = 0, nthreads = 0, time_mode = -1;
+    int stats = -1, expire = 0, compact = 0, count_by = SCAN_COUNT_NONE, io = -1;
+    uint32_t warn = 0;
+    unsigned interval = 0;
+    const char *hook = NULL, *export_path = NULL, *snapshot_path = NULL, *query = NULL;
+    const char *serve = NULL;
     char *filename;
-    struct principal *princ;
+    struct print_options opts;
+    struct cc_filter filter;
+    struct outbuf out;
 
-    while ((opt = getopt(argc, argv, "v")) != -1) {
+    print_options_init(&opts);
+    cc_filter_init(&filter);
+    while ((opt = getopt_long(argc, argv, "vsSwej:n:o:t:f:", long_options, NULL)) != -1) {
         switch (opt) {
         case 'v':
-            verbose++;
+            if (!opts.dump) {
+                opts.dump = ENCODE_HEX;
+            }
+            break;
+        case OPT_DUMP:
+            if (!strcmp(optarg, "hex")) {
+                opts.dump = ENCODE_HEX;
+            } else if (!strcmp(optarg, "base64")) {
+                opts.dump = ENCODE_BASE64;
+            } else {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's':
+            scan = 1;
+            break;
+        case 'S':
+            opts.summary = 1;
+            break;
+        case OPT_STATS:
+            if (!optarg) {
+                stats = STATS_FORMAT_OUTPUT;
+            } else if (!strcmp(optarg, "text")) {
+                stats = PRINT_TEXT;
+            } else if (!strcmp(optarg, "json")) {
+                stats = PRINT_JSON;
+            } else {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'w':
+            watch = 1;
+            break;
+        case 'e':
+            expire = 1;
+            break;
+        case OPT_WARN:
+            if (parse_duration(optarg, &warn) < 0) {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_INTERVAL:
+            interval = atoi(optarg);
+            if ((int) interval <= 0) {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_HOOK:
+            hook = optarg;
+            break;
+        case OPT_COMPACT:
+            compact = 1;
+            break;
+        case OPT_EXPORT:
+            export_path = optarg;
+            break;
+        case OPT_SNAPSHOT:
+            snapshot_path = optarg;
+            break;
+        case OPT_QUERY:
+            query = optarg;
+            break;
+        case OPT_SERVE:
+            serve = optarg;
+            break;
+        case OPT_RETRIEVE:
+            opts.server = optarg;
+            break;
+        case OPT_COUNT:
+            if (!strcmp(optarg, "server")) {
+                count_by = SCAN_COUNT_SERVER;
+            } else if (!strcmp(optarg, "client")) {
+                count_by = SCAN_COUNT_CLIENT;
+            } else if (!strcmp(optarg, "realm")) {
+                count_by = SCAN_COUNT_REALM;
+            } else {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_IO:
+            if (!strcmp(optarg, "uring")) {
+                io = LOAD_URING;
+            } else if (!strcmp(optarg, "pread")) {
+                io = LOAD_PREAD;
+            } else if (!strcmp(optarg, "mmap")) {
+                io = LOAD_MMAP;
+            } else {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'f':
+            if (cc_filter_parse(&filter, optarg, time(NULL)) < 0) {
+                printf("Invalid filter: %s\n", optarg);
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            opts.filter = &filter;
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            if (nthreads <= 0) {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'n':
+            if (parse_range(optarg, &opts) < 0) {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'o':
+            if (!strcmp(optarg, "text")) {
+                opts.format = PRINT_TEXT;
+            } else if (!strcmp(optarg, "json")) {
+                opts.format = PRINT_JSON;
+            } else if (!strcmp(optarg, "ndjson")) {
+                opts.format = PRINT_NDJSON;
+            } else {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            if (!strcmp(optarg, "local")) {
+                time_mode = TIMEFMT_LOCAL;
+            } else if (!strcmp(optarg, "utc")) {
+                time_mode = TIMEFMT_UTC;
+            } else if (!strcmp(optarg, "raw")) {
+                time_mode = TIMEFMT_RAW;
+            } else {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
             break;
         default:
             usage(argv[0]);
             exit(EXIT_FAILURE);
         }
     }
+    if (time_mode < 0) {
+        time_mode = opts.format == PRINT_TEXT ? TIMEFMT_LOCAL : TIMEFMT_RAW;
+    }
+    opts.time_mode = time_mode;
 
     filename = argv[optind];
-    if (!filename) {
+    if (snapshot_path && (scan || watch || expire || export_path || compact || opts.first >= 0 ||
+                          opts.filter || (query && filename))) {
         usage(argv[0]);
         return EXIT_FAILURE;
     }
-
-    fd = open(filename, O_RDONLY);
-    if (fd < 0) {
-        err = errno;
-        printf("Error opening the file %s: %s\n", filename, strerror(err));
+    if ((!filename && !snapshot_path) || (query && !snapshot_path) ||
+        (opts.server && (scan || watch || expire || export_path || compact || snapshot_path ||
+                         opts.first >= 0)) ||
+        (watch && (scan || opts.first >= 0 || !strcmp(filename, "-"))) ||
+        (expire && (scan || watch || opts.first >= 0 || !strcmp(filename, "-"))) ||
+        (count_by && !scan) || (io >= 0 && !scan && !serve) || (opts.dump && opts.summary) ||
+        (serve && (scan || watch || expire || export_path || compact || snapshot_path ||
+                   opts.server || opts.first >= 0 || opts.dump || !strcmp(filename, "-"))) ||
+        (export_path && (scan || watch || expire || opts.first >= 0)) ||
+        (compact && (scan || watch || expire || export_path || opts.first >= 0 || opts.filter))) {
+        usage(argv[0]);
         return EXIT_FAILURE;
     }
-
-    size = get_file_size(fd);
-    LOG("File size: %zd\n", size);
-    if (size < 0) {
+    tzset();
+    if (out_init(&out, STDOUT_FILENO, OUTBUF_SIZE) < 0) {
+        printf("Error allocating memory for the output\n");
         return EXIT_FAILURE;
     }
-
-    buffer = (char *) malloc(size);
-    if (!buffer) {
-        printf("Error allocating memory for the ccache file %s\n", filename);
-        return EXIT_FAILURE;
+    if (stats != -1) {
+        if (!ENABLE_STATS) {
+            fprintf(stderr, "Statistics are not built in (ENABLE_STATS=0)\n");
+        }
+        stats_enable();
+    }
+
+    if (query) {
+        ret = query_main(&out, &opts, snapshot_path, query);
+    } else if (snapshot_path) {
+        ret = snapshot_main(&out, argv + optind, argc - optind, &opts, snapshot_path);
+    } else if (scan) {
+        ret = scan_main(&out, argv + optind, argc - optind, nthreads, &opts, count_by,
+                        io >= 0 ? io : LOAD_URING);
+    } else if (watch) {
+        ret = watch_main(&out, argv + optind, argc - optind, &opts);
+    } else if (compact) {
+        ret = compact_main(&out, argv + optind, argc - optind, &opts);
+    } else if (export_path) {
+        ret = export_main(&out, argv + optind, argc - optind, &opts, export_path);
+    } else if (serve) {
+        ret = serve_main(&out, argv + optind, argc - optind, &opts, serve, nthreads,
+                         io >= 0 ? io : LOAD_URING, interval);
+    } else if (expire) {
+        ret = expire_main(&out, argv + optind, argc - optind, &opts, warn, interval, hook);
+    } else {
+        if (nthreads) {
+            opts.nthreads = nthreads;
+        }
+        ret = print_ccache(&out, filename, &opts) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (out_flush(&out) < 0) {
+        ret = EXIT_FAILURE;
+    }
+    out_free(&out);
+    if (stats != -1 && ENABLE_STATS) {
+        // After the output, on the standard error
+        if (out_init(&out, STDERR_FILENO, OUTBUF_SIZE) == 0) {
+            print_stats(&out, stats == STATS_FORMAT_OUTPUT ? opts.format : stats);
+            out_flush(&out);
+            out_free(&out);
+        }
     }
-    read(fd, buffer, size);
-    void *data = mmap(0, size, PROT_READ, MAP_PRIVATE|MAP_LOCKED|MAP_POPULATE, fd, 0);
-    void *dataptr = data;
-    if(dataptr == MAP_FAILED) {
-        goto fail_close;
-    }
-    // File header
-    LOG("dataptr addr (mmap): %p\n", dataptr);
-    check_file_header(&dataptr, &size);
-    check_header(&dataptr, &size);
-
-    // Get the default principal
-    princ = (struct principal *) malloc(sizeof(struct principal));
-    ret = get_default_principal(&dataptr, princ, &size);
-    if(ret < 0) {
-        goto fail_close;
-    }
-    printf("Default principal: %s/%s@%s\n", princ->components[0]->value, princ->components[1]->value, princ->realm->value);
-    
-    // Get the credentials
-    check_credentials(&dataptr, &size);
-
-    munmap(dataptr, size); 
-    close(fd);
-    return EXIT_SUCCESS;
-
-fail_close:
-    munmap(dataptr, size); 
-    close(fd);
-    return EXIT_FAILURE;
+    return ret;
 }
@@ -0,0 +1,105 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "data.h"
+#include "parser.h"
+#include "ccol.h"
+
+static const uint8_t type_widths[] = {
+    [CCOL_U8] = 1, [CCOL_U16] = 2, [CCOL_U32] = 4, [CCOL_U64] = 8, [CCOL_BLOB] = 1
+};
+
+/* Map an export and check its directory: every column must be aligned and
+ * inside the file. The structures are used in place, which needs a
+ * little-endian host.
+ */
+int ccol_open(struct ccol *c, const char *path) {
+    const struct ccol_header *h;
+    struct stat st;
+    uint64_t i;
+    void *map;
+    int fd;
+
+    memset(c, 0, sizeof(*c));
+    if (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__) {
+        return CC_ERR_VERSION;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return CC_ERR_IO;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return CC_ERR_IO;
+    }
+    if ((uint64_t) st.st_size < sizeof(struct ccol_header)) {
+        close(fd);
+        return CC_ERR_TRUNCATED;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return CC_ERR_IO;
+    }
+    c->map = map;
+    c->size = st.st_size;
+    h = c->header = map;
+
+    if (memcmp(h->magic, CCOL_MAGIC, sizeof(h->magic))) {
+        ccol_close(c);
+        return CC_ERR_NOT_CCACHE;
+    }
+    if (h->version != CCOL_VERSION) {
+        ccol_close(c);
+        return CC_ERR_VERSION;
+    }
+    if (h->directory % CCOL_ALIGN || h->directory > c->size ||
+        h->columns > (c->size - h->directory) / sizeof(struct ccol_column)) {
+        ccol_close(c);
+        return CC_ERR_TRUNCATED;
+    }
+    c->columns = (const struct ccol_column *) (c->map + h->directory);
+    for (i = 0; i < h->columns; i++) {
+        const struct ccol_column *col = &c->columns[i];
+
+        if (col->type < CCOL_U8 || col->type > CCOL_BLOB || col->offset % CCOL_ALIGN) {
+            ccol_close(c);
+            return CC_ERR_INVALID;
+        }
+        if (col->offset > c->size || col->count > (c->size - col->offset) / type_widths[col->type]) {
+            ccol_close(c);
+            return CC_ERR_TRUNCATED;
+        }
+    }
+    return CC_OK;
+}
+
+/* The values of a column, checking its type, NULL if there is no such
+ * column.
+ */
+const void *ccol_column(const struct ccol *c, const char *name, uint32_t type, uint64_t *count) {
+    uint64_t i;
+
+    for (i = 0; i < c->header->columns; i++) {
+        const struct ccol_column *col = &c->columns[i];
+
+        if (!strncmp(col->name, name, CCOL_NAME_SIZE) && col->type == type) {
+            *count = col->count;
+            return c->map + col->offset;
+        }
+    }
+    return NULL;
+}
+
+void ccol_close(struct ccol *c) {
+    if (c->map) {
+        munmap((void *) c->map, c->size);
+    }
+    memset(c, 0, sizeof(*c));
+}
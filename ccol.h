@@ -0,0 +1,88 @@
+#ifndef CCOL_H_INCLUDED
+#define CCOL_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Columnar export of credentials (cccache --export), laid out to be mapped
+ * and read in place:
+ *
+ *   header         struct ccol_header, at offset 0
+ *   directory      header.columns struct ccol_column, at header.directory
+ *   columns        each at a multiple of CCOL_ALIGN
+ *
+ * All the integers are little-endian. A row is a credential; the fixed width
+ * columns have one value per row. The principals and file names are
+ * dictionary encoded: the "client", "server" and "file" columns hold indexes
+ * in the "principal" and "file_name" dictionaries. A dictionary, like the
+ * tickets, is a blob column of the bytes end to end, with an offsets column
+ * of count + 1 entries: entry i is at [offsets[i], offsets[i + 1]).
+ */
+
+#define CCOL_MAGIC                      "CCCOLUMN"
+#define CCOL_VERSION                    1
+#define CCOL_ALIGN                      64
+#define CCOL_NAME_SIZE                  24
+
+/* Types of the columns */
+#define CCOL_U8                         1
+#define CCOL_U16                        2
+#define CCOL_U32                        3
+#define CCOL_U64                        4
+#define CCOL_BLOB                       5       /* bytes, see the offsets column */
+
+/* The columns written by cccache, in this order */
+#define CCOL_COLUMNS(X) \
+    X(FILE,             "file",             CCOL_U32) \
+    X(CLIENT,           "client",           CCOL_U32) \
+    X(SERVER,           "server",           CCOL_U32) \
+    X(AUTHTIME,         "authtime",         CCOL_U32) \
+    X(STARTTIME,        "starttime",        CCOL_U32) \
+    X(ENDTIME,          "endtime",          CCOL_U32) \
+    X(RENEW_TILL,       "renew_till",       CCOL_U32) \
+    X(TICKET_FLAGS,     "ticket_flags",     CCOL_U32) \
+    X(ENCTYPE,          "enctype",          CCOL_U16) \
+    X(IS_SKEY,          "is_skey",          CCOL_U8) \
+    X(TICKET_OFFSETS,   "ticket_offsets",   CCOL_U64) \
+    X(TICKETS,          "tickets",          CCOL_BLOB) \
+    X(PRINCIPAL_OFFSETS, "principal_offsets", CCOL_U64) \
+    X(PRINCIPALS,       "principal",        CCOL_BLOB) \
+    X(FILE_OFFSETS,     "file_offsets",     CCOL_U64) \
+    X(FILE_NAMES,       "file_name",        CCOL_BLOB)
+
+#define CCOL_ENUM(id, name, type) CCOL_##id,
+enum {
+    CCOL_COLUMNS(CCOL_ENUM)
+    CCOL_COUNT
+};
+#undef CCOL_ENUM
+
+struct ccol_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t columns;
+    uint64_t rows;
+    uint64_t directory;         /* offset of the directory */
+    uint8_t reserved[32];
+};
+
+struct ccol_column {
+    char name[CCOL_NAME_SIZE];  /* NUL padded */
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t count;             /* values, bytes for a blob */
+    uint64_t offset;
+};
+
+/* A mapped export */
+struct ccol {
+    const uint8_t *map;
+    size_t size;
+    const struct ccol_header *header;
+    const struct ccol_column *columns;
+};
+
+int ccol_open(struct ccol *c, const char *path);
+const void *ccol_column(const struct ccol *c, const char *name, uint32_t type, uint64_t *count);
+void ccol_close(struct ccol *c);
+#endif
@@ -0,0 +1,314 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "data.h"
+#include "io.h"
+#include "parser.h"
+#include "intern.h"
+#include "compact.h"
+
+#define COMPACT_DROP                    UINT32_MAX
+
+/* The credentials to keep, from a first pass in summary mode: for every
+ * client and server pair, the one ending last (the last one in the file on a
+ * tie), as long as it hasn't ended. Only an ID per credential is remembered.
+ */
+struct compact_plan {
+    struct cc_names names;
+    struct cc_intern pairs;
+    uint32_t *pair_of;          /* by credential, COMPACT_DROP if it has ended */
+    uint32_t *best;             /* by pair, the credential kept */
+    uint32_t *best_endtime;
+    uint32_t count;
+    uint32_t size;
+    uint32_t pairs_size;
+};
+
+static int is_config(const struct credential *cred) {
+    return cred->server.realm.length == sizeof(CC_CONF_REALM) - 1 &&
+           !memcmp(cred->server.realm.value, CC_CONF_REALM, sizeof(CC_CONF_REALM) - 1);
+}
+
+static int grow(uint32_t **array, uint32_t size, uint32_t need) {
+    uint32_t n = size ? size : 64;
+    uint32_t *a;
+
+    while (n <= need) {
+        n *= 2;
+    }
+    a = realloc(*array, n * sizeof(uint32_t));
+    if (!a) {
+        return CC_ERR_NOMEM;
+    }
+    *array = a;
+    return n;
+}
+
+static void plan_init(struct compact_plan *p) {
+    memset(p, 0, sizeof(*p));
+    cc_names_init(&p->names);
+    cc_intern_init(&p->pairs);
+}
+
+static void plan_free(struct compact_plan *p) {
+    cc_names_free(&p->names);
+    cc_intern_free(&p->pairs);
+    free(p->pair_of);
+    free(p->best);
+    free(p->best_endtime);
+}
+
+static int plan_credential(struct compact_plan *p, const struct credential *cred, time_t now,
+                           struct cc_compact_result *res) {
+    uint32_t ids[2], pair, seen, n = p->count;
+    int rc;
+
+    if (n >= p->size) {
+        rc = grow(&p->pair_of, p->size, n);
+        if (rc < 0) {
+            return rc;
+        }
+        p->size = rc;
+    }
+    p->count++;
+    // The configuration entries have no endtime
+    if (cred->endtime < now && !is_config(cred)) {
+        p->pair_of[n] = COMPACT_DROP;
+        res->expired++;
+        return CC_OK;
+    }
+
+    seen = p->pairs.count;
+    rc = cc_names_principal(&p->names, &cred->client, &ids[0]);
+    if (rc == CC_OK) {
+        rc = cc_names_principal(&p->names, &cred->server, &ids[1]);
+    }
+    if (rc == CC_OK) {
+        rc = cc_intern(&p->pairs, ids, sizeof(ids), &pair);
+    }
+    if (rc < 0) {
+        return rc;
+    }
+    if (pair >= p->pairs_size) {
+        if ((rc = grow(&p->best, p->pairs_size, pair)) < 0 ||
+            (rc = grow(&p->best_endtime, p->pairs_size, pair)) < 0) {
+            return rc;
+        }
+        p->pairs_size = rc;
+    }
+    p->pair_of[n] = pair;
+    if (pair == seen || cred->endtime >= p->best_endtime[pair]) {
+        p->best[pair] = n;
+        p->best_endtime[pair] = cred->endtime;
+    }
+    return CC_OK;
+}
+
+static int kept(const struct compact_plan *p, uint32_t n) {
+    return p->pair_of[n] != COMPACT_DROP && p->best[p->pair_of[n]] == n;
+}
+
+static int compact_fail(struct cc_compact_result *res, int err, const char *where) {
+    res->where = where;
+    if (err == CC_ERR_IO) {
+        res->sys_errno = errno;
+    }
+    return err;
+}
+
+/* Take the lock krb5's FILE ccache takes to store a credential: a write lock
+ * on the whole file, waited for. It is released when fd is closed (or any
+ * other descriptor of the file in this process: the reader's stays open).
+ */
+static int lock_file(int fd) {
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &fl) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int same_file(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/* Write the kept credentials next to the file, then rename the copy over it.
+ * The copy gets the mode and owner of the file. The file is locked like krb5
+ * does from the check that it is still the one planned to the rename, so
+ * that a credential stored meanwhile waits for the rename, instead of being
+ * lost. A krb5 writer that opened the file before the rename still writes to
+ * the replaced one when it gets the lock: this is only safe against writers
+ * that open the file after it.
+ */
+static int compact_write(struct ccache *cc, const char *path, const struct stat *st,
+                         const struct compact_plan *p, struct cc_compact_result *res) {
+    struct credential *cred;
+    struct writer w;
+    struct stat now_st;
+    char *tmp;
+    uint32_t n;
+    int fd, lock_fd, rc = CC_OK;
+
+    // A write lock needs a descriptor open for writing
+    lock_fd = open(path, O_RDWR | O_CLOEXEC);
+    if (lock_fd < 0 || lock_file(lock_fd) < 0) {
+        rc = compact_fail(res, CC_ERR_IO, "lock");
+        if (lock_fd >= 0) {
+            close(lock_fd);
+        }
+        return rc;
+    }
+    // Credentials stored since the first pass would be lost
+    if (fstat(lock_fd, &now_st) < 0 || !same_file(&now_st, st)) {
+        close(lock_fd);
+        errno = EAGAIN;
+        return compact_fail(res, CC_ERR_IO, "changed");
+    }
+
+    tmp = malloc(strlen(path) + sizeof(".XXXXXX"));
+    if (!tmp) {
+        close(lock_fd);
+        return compact_fail(res, CC_ERR_NOMEM, "write");
+    }
+    sprintf(tmp, "%s.XXXXXX", path);
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        rc = compact_fail(res, CC_ERR_IO, "create");
+        close(lock_fd);
+        free(tmp);
+        return rc;
+    }
+    if (writer_init(&w, fd, 0) < 0) {
+        rc = compact_fail(res, CC_ERR_NOMEM, "write");
+        goto out;
+    }
+
+    // The file header and the header fields as they are, then the default
+    // principal and the credentials
+    writer_write(&w, cc->reader.map, 4 + cc->header.length);
+    put_principal(&w, &cc->default_principal);
+    if (cc_resume(cc, cc->creds_start, 0) < 0) {
+        rc = compact_fail(res, CC_ERR_INVALID, "decode");
+        goto out;
+    }
+    cc_set_summary(cc, 0);
+    for (n = 0; n < p->count; n++) {
+        rc = cc_next(cc, &cred);
+        if (rc != CC_OK) {
+            rc = compact_fail(res, rc < 0 ? rc : CC_ERR_INVALID, "decode");
+            goto out;
+        }
+        if (kept(p, n) && put_credential(&w, cred) < 0) {
+            break;
+        }
+    }
+    rc = CC_OK;
+    if (writer_flush(&w) < 0) {
+        rc = compact_fail(res, CC_ERR_IO, "write");
+        goto out;
+    }
+    res->size_after = w.offset;
+    if (fchmod(fd, st->st_mode & 07777) < 0 ||
+        ((st->st_uid != geteuid() || st->st_gid != getegid()) &&
+         fchown(fd, st->st_uid, st->st_gid) < 0)) {
+        rc = compact_fail(res, CC_ERR_IO, "chmod");
+        goto out;
+    }
+    if (fsync(fd) < 0) {
+        rc = compact_fail(res, CC_ERR_IO, "write");
+        goto out;
+    }
+
+    // Replaced by a writer that doesn't take the lock, like kinit renaming a new ccache
+    if (stat(path, &now_st) < 0 || !same_file(&now_st, st)) {
+        errno = EAGAIN;
+        rc = compact_fail(res, CC_ERR_IO, "changed");
+        goto out;
+    }
+    if (rename(tmp, path) < 0) {
+        rc = compact_fail(res, CC_ERR_IO, "rename");
+    }
+
+out:
+    if (w.buf) {
+        writer_free(&w);
+    }
+    close(fd);
+    if (rc < 0) {
+        unlink(tmp);
+    }
+    // Releases the lock, after the rename
+    close(lock_fd);
+    free(tmp);
+    return rc;
+}
+
+/* Rewrite a ccache without the credentials that have ended by now and those
+ * superseded by another one for the same client and server. The header
+ * fields and the default principal are kept as they are. The credentials are
+ * decoded twice from the mapping, once to plan and once to write, and never
+ * held all at once. The result replaces the file with an atomic rename;
+ * nothing is written if there is nothing to remove.
+ * Returns CC_OK or a CC_ERR_* code, with res->where set.
+ */
+int cc_compact(const char *path, time_t now, struct cc_compact_result *res) {
+    struct compact_plan plan;
+    struct credential *cred;
+    struct ccache *cc;
+    struct stat st;
+    uint32_t n;
+    int rc;
+
+    memset(res, 0, sizeof(*res));
+    plan_init(&plan);
+    rc = cc_open(&cc, path);
+    if (rc < 0) {
+        res->where = cc ? cc->where : "open";
+        res->sys_errno = cc ? cc->sys_errno : 0;
+        goto out;
+    }
+    if (!reader_is_mapped(&cc->reader) || fstat(cc->reader.fd, &st) < 0) {
+        rc = compact_fail(res, CC_ERR_NOT_SEEKABLE, "open");
+        goto out;
+    }
+    res->size_before = res->size_after = st.st_size;
+
+    cc_set_summary(cc, 1);
+    while ((rc = cc_next(cc, &cred)) == CC_OK) {
+        rc = plan_credential(&plan, cred, now, res);
+        if (rc < 0) {
+            break;
+        }
+    }
+    if (rc < 0) {
+        res->where = cc->where ? cc->where : "decode";
+        res->sys_errno = cc->sys_errno;
+        goto out;
+    }
+    res->total = plan.count;
+    for (n = 0; n < plan.count; n++) {
+        if (kept(&plan, n)) {
+            res->kept++;
+        }
+    }
+    res->duplicates = res->total - res->kept - res->expired;
+    rc = res->kept < res->total ? compact_write(cc, path, &st, &plan, res) : CC_OK;
+out:
+    cc_close(cc);
+    plan_free(&plan);
+    return rc;
+}
@@ -0,0 +1,24 @@
+#ifndef COMPACT_H_INCLUDED
+#define COMPACT_H_INCLUDED
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* Realm of the configuration entries krb5 stores as credentials */
+#define CC_CONF_REALM                   "X-CACHECONF:"
+
+/* What cc_compact() did, or where it failed */
+struct cc_compact_result {
+    uint32_t total;             /* credentials in the file */
+    uint32_t kept;
+    uint32_t expired;
+    uint32_t duplicates;        /* superseded by a newer one for the same client and server */
+    off_t size_before;
+    off_t size_after;
+    const char *where;          /* what failed: "open", "decode", "write", "rename"... */
+    int sys_errno;              /* for CC_ERR_IO */
+};
+
+int cc_compact(const char *path, time_t now, struct cc_compact_result *res);
+#endif
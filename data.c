@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
@@ -8,140 +9,173 @@
 #include <byteswap.h>
 #include <sys/mman.h>
 #include "data.h"
+#include "io.h"
+#include "tables.h"
+#include "stats.h"
 
-#define get_and_swap(data, result, leftover, size) (getBE##size(data, result, leftover))
 
+/* Write the names of the flags set, separated by '|', or "0" if none is.
+ * The names of the flags of each byte come precomputed from flag_table, so
+ * it takes at most four copies. buf must hold FLAG_RENDER_MAX bytes; the
+ * result is not NUL terminated, its length is returned.
+ */
+size_t flag_render(char *buf, uint32_t flags) {
+    size_t len = 0;
+    int byte;
+    STATS_START(start);
 
-#define TKT_FLG_FORWARDABLE             0x40000000
-#define TKT_FLG_FORWARDED               0x20000000
-#define TKT_FLG_PROXIABLE               0x10000000
-#define TKT_FLG_PROXY                   0x08000000
-#define TKT_FLG_MAY_POSTDATE            0x04000000
-#define TKT_FLG_POSTDATED               0x02000000
-#define TKT_FLG_INVALID                 0x01000000
-#define TKT_FLG_RENEWABLE               0x00800000
-#define TKT_FLG_INITIAL                 0x00400000
-#define TKT_FLG_PRE_AUTH                0x00200000
-#define TKT_FLG_HW_AUTH                 0x00100000
-#define TKT_FLG_TRANSIT_POLICY_CHECKED  0x00080000
-#define TKT_FLG_OK_AS_DELEGATE          0x00040000
-#define TKT_FLG_ENC_PA_REP              0x00010000
-#define TKT_FLG_ANONYMOUS               0x00008000
-
+    for (byte = 0; byte < 4; byte++) {
+        const struct name_entry *e = &flag_table[byte][(flags >> (24 - byte * 8)) & 0xff];
 
-int test_flag(unsigned value, unsigned flag) {
-    return (value & flag);
+        if (e->len) {
+            memcpy(buf + len, e->str, e->len);
+            len += e->len;
+        }
+    }
+    if (!len) {
+        buf[0] = '0';
+        len = 1;
+    } else {
+        // Drop the last separator
+        len--;
+    }
+    STATS_STOP(start, flags_ns);
+    return len;
 }
 
-/* The buffer passed as argument must have memory allocated */
+/* Same as flag_render(), NUL terminated.
+ * The buffer passed as argument must have memory allocated (MAXSTRINGLEN).
+ */
 int flag_string(int flags, char *buffer) {
-	int len;
-    memset(buffer,0,MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_FORWARDABLE))
-		strlcat(buffer, "FORWARDABLE|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_FORWARDED))
-		strlcat(buffer, "FORWARDED|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_PROXIABLE))
-		strlcat(buffer, "PROXIABLE|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_PROXY))
-		strlcat(buffer, "PROXY|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_MAY_POSTDATE))
-		strlcat(buffer, "MAY_POSTDATE|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_POSTDATED))
-		strlcat(buffer, "POSTDATED|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_INVALID))
-		strlcat(buffer, "INVALID|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_RENEWABLE))
-		strlcat(buffer, "RENEWABLE|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_INITIAL))
-		strlcat(buffer, "INITIAL|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_PRE_AUTH))
-		strlcat(buffer, "PRE_AUTH|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_HW_AUTH))
-		strlcat(buffer, "HW_AUTH|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_TRANSIT_POLICY_CHECKED))
-		strlcat(buffer, "TRANSIT_POLICY_CHECKED|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_OK_AS_DELEGATE))
-		strlcat(buffer, "OK_AS_DELEGATE|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_ENC_PA_REP))
-		strlcat(buffer, "ENC_PA_REP|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_ENC_PA_REP))
-		strlcat(buffer, "ENC_PA_REP|", MAXSTRINGLEN);
-	if (test_flag(flags, TKT_FLG_ANONYMOUS))
-		strlcat(buffer, "ANONYMOUS|", MAXSTRINGLEN);
-	len = strlen(buffer);
-	if (len)
-		buffer[len - 1] = '\0';
-	else
-		strlcat(buffer, "0", MAXSTRINGLEN);
+    size_t len = flag_render(buffer, flags);
+
+    buffer[len] = '\0';
     return 0;
 }
 
 
-/* Get a single byte. This will advance the pointer of a byte and decrease th
- * leftover of the same amonut
+/* Get a single byte. This will advance the reader of a byte, refilling its
+ * window if needed.
  */
-int getBE(void **data, uint8_t *result, ssize_t *leftover) {
-    char * dataptr;
+int getBE(struct reader *r, uint8_t *result) {
     ssize_t length = 1;
-    dataptr = *data;
-    if (*leftover < length) {
+    if (r->leftover < length && reader_fill(r, length) < 0) {
         return -1;
     }
-    *result = *dataptr;
-    *data += length;
-    *leftover -= length;
+    *result = *r->ptr;
+    r->ptr += length;
+    r->leftover -= length;
+    r->offset += length;
     return 0; 
 }
 
-/* Get 16 bits (2 bytes) of data from a pointer and swap it (the ccache is in big
- * endian). This will advance the pointer of 2 bytes and decrease the leftover
- * of the same amount.
+/* Get 16 bits (2 bytes) of data from the reader and swap it (the ccache is in
+ * big endian). This will advance the reader of 2 bytes.
  */
-int getBE16(void **data, uint16_t *result, ssize_t *leftover) {
+int getBE16(struct reader *r, uint16_t *result) {
     uint16_t tmp;
-    memcpy(&tmp, *data, sizeof(tmp));
     ssize_t length = sizeof(tmp);
-    if (*leftover < length) {
+    if (r->leftover < length && reader_fill(r, length) < 0) {
         return -1;
     }
+    memcpy(&tmp, r->ptr, sizeof(tmp));
     *result = bswap_16(tmp);
-    *data += length;
-    *leftover -= length;
+    r->ptr += length;
+    r->leftover -= length;
+    r->offset += length;
     return 0; 
 }
 
-/* Get 32 bits (4 bytes) data from a pointer and swap it (the ccache is in big
- * endian). This will advance the pointer of 4 bytes and decrease the leftover
- * of the same amount.
+/* Get 32 bits (4 bytes) data from the reader and swap it (the ccache is in big
+ * endian). This will advance the reader of 4 bytes.
  */
-int getBE32(void **data, uint32_t *result, ssize_t *leftover) {
+int getBE32(struct reader *r, uint32_t *result) {
     uint32_t tmp;
-    memcpy(&tmp, *data, sizeof(tmp));
     ssize_t length = sizeof(tmp);
-    if (*leftover < length) {
+    if (r->leftover < length && reader_fill(r, length) < 0) {
         return -1;
     }
+    memcpy(&tmp, r->ptr, sizeof(tmp));
     *result = bswap_32(tmp);
-    *data += length;
-    *leftover -= length;
+    r->ptr += length;
+    r->leftover -= length;
+    r->offset += length;
     return 0; 
 }
 
-/* Get a 64 bits (8 bytes) data from a pointer and swap it (the ccache is in big
- * endian). This will advance the pointer of 8 bytes and decrease the leftover
- * of the same amount.
+/* Get a 64 bits (8 bytes) data from the reader and swap it (the ccache is in
+ * big endian). This will advance the reader of 8 bytes.
  */
-int getBE64(void **data, uint64_t *result, ssize_t *leftover) {
+int getBE64(struct reader *r, uint64_t *result) {
     uint64_t tmp;
-    memcpy(&tmp, *data, sizeof(tmp));
     ssize_t length = sizeof(tmp);
-    if (*leftover < length) {
+    if (r->leftover < length && reader_fill(r, length) < 0) {
         return -1;
     }
+    memcpy(&tmp, r->ptr, sizeof(tmp));
     *result = bswap_64(tmp);
-    *data += length;
-    *leftover -= length;
+    r->ptr += length;
+    r->leftover -= length;
+    r->offset += length;
     return 0; 
 }
 
+/* Put a single byte. Like the other put functions, it returns -1 once the
+ * writer has failed.
+ */
+int putBE(struct writer *w, uint8_t value) {
+    return writer_write(w, &value, sizeof(value));
+}
+
+/* Put 16 bits (2 bytes) in big endian */
+int putBE16(struct writer *w, uint16_t value) {
+    uint16_t tmp = bswap_16(value);
+
+    return writer_write(w, &tmp, sizeof(tmp));
+}
+
+/* Put 32 bits (4 bytes) in big endian */
+int putBE32(struct writer *w, uint32_t value) {
+    uint32_t tmp = bswap_32(value);
+
+    return writer_write(w, &tmp, sizeof(tmp));
+}
+
+/* Put 64 bits (8 bytes) in big endian */
+int putBE64(struct writer *w, uint64_t value) {
+    uint64_t tmp = bswap_64(value);
+
+    return writer_write(w, &tmp, sizeof(tmp));
+}
+
+/* Put a counted octet string: its length, then its bytes */
+int put_data(struct writer *w, const struct data *data) {
+    if (putBE32(w, data->length) < 0) {
+        return -1;
+    }
+    return writer_write(w, data->value, data->length);
+}
+
+/* Copy the value of a borrowed data view into memory owned by the caller, so
+ * that it outlives the mapping it points into. The copy must be released with
+ * data_free().
+ */
+int data_dup(const struct data *src, struct data *dst) {
+    char *value;
+
+    value = malloc(src->length ? src->length : 1);
+    if (!value) {
+        return -1;
+    }
+    memcpy(value, src->value, src->length);
+    dst->length = src->length;
+    dst->value = value;
+    return 0;
+}
+
+/* Release a value obtained with data_dup() */
+void data_free(struct data *dt) {
+    free((void *) dt->value);
+    dt->value = NULL;
+    dt->length = 0;
+}
@@ -3,42 +3,108 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+#include <byteswap.h>
+#include "io.h"
 
 
 #define MAXSTRINGLEN                    1024
+#define ENABLE_ERROR_LOG                0
+
+#if ENABLE_ERROR_LOG
+#include <stdio.h>
+extern const char* __progname;
+#define LOG(x, ...) \
+do \
+    { \
+        printf("%s: ", __progname); \
+        printf(x, __VA_ARGS__); \
+    } \
+while (0)
+#else
+#define LOG(x, ...) \
+do ;\
+while (0)
+#endif
 
-#define get_and_swap(data, result, leftover, size) (getBE##size(data, result, leftover))
-
-int getBE(void **data, uint8_t *result, ssize_t *leftover);
-int getBE16(void **data, uint16_t *result, ssize_t *leftover);
-int getBE32(void **data, uint32_t *result, ssize_t *leftover);
-int getBE64(void **data, uint64_t *result, ssize_t *leftover);
+#define TKT_FLG_FORWARDABLE             0x40000000
+#define TKT_FLG_FORWARDED               0x20000000
+#define TKT_FLG_PROXIABLE               0x10000000
+#define TKT_FLG_PROXY                   0x08000000
+#define TKT_FLG_MAY_POSTDATE            0x04000000
+#define TKT_FLG_POSTDATED               0x02000000
+#define TKT_FLG_INVALID                 0x01000000
+#define TKT_FLG_RENEWABLE               0x00800000
+#define TKT_FLG_INITIAL                 0x00400000
+#define TKT_FLG_PRE_AUTH                0x00200000
+#define TKT_FLG_HW_AUTH                 0x00100000
+#define TKT_FLG_TRANSIT_POLICY_CHECKED  0x00080000
+#define TKT_FLG_OK_AS_DELEGATE          0x00040000
+#define TKT_FLG_ENC_PA_REP              0x00010000
+#define TKT_FLG_ANONYMOUS               0x00008000
+
+#define get_and_swap(reader, result, size) (getBE##size(reader, result))
+
+struct data;
+
+int getBE(struct reader *r, uint8_t *result);
+int getBE16(struct reader *r, uint16_t *result);
+int getBE32(struct reader *r, uint32_t *result);
+int getBE64(struct reader *r, uint64_t *result);
+int putBE(struct writer *w, uint8_t value);
+int putBE16(struct writer *w, uint16_t value);
+int putBE32(struct writer *w, uint32_t value);
+int putBE64(struct writer *w, uint64_t value);
+int put_data(struct writer *w, const struct data *data);
 int flag_string(int flags, char *buffer);
 
+/* Unchecked big endian loads, for bytes already known to be in the window */
+static inline uint16_t loadBE16(const uint8_t *p) {
+    uint16_t tmp;
+
+    memcpy(&tmp, p, sizeof(tmp));
+    return bswap_16(tmp);
+}
+
+static inline uint32_t loadBE32(const uint8_t *p) {
+    uint32_t tmp;
+
+    memcpy(&tmp, p, sizeof(tmp));
+    return bswap_32(tmp);
+}
+int data_dup(const struct data *src, struct data *dst);
+void data_free(struct data *dt);
+
 
 struct field {
     uint16_t tag;
     uint16_t length;
     uint32_t time1;
     uint32_t time2;
-}__attribute__((packed));
+};
 
 struct header {
     uint16_t length;
     struct field field; 
-}__attribute__((packed));
+};
 
+/* A (pointer, length) view of a counted octet string in the ccache.
+ * The value is not NUL terminated. When the file is mapped it is borrowed
+ * from the mapping, when it is streamed it is copied in the arena of the
+ * record: either way it is valid only until that arena is reset. Use
+ * data_dup() to get a copy owned by the caller.
+ */
 struct data {
     uint32_t length;
-    char * value;
-}__attribute__((packed));
+    const char *value;
+};
 
 struct principal {
     uint32_t name_type;
     uint32_t comp_count;
-    struct data *realm;
-    struct data **components;
-}__attribute__((packed));
+    struct data realm;
+    struct data *components;
+};
 
 
 struct keyblock {
@@ -77,7 +143,7 @@ struct credential {
     uint8_t is_skey;
     uint32_t ticket_flags;
     struct addresses addresses;
-    struct authdata authdata;
+    struct authdatas authdatas;
     struct data ticket;
     struct data second_ticket;
 };
@@ -0,0 +1,233 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "encode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ENCODE_X86                      1
+#else
+#define ENCODE_X86                      0
+#endif
+
+#define KERNEL_SCALAR                   0
+#define KERNEL_SSE2                     1
+#define KERNEL_AVX2                     2
+
+/* A kernel encodes whole blocks from the start of src, and returns how many
+ * bytes it did; the rest is left to the plain C loop.
+ */
+typedef size_t (*encode_fn)(char *dst, const uint8_t *src, size_t length);
+
+static const char hex_digits[] = "0123456789abcdef";
+static const char base64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static pthread_once_t encode_once = PTHREAD_ONCE_INIT;
+static encode_fn hex_kernel;
+static encode_fn base64_kernel;
+static const char *kernel_name = "scalar";
+
+#if ENCODE_X86
+/* Hex: each nibble becomes '0' + n, plus the gap to 'a' when n > 9, then
+ * the high and low digits are interleaved.
+ */
+__attribute__((target("sse2")))
+static size_t hex_sse2(char *dst, const uint8_t *src, size_t length) {
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i gap = _mm_set1_epi8('a' - '0' - 10);
+    __m128i in, hi, lo;
+    size_t i;
+
+    for (i = 0; i + 16 <= length; i += 16) {
+        in = _mm_loadu_si128((const __m128i *) (src + i));
+        hi = _mm_and_si128(_mm_srli_epi16(in, 4), mask);
+        lo = _mm_and_si128(in, mask);
+        hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), gap));
+        lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), gap));
+        _mm_storeu_si128((__m128i *) (dst + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *) (dst + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t hex_avx2(char *dst, const uint8_t *src, size_t length) {
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i gap = _mm256_set1_epi8('a' - '0' - 10);
+    __m256i in, hi, lo, first, second;
+    size_t i;
+
+    for (i = 0; i + 32 <= length; i += 32) {
+        in = _mm256_loadu_si256((const __m256i *) (src + i));
+        hi = _mm256_and_si256(_mm256_srli_epi16(in, 4), mask);
+        lo = _mm256_and_si256(in, mask);
+        hi = _mm256_add_epi8(_mm256_add_epi8(hi, zero), _mm256_and_si256(_mm256_cmpgt_epi8(hi, nine), gap));
+        lo = _mm256_add_epi8(_mm256_add_epi8(lo, zero), _mm256_and_si256(_mm256_cmpgt_epi8(lo, nine), gap));
+        // The unpacks work within the 128 bit lanes: put the halves back in order
+        first = _mm256_unpacklo_epi8(hi, lo);
+        second = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *) (dst + 2 * i), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i *) (dst + 2 * i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    return i;
+}
+
+/* Base64, after Wojciech Muła: the 3 byte groups are spread to 4 bytes with
+ * a shuffle, the 6 bit indexes are moved in place with multiplies, and a
+ * second shuffle gives the offset from each index to its character.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i base64_block_ssse3(__m128i in) {
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
+    __m128i t0, t1, t2, t3, indexes, classes;
+
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    indexes = _mm_or_si128(t1, t3);
+
+    // 0-25 -> 13, 26-51 -> 0, 52-61 -> 1-10, 62 -> 11, 63 -> 12
+    classes = _mm_subs_epu8(indexes, _mm_set1_epi8(51));
+    classes = _mm_or_si128(classes, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indexes),
+                                                  _mm_set1_epi8(13)));
+    return _mm_add_epi8(indexes, _mm_shuffle_epi8(offsets, classes));
+}
+
+// 12 bytes to 16 characters at a time, loading 16
+__attribute__((target("ssse3")))
+static size_t base64_ssse3(char *dst, const uint8_t *src, size_t length) {
+    size_t i, o = 0;
+
+    for (i = 0; i + 16 <= length; i += 12, o += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *) (src + i));
+
+        _mm_storeu_si128((__m128i *) (dst + o), base64_block_ssse3(in));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t base64_avx2(char *dst, const uint8_t *src, size_t length) {
+    const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0);
+    const __m256i spread = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                           10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    __m256i in, t0, t1, t2, t3, indexes, classes;
+    size_t i, o = 0;
+
+    // 24 bytes to 32 characters at a time: 12 in each lane, loading 28
+    for (i = 0; i + 28 <= length; i += 24, o += 32) {
+        in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (src + i))),
+                                     _mm_loadu_si128((const __m128i *) (src + i + 12)), 1);
+        in = _mm256_shuffle_epi8(in, spread);
+        t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        indexes = _mm256_or_si256(t1, t3);
+        classes = _mm256_subs_epu8(indexes, _mm256_set1_epi8(51));
+        classes = _mm256_or_si256(classes, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indexes),
+                                                            _mm256_set1_epi8(13)));
+        _mm256_storeu_si256((__m256i *) (dst + o), _mm256_add_epi8(indexes, _mm256_shuffle_epi8(offsets, classes)));
+    }
+    return i;
+}
+#endif
+
+static void encode_choose(void) {
+    const char *env = getenv("CCCACHE_ENCODE");
+    int level = KERNEL_AVX2;
+
+    if (env) {
+        level = !strcmp(env, "avx2") ? KERNEL_AVX2 : !strcmp(env, "sse2") ? KERNEL_SSE2 : KERNEL_SCALAR;
+    }
+#if ENCODE_X86
+    __builtin_cpu_init();
+    if (level >= KERNEL_AVX2 && __builtin_cpu_supports("avx2")) {
+        hex_kernel = hex_avx2;
+        base64_kernel = base64_avx2;
+        kernel_name = "avx2";
+    } else if (level >= KERNEL_SSE2 && __builtin_cpu_supports("sse2")) {
+        hex_kernel = hex_sse2;
+        kernel_name = "sse2";
+        if (__builtin_cpu_supports("ssse3")) {
+            base64_kernel = base64_ssse3;
+            kernel_name = "ssse3";
+        }
+    }
+#else
+    (void) level;
+#endif
+}
+
+/* Write length bytes as 2 * length hex digits (not NUL terminated).
+ * Returns the characters written.
+ */
+size_t hex_encode(char *dst, const void *src, size_t length) {
+    const uint8_t *in = src;
+    size_t i = 0;
+
+    pthread_once(&encode_once, encode_choose);
+    if (hex_kernel) {
+        i = hex_kernel(dst, in, length);
+    }
+    for (; i < length; i++) {
+        dst[2 * i] = hex_digits[in[i] >> 4];
+        dst[2 * i + 1] = hex_digits[in[i] & 0x0f];
+    }
+    return HEX_LENGTH(length);
+}
+
+/* Write length bytes in base64, padded with '=' (not NUL terminated).
+ * Returns the characters written, BASE64_LENGTH(length).
+ */
+size_t base64_encode(char *dst, const void *src, size_t length) {
+    const uint8_t *in = src;
+    size_t i = 0;
+    char *p;
+
+    pthread_once(&encode_once, encode_choose);
+    if (base64_kernel) {
+        i = base64_kernel(dst, in, length);
+    }
+    p = dst + i / 3 * 4;
+    for (; i + 3 <= length; i += 3) {
+        *p++ = base64_alphabet[in[i] >> 2];
+        *p++ = base64_alphabet[(in[i] & 0x03) << 4 | in[i + 1] >> 4];
+        *p++ = base64_alphabet[(in[i + 1] & 0x0f) << 2 | in[i + 2] >> 6];
+        *p++ = base64_alphabet[in[i + 2] & 0x3f];
+    }
+    if (i < length) {
+        *p++ = base64_alphabet[in[i] >> 2];
+        if (i + 1 < length) {
+            *p++ = base64_alphabet[(in[i] & 0x03) << 4 | in[i + 1] >> 4];
+            *p++ = base64_alphabet[(in[i + 1] & 0x0f) << 2];
+        } else {
+            *p++ = base64_alphabet[(in[i] & 0x03) << 4];
+            *p++ = '=';
+        }
+        *p++ = '=';
+    }
+    return p - dst;
+}
+
+// The kernels in use, for the benchmarks
+const char *encode_kernel(void) {
+    pthread_once(&encode_once, encode_choose);
+    return kernel_name;
+}
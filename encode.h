@@ -0,0 +1,28 @@
+#ifndef ENCODE_H_INCLUDED
+#define ENCODE_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* How the binary payloads are dumped (-v, --dump) */
+#define ENCODE_NONE                     0
+#define ENCODE_HEX                      1       /* lowercase */
+#define ENCODE_BASE64                   2       /* RFC 4648, padded */
+
+#define HEX_LENGTH(n)                   ((n) * 2)
+#define BASE64_LENGTH(n)                (((n) + 2) / 3 * 4)
+
+/* Bytes encoded at a time into an output buffer: a multiple of 3, so that
+ * only the last piece of a base64 value is padded.
+ */
+#define ENCODE_CHUNK                    (3 * 16384)
+
+/* The kernels are chosen once, from what the CPU supports: AVX2, then SSE2
+ * (SSSE3 for base64, which needs a byte shuffle), then plain C. The
+ * CCCACHE_ENCODE environment variable (avx2, sse2 or scalar) can lower the
+ * choice, to compare them.
+ */
+size_t hex_encode(char *dst, const void *src, size_t length);
+size_t base64_encode(char *dst, const void *src, size_t length);
+const char *encode_kernel(void);
+#endif
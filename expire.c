@@ -0,0 +1,482 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "data.h"
+#include "arena.h"
+#include "parser.h"
+#include "print.h"
+#include "timefmt.h"
+#include "expire.h"
+
+static const char *const event_names[EXPIRE_EVENTS] = {
+    "expiring", "expired", "renew_expiring", "renew_expired"
+};
+
+int expire_init(struct expire *e, struct outbuf *out, const struct print_options *opts,
+                uint32_t warn, unsigned interval, const char *hook) {
+    memset(e, 0, sizeof(*e));
+    e->out = out;
+    e->opts = *opts;
+    // A stream of events, like the watch mode
+    if (e->opts.format == PRINT_JSON) {
+        e->opts.format = PRINT_NDJSON;
+    }
+    e->warn = warn;
+    e->interval = interval ? interval : EXPIRE_INTERVAL;
+    e->hook = hook;
+    return out_init(&e->buf, -1, 0);
+}
+
+int expire_add(struct expire *e, const char *path) {
+    struct expire_file *f;
+
+    if (e->count == e->size) {
+        size_t size = e->size ? e->size * 2 : 8;
+        struct expire_file *files = realloc(e->files, size * sizeof(struct expire_file));
+
+        if (!files) {
+            return -1;
+        }
+        e->files = files;
+        e->size = size;
+    }
+    f = &e->files[e->count];
+    memset(f, 0, sizeof(*f));
+    f->path = strdup(path);
+    if (!f->path) {
+        return -1;
+    }
+    arena_init(&f->names, ARENA_DEFAULT_BLOCK);
+    e->count++;
+    return 0;
+}
+
+/* The heap is ordered on the deadline, then on the event so that "expiring"
+ * comes before "expired" when there is no warning delay.
+ */
+static int entry_before(const struct expire_entry *a, const struct expire_entry *b) {
+    return a->deadline < b->deadline || (a->deadline == b->deadline && a->event < b->event);
+}
+
+static void heap_up(struct expire *e, size_t i) {
+    struct expire_entry entry = e->heap[i];
+
+    while (i) {
+        size_t parent = (i - 1) / 2;
+
+        if (!entry_before(&entry, &e->heap[parent])) {
+            break;
+        }
+        e->heap[i] = e->heap[parent];
+        i = parent;
+    }
+    e->heap[i] = entry;
+}
+
+static void heap_down(struct expire *e, size_t i) {
+    struct expire_entry entry = e->heap[i];
+    size_t child;
+
+    while ((child = 2 * i + 1) < e->heap_count) {
+        if (child + 1 < e->heap_count && entry_before(&e->heap[child + 1], &e->heap[child])) {
+            child++;
+        }
+        if (!entry_before(&e->heap[child], &entry)) {
+            break;
+        }
+        e->heap[i] = e->heap[child];
+        i = child;
+    }
+    e->heap[i] = entry;
+}
+
+static int heap_push(struct expire *e, uint32_t deadline, uint32_t event, uint32_t file, uint32_t cred) {
+    if (e->heap_count == e->heap_size) {
+        size_t size = e->heap_size ? e->heap_size * 2 : 64;
+        struct expire_entry *heap = realloc(e->heap, size * sizeof(struct expire_entry));
+
+        if (!heap) {
+            return -1;
+        }
+        e->heap = heap;
+        e->heap_size = size;
+    }
+    e->heap[e->heap_count] = (struct expire_entry) { deadline, event, file, cred };
+    heap_up(e, e->heap_count++);
+    return 0;
+}
+
+static struct expire_entry heap_pop(struct expire *e) {
+    struct expire_entry top = e->heap[0];
+
+    e->heap[0] = e->heap[--e->heap_count];
+    if (e->heap_count) {
+        heap_down(e, 0);
+    }
+    return top;
+}
+
+// Remove the events of a file, and restore the heap in linear time
+static void heap_drop_file(struct expire *e, uint32_t file) {
+    size_t i, n = 0;
+
+    for (i = 0; i < e->heap_count; i++) {
+        if (e->heap[i].file != file) {
+            e->heap[n++] = e->heap[i];
+        }
+    }
+    e->heap_count = n;
+    for (i = n / 2; i-- > 0; ) {
+        heap_down(e, i);
+    }
+}
+
+/* The events of a file not handled yet: those after the time the heap was
+ * last emptied up to, even if they came due while the file was being read
+ * again or a hook was running.
+ */
+static int expire_schedule(struct expire *e, uint32_t file) {
+    const struct expire_file *f = &e->files[file];
+    uint32_t i, ev, deadlines[EXPIRE_EVENTS];
+
+    for (i = 0; i < f->count; i++) {
+        const struct expire_cred *c = &f->creds[i];
+
+        deadlines[EXPIRE_EXPIRING] = c->endtime > e->warn ? c->endtime - e->warn : 0;
+        deadlines[EXPIRE_EXPIRED] = c->endtime;
+        deadlines[EXPIRE_RENEW_EXPIRING] = c->renew_till > e->warn ? c->renew_till - e->warn : 0;
+        deadlines[EXPIRE_RENEW_EXPIRED] = c->renew_till;
+        for (ev = 0; ev < EXPIRE_EVENTS; ev++) {
+            if (deadlines[ev] <= e->processed) {
+                continue;
+            }
+            if ((ev == EXPIRE_EXPIRING || ev == EXPIRE_RENEW_EXPIRING) && !e->warn) {
+                continue;
+            }
+            if (heap_push(e, deadlines[ev], ev, file, i) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// A principal as printed, in the names arena
+static char *name_principal(struct expire *e, struct arena *names, const struct principal *princ) {
+    char *name;
+
+    e->buf.len = 0;
+    print_principal(&e->buf, princ);
+    if (e->buf.error) {
+        return NULL;
+    }
+    name = arena_alloc(names, e->buf.len + 1);
+    if (name) {
+        memcpy(name, e->buf.buf, e->buf.len);
+        name[e->buf.len] = '\0';
+    }
+    return name;
+}
+
+static void expire_error(struct expire *e, struct expire_file *f, struct ccache *cc, int err) {
+    if (f->error == err) {
+        return;
+    }
+    f->error = err;
+    if (e->opts.format == PRINT_TEXT) {
+        print_error(e->out, &e->opts, f->path, cc, err);
+        return;
+    }
+    out_lit(e->out, "{\"file\":");
+    out_json_str(e->out, f->path, strlen(f->path));
+    out_char(e->out, ',');
+    print_error(e->out, &e->opts, f->path, cc, err);
+    out_lit(e->out, "}\n");
+}
+
+/* Decode the times of all the credentials of a file, and replace its events.
+ * On failure the events known from the last read are kept.
+ */
+static void expire_read(struct expire *e, uint32_t file, const struct stat *st) {
+    struct expire_file *f = &e->files[file];
+    struct expire_cred *creds = NULL;
+    struct credential *cred;
+    struct ccache *cc;
+    struct arena names;
+    size_t count = 0, size = 0;
+    int ret;
+
+    arena_init(&names, ARENA_DEFAULT_BLOCK);
+    // Read, not mapped: a renewal can rewrite the file under us
+    ret = cc_load(&cc, f->path, &e->data, &e->data_size);
+    if (ret == CC_OK) {
+        cc_set_filter(cc, e->opts.filter);
+        // Only the principals and times are needed
+        cc_set_summary(cc, 1);
+    }
+    while (ret == CC_OK && (ret = cc_next(cc, &cred)) == CC_OK) {
+        struct expire_cred *c;
+
+        if (count == size) {
+            size = size ? size * 2 : 16;
+            c = realloc(creds, size * sizeof(struct expire_cred));
+            if (!c) {
+                ret = CC_ERR_NOMEM;
+                break;
+            }
+            creds = c;
+        }
+        c = &creds[count];
+        c->client = name_principal(e, &names, &cred->client);
+        c->server = name_principal(e, &names, &cred->server);
+        if (!c->client || !c->server) {
+            ret = CC_ERR_NOMEM;
+            break;
+        }
+        c->endtime = cred->endtime;
+        c->renew_till = cred->ticket_flags & TKT_FLG_RENEWABLE ? cred->renew_till : 0;
+        count++;
+    }
+
+    // Caught while it is being written: tried again on the next look
+    if (ret < 0) {
+        if (ret == CC_ERR_IO && cc && cc->sys_errno == ENOENT) {
+            f->error = 0;
+        } else if (ret != CC_ERR_TRUNCATED) {
+            expire_error(e, f, cc, ret);
+        }
+        f->read = 0;
+        free(creds);
+        arena_free(&names);
+        cc_close(cc);
+        return;
+    }
+    cc_close(cc);
+
+    heap_drop_file(e, file);
+    free(f->creds);
+    arena_free(&f->names);
+    f->creds = creds;
+    f->count = count;
+    f->creds_size = size;
+    f->names = names;
+    f->error = 0;
+    f->read = 1;
+    f->mtime = st->st_mtim;
+    f->size = st->st_size;
+    f->dev = st->st_dev;
+    f->ino = st->st_ino;
+    if (expire_schedule(e, file) < 0) {
+        expire_error(e, f, NULL, CC_ERR_NOMEM);
+    }
+}
+
+// Read again the files whose mtime changed since their last read
+static void expire_check(struct expire *e) {
+    struct stat st;
+    size_t i;
+
+    for (i = 0; i < e->count; i++) {
+        struct expire_file *f = &e->files[i];
+
+        if (stat(f->path, &st) < 0) {
+            // Destroyed, or out of reach: nothing left to expire
+            if (f->read) {
+                heap_drop_file(e, i);
+                f->count = 0;
+                f->read = 0;
+            }
+            continue;
+        }
+        if (f->read && st.st_mtim.tv_sec == f->mtime.tv_sec &&
+            st.st_mtim.tv_nsec == f->mtime.tv_nsec && st.st_size == f->size &&
+            st.st_dev == f->dev && st.st_ino == f->ino) {
+            continue;
+        }
+        expire_read(e, i, &st);
+    }
+}
+
+static void print_event_time(struct expire *e, const char *name, uint32_t time) {
+    char timebuf[TIME_BUFSIZE];
+
+    out_lit(e->out, ",\"");
+    out_str(e->out, name);
+    out_lit(e->out, "\":");
+    if (e->opts.time_mode == TIMEFMT_RAW) {
+        out_u64(e->out, time);
+    } else {
+        out_char(e->out, '"');
+        out_mem(e->out, timebuf, time_format(timebuf, time, e->opts.time_mode));
+        out_char(e->out, '"');
+    }
+}
+
+static void print_event(struct expire *e, const struct expire_entry *entry) {
+    const struct expire_file *f = &e->files[entry->file];
+    const struct expire_cred *c = &f->creds[entry->cred];
+    char timebuf[TIME_BUFSIZE];
+
+    if (e->opts.format == PRINT_TEXT) {
+        out_mem(e->out, timebuf, time_format(timebuf, entry->deadline, e->opts.time_mode));
+        out_lit(e->out, ": ");
+        out_str(e->out, event_names[entry->event]);
+        out_char(e->out, ' ');
+        out_str(e->out, c->server);
+        out_lit(e->out, " for ");
+        out_str(e->out, c->client);
+        out_lit(e->out, " in ");
+        out_str(e->out, f->path);
+        out_char(e->out, '\n');
+        return;
+    }
+    out_lit(e->out, "{\"event\":\"");
+    out_str(e->out, event_names[entry->event]);
+    out_char(e->out, '"');
+    print_event_time(e, "time", entry->deadline);
+    out_lit(e->out, ",\"file\":");
+    out_json_str(e->out, f->path, strlen(f->path));
+    out_lit(e->out, ",\"client\":");
+    out_json_str(e->out, c->client, strlen(c->client));
+    out_lit(e->out, ",\"server\":");
+    out_json_str(e->out, c->server, strlen(c->server));
+    print_event_time(e, "endtime", c->endtime);
+    print_event_time(e, "renew_till", c->renew_till);
+    out_lit(e->out, "}\n");
+}
+
+/* Run the hook with the event in its environment:
+ *   CCCACHE_EVENT      expiring, expired, renew_expiring or renew_expired
+ *   CCCACHE_FILE, CCCACHE_CLIENT, CCCACHE_SERVER
+ *   CCCACHE_TIME, CCCACHE_ENDTIME, CCCACHE_RENEW_TILL  seconds since the epoch
+ * The events are handled one at a time: the hook is waited for.
+ */
+static void run_hook(struct expire *e, const struct expire_entry *entry) {
+    const struct expire_file *f = &e->files[entry->file];
+    const struct expire_cred *c = &f->creds[entry->cred];
+    char deadline[16], endtime[16], renew_till[16];
+    int status;
+    pid_t pid;
+
+    snprintf(deadline, sizeof(deadline), "%u", entry->deadline);
+    snprintf(endtime, sizeof(endtime), "%u", c->endtime);
+    snprintf(renew_till, sizeof(renew_till), "%u", c->renew_till);
+    out_flush(e->out);
+    pid = fork();
+    if (pid == 0) {
+        if (setenv("CCCACHE_EVENT", event_names[entry->event], 1) < 0 ||
+            setenv("CCCACHE_FILE", f->path, 1) < 0 ||
+            setenv("CCCACHE_CLIENT", c->client, 1) < 0 ||
+            setenv("CCCACHE_SERVER", c->server, 1) < 0 ||
+            setenv("CCCACHE_TIME", deadline, 1) < 0 ||
+            setenv("CCCACHE_ENDTIME", endtime, 1) < 0 ||
+            setenv("CCCACHE_RENEW_TILL", renew_till, 1) < 0) {
+            _exit(127);
+        }
+        execl("/bin/sh", "sh", "-c", e->hook, (char *) NULL);
+        _exit(127);
+    }
+    while (pid > 0 && waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            pid = -1;
+        }
+    }
+    if (pid > 0 && WIFEXITED(status) && !WEXITSTATUS(status)) {
+        return;
+    }
+
+    e->buf.len = 0;
+    if (pid < 0) {
+        out_lit(&e->buf, "Error running the hook: ");
+        out_str(&e->buf, strerror(errno));
+    } else if (WIFEXITED(status)) {
+        out_lit(&e->buf, "Hook failed with exit status ");
+        out_u64(&e->buf, WEXITSTATUS(status));
+    } else {
+        out_lit(&e->buf, "Hook killed by signal ");
+        out_u64(&e->buf, WTERMSIG(status));
+    }
+    if (e->opts.format == PRINT_TEXT) {
+        out_buf(e->out, &e->buf);
+        out_lit(e->out, " for ");
+        out_str(e->out, event_names[entry->event]);
+        out_char(e->out, ' ');
+        out_str(e->out, c->server);
+        out_lit(e->out, " in ");
+        out_str(e->out, f->path);
+        out_char(e->out, '\n');
+    } else {
+        out_lit(e->out, "{\"file\":");
+        out_json_str(e->out, f->path, strlen(f->path));
+        out_lit(e->out, ",\"error\":");
+        out_json_str(e->out, e->buf.buf, e->buf.len);
+        out_lit(e->out, "}\n");
+    }
+}
+
+/* Handle the events as their deadlines come. The files are looked at every
+ * interval seconds, and read again only if they changed: the events of a
+ * ccache renewed or replaced are then the ones of its new credentials. The
+ * deadlines already passed at the start are not reported, but those that
+ * come due while a file is read again or a hook runs are, late.
+ * Only returns on failure, with errno set.
+ */
+int expire_run(struct expire *e) {
+    time_t now, next_check = 0, wake;
+    struct timespec ts;
+
+    e->processed = time(NULL);
+    for (;;) {
+        now = time(NULL);
+        if (now >= next_check) {
+            expire_check(e);
+            next_check = now + e->interval;
+        }
+        while (e->heap_count && e->heap[0].deadline <= now) {
+            struct expire_entry entry = heap_pop(e);
+
+            if (e->hook) {
+                run_hook(e, &entry);
+            } else {
+                print_event(e, &entry);
+            }
+        }
+        e->processed = now;
+        if (out_flush(e->out) < 0) {
+            return -1;
+        }
+
+        wake = next_check;
+        if (e->heap_count && e->heap[0].deadline < wake) {
+            wake = e->heap[0].deadline;
+        }
+        if (wake > now) {
+            ts.tv_sec = wake - now;
+            ts.tv_nsec = 0;
+            if (nanosleep(&ts, NULL) < 0 && errno != EINTR) {
+                return -1;
+            }
+        }
+    }
+}
+
+void expire_free(struct expire *e) {
+    size_t i;
+
+    for (i = 0; i < e->count; i++) {
+        free(e->files[i].path);
+        free(e->files[i].creds);
+        arena_free(&e->files[i].names);
+    }
+    free(e->files);
+    free(e->heap);
+    free(e->data);
+    out_free(&e->buf);
+}
@@ -0,0 +1,81 @@
+#ifndef EXPIRE_H_INCLUDED
+#define EXPIRE_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include "arena.h"
+#include "out.h"
+#include "print.h"
+
+/* Events of a credential, in the order they happen */
+#define EXPIRE_EXPIRING                 0       /* endtime - warn */
+#define EXPIRE_EXPIRED                  1       /* endtime */
+#define EXPIRE_RENEW_EXPIRING           2       /* renew_till - warn, renewable only */
+#define EXPIRE_RENEW_EXPIRED            3       /* renew_till, renewable only */
+#define EXPIRE_EVENTS                   4
+
+#define EXPIRE_INTERVAL                 60      /* seconds between two stat() of the files */
+
+/* What an event needs of a credential, kept between two reads of its file */
+struct expire_cred {
+    char *client;
+    char *server;
+    uint32_t endtime;
+    uint32_t renew_till;
+};
+
+/* A scheduled ccache. It is read again only when its mtime, size or inode
+ * change.
+ */
+struct expire_file {
+    char *path;
+    int read;                   /* mtime, size and inode are those of the last read */
+    int error;                  /* last failure printed, not repeated */
+    struct timespec mtime;
+    off_t size;
+    dev_t dev;
+    ino_t ino;
+    struct expire_cred *creds;
+    size_t count;
+    size_t creds_size;
+    struct arena names;         /* client and server names of creds */
+};
+
+/* An event to come, in the heap */
+struct expire_entry {
+    uint32_t deadline;
+    uint32_t event;
+    uint32_t file;
+    uint32_t cred;
+};
+
+/* Min-heap of the events to come across all the files, on their deadline.
+ * The process sleeps until the first one, or until the files are to be looked
+ * at again. An event is printed, or given to a hook run with /bin/sh -c.
+ */
+struct expire {
+    struct expire_file *files;
+    size_t count;
+    size_t size;
+    struct expire_entry *heap;
+    size_t heap_count;
+    size_t heap_size;
+    time_t processed;           /* events up to this time were handled */
+    uint32_t warn;              /* seconds before endtime and renew_till */
+    unsigned interval;          /* seconds between two looks at the files */
+    const char *hook;           /* NULL to print the events */
+    struct outbuf *out;
+    struct print_options opts;
+    struct outbuf buf;          /* principal being named */
+    uint8_t *data;              /* file being read, not mapped */
+    size_t data_size;
+};
+
+int expire_init(struct expire *e, struct outbuf *out, const struct print_options *opts,
+                uint32_t warn, unsigned interval, const char *hook);
+int expire_add(struct expire *e, const char *path);
+int expire_run(struct expire *e);
+void expire_free(struct expire *e);
+#endif
@@ -0,0 +1,316 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "data.h"
+#include "parser.h"
+#include "print.h"
+#include "intern.h"
+#include "ccol.h"
+#include "export.h"
+
+#define CCOL_NAME(id, name, type) name,
+static const char *const column_names[CCOL_COUNT] = {
+    CCOL_COLUMNS(CCOL_NAME)
+};
+#undef CCOL_NAME
+
+#define CCOL_TYPE(id, name, type) type,
+static const uint32_t column_types[CCOL_COUNT] = {
+    CCOL_COLUMNS(CCOL_TYPE)
+};
+#undef CCOL_TYPE
+
+// A little-endian integer of width bytes
+static void store_le(uint8_t *p, uint64_t value, int width) {
+    int i;
+
+    for (i = 0; i < width; i++) {
+        p[i] = value >> (8 * i);
+    }
+}
+
+static void put_le(struct outbuf *o, uint64_t value, int width) {
+    uint8_t bytes[8];
+
+    store_le(bytes, value, width);
+    out_mem(o, bytes, width);
+}
+
+int export_init(struct export *x, struct outbuf *out, const struct print_options *opts) {
+    int i;
+
+    memset(x, 0, sizeof(*x));
+    x->out = out;
+    x->opts = opts;
+    for (i = 0; i < CCOL_COUNT; i++) {
+        if (out_init(&x->columns[i], -1, 0) < 0) {
+            while (i--) {
+                out_free(&x->columns[i]);
+            }
+            return -1;
+        }
+    }
+    cc_names_init(&x->names);
+    cc_intern_init(&x->files);
+    put_le(&x->columns[CCOL_TICKET_OFFSETS], 0, 8);
+    return 0;
+}
+
+static int export_credential(struct export *x, uint32_t file, const struct credential *cred) {
+    struct outbuf *col = x->columns;
+    uint32_t client, server;
+    int rc;
+
+    rc = cc_names_principal(&x->names, &cred->client, &client);
+    if (rc == CC_OK) {
+        rc = cc_names_principal(&x->names, &cred->server, &server);
+    }
+    if (rc < 0) {
+        return rc;
+    }
+    put_le(&col[CCOL_FILE], file, 4);
+    put_le(&col[CCOL_CLIENT], client, 4);
+    put_le(&col[CCOL_SERVER], server, 4);
+    put_le(&col[CCOL_AUTHTIME], cred->authtime, 4);
+    put_le(&col[CCOL_STARTTIME], cred->starttime, 4);
+    put_le(&col[CCOL_ENDTIME], cred->endtime, 4);
+    put_le(&col[CCOL_RENEW_TILL], cred->renew_till, 4);
+    put_le(&col[CCOL_TICKET_FLAGS], cred->ticket_flags, 4);
+    put_le(&col[CCOL_ENCTYPE], cred->keyblock.enctype, 2);
+    put_le(&col[CCOL_IS_SKEY], cred->is_skey, 1);
+    out_mem(&col[CCOL_TICKETS], cred->ticket.value, cred->ticket.length);
+    x->ticket_bytes += cred->ticket.length;
+    put_le(&col[CCOL_TICKET_OFFSETS], x->ticket_bytes, 8);
+    x->rows++;
+    return CC_OK;
+}
+
+/* Add the credentials of a file (those matching the filter) to the export.
+ * Returns 0, or the CC_ERR_* code of the failure, once printed. The
+ * credentials before a failure are kept.
+ */
+int export_add(struct export *x, const char *filename) {
+    struct ccache *cc;
+    struct credential *cred;
+    uint32_t file;
+    int ret;
+
+    ret = cc_intern(&x->files, filename, strlen(filename), &file);
+    if (ret == CC_OK) {
+        ret = cc_open(&cc, filename);
+    } else {
+        cc = NULL;
+    }
+    if (ret == CC_OK) {
+        cc_set_filter(cc, x->opts->filter);
+        while ((ret = cc_next(cc, &cred)) == CC_OK) {
+            ret = export_credential(x, file, cred);
+            if (ret < 0) {
+                break;
+            }
+        }
+    }
+    if (ret < 0) {
+        if (x->opts->format == PRINT_TEXT) {
+            out_lit(x->out, "-- File: ");
+            out_str(x->out, filename);
+            out_char(x->out, '\n');
+        } else {
+            out_lit(x->out, "{\"file\":");
+            out_json_str(x->out, filename, strlen(filename));
+            out_char(x->out, ',');
+        }
+        print_error(x->out, x->opts, filename, cc, ret);
+        if (x->opts->format != PRINT_TEXT) {
+            out_lit(x->out, "}\n");
+        }
+    }
+    cc_close(cc);
+    return ret < 0 ? ret : 0;
+}
+
+// The dictionaries: principals as printed, and file names
+static void export_dictionaries(struct export *x) {
+    struct outbuf *col = x->columns;
+    const struct data *s;
+    const uint32_t *ids;
+    uint32_t i, j, count;
+
+    put_le(&col[CCOL_PRINCIPAL_OFFSETS], 0, 8);
+    for (i = 0; i < x->names.principals.count; i++) {
+        ids = cc_names_ids(&x->names, i, &count);
+        for (j = 1; j < count; j++) {
+            if (j > 1) {
+                out_char(&col[CCOL_PRINCIPALS], '/');
+            }
+            s = cc_intern_get(&x->names.strings, ids[j]);
+            out_mem(&col[CCOL_PRINCIPALS], s->value, s->length);
+        }
+        out_char(&col[CCOL_PRINCIPALS], '@');
+        s = cc_intern_get(&x->names.strings, ids[0]);
+        out_mem(&col[CCOL_PRINCIPALS], s->value, s->length);
+        put_le(&col[CCOL_PRINCIPAL_OFFSETS], col[CCOL_PRINCIPALS].len, 8);
+    }
+
+    put_le(&col[CCOL_FILE_OFFSETS], 0, 8);
+    for (i = 0; i < x->files.count; i++) {
+        s = cc_intern_get(&x->files, i);
+        out_mem(&col[CCOL_FILE_NAMES], s->value, s->length);
+        put_le(&col[CCOL_FILE_OFFSETS], col[CCOL_FILE_NAMES].len, 8);
+    }
+}
+
+static int write_all(int fd, const void *data, size_t length) {
+    const char *p = data;
+    ssize_t n;
+
+    while (length) {
+        n = write(fd, p, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static uint64_t align_column(uint64_t offset) {
+    return (offset + CCOL_ALIGN - 1) & ~(uint64_t) (CCOL_ALIGN - 1);
+}
+
+/* Write the export next to path: the header, the directory, then every
+ * column from its buffer, and rename it over path once it is complete. The
+ * readers still mapping the one before keep it until they close it, and a
+ * failure leaves it in place. Returns -1 with errno set on failure.
+ */
+int export_write(struct export *x, const char *path) {
+    static const uint8_t zeros[CCOL_ALIGN];
+    uint8_t header[sizeof(struct ccol_header)];
+    struct outbuf dir;
+    uint64_t offset;
+    char *tmp;
+    int i, fd, err;
+
+    export_dictionaries(x);
+    for (i = 0; i < CCOL_COUNT; i++) {
+        if (x->columns[i].error) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    if (out_init(&dir, -1, 0) < 0) {
+        return -1;
+    }
+
+    // Field by field, whatever the byte order of the host
+    memset(header, 0, sizeof(header));
+    memcpy(header + offsetof(struct ccol_header, magic), CCOL_MAGIC, 8);
+    store_le(header + offsetof(struct ccol_header, version), CCOL_VERSION, 4);
+    store_le(header + offsetof(struct ccol_header, columns), CCOL_COUNT, 4);
+    store_le(header + offsetof(struct ccol_header, rows), x->rows, 8);
+    store_le(header + offsetof(struct ccol_header, directory), align_column(sizeof(header)), 8);
+
+    offset = align_column(sizeof(header)) + align_column(CCOL_COUNT * sizeof(struct ccol_column));
+    for (i = 0; i < CCOL_COUNT; i++) {
+        char name[CCOL_NAME_SIZE] = { 0 };
+        uint64_t count = x->columns[i].len;
+
+        memcpy(name, column_names[i], strlen(column_names[i]));
+        out_mem(&dir, name, sizeof(name));
+        put_le(&dir, column_types[i], 4);
+        put_le(&dir, 0, 4);
+        switch (column_types[i]) {
+        case CCOL_U16:
+            count /= 2;
+            break;
+        case CCOL_U32:
+            count /= 4;
+            break;
+        case CCOL_U64:
+            count /= 8;
+            break;
+        }
+        put_le(&dir, count, 8);
+        put_le(&dir, offset, 8);
+        offset = align_column(offset + x->columns[i].len);
+    }
+    if (dir.error) {
+        out_free(&dir);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    tmp = malloc(strlen(path) + sizeof(".XXXXXX"));
+    if (!tmp) {
+        out_free(&dir);
+        return -1;
+    }
+    sprintf(tmp, "%s.XXXXXX", path);
+    // mkstemp() leaves it 0600: it holds the tickets
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        free(tmp);
+        out_free(&dir);
+        return -1;
+    }
+    offset = sizeof(header);
+    if (write_all(fd, header, sizeof(header)) < 0) {
+        goto fail;
+    }
+    if (write_all(fd, zeros, align_column(offset) - offset) < 0 ||
+        write_all(fd, dir.buf, dir.len) < 0) {
+        goto fail;
+    }
+    offset = align_column(offset) + dir.len;
+    for (i = 0; i < CCOL_COUNT; i++) {
+        if (write_all(fd, zeros, align_column(offset) - offset) < 0 ||
+            write_all(fd, x->columns[i].buf, x->columns[i].len) < 0) {
+            goto fail;
+        }
+        offset = align_column(offset) + x->columns[i].len;
+    }
+    if (fsync(fd) < 0) {
+        goto fail;
+    }
+    if (close(fd) < 0) {
+        fd = -1;
+        goto fail;
+    }
+    fd = -1;
+    if (rename(tmp, path) < 0) {
+        goto fail;
+    }
+    free(tmp);
+    out_free(&dir);
+    return 0;
+
+fail:
+    err = errno;
+    if (fd >= 0) {
+        close(fd);
+    }
+    unlink(tmp);
+    free(tmp);
+    out_free(&dir);
+    errno = err;
+    return -1;
+}
+
+void export_free(struct export *x) {
+    int i;
+
+    for (i = 0; i < CCOL_COUNT; i++) {
+        out_free(&x->columns[i]);
+    }
+    cc_names_free(&x->names);
+    cc_intern_free(&x->files);
+}
@@ -0,0 +1,29 @@
+#ifndef EXPORT_H_INCLUDED
+#define EXPORT_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include "out.h"
+#include "print.h"
+#include "intern.h"
+#include "ccol.h"
+
+/* Columnar export being built: every column grows in memory as the
+ * credentials are decoded, and the file is written in one go at the end (see
+ * ccol.h for the layout).
+ */
+struct export {
+    struct outbuf columns[CCOL_COUNT];
+    struct cc_names names;      /* the principal dictionary, by ID */
+    struct cc_intern files;     /* the file name dictionary */
+    uint64_t rows;
+    uint64_t ticket_bytes;
+    struct outbuf *out;         /* for the errors */
+    const struct print_options *opts;
+};
+
+int export_init(struct export *x, struct outbuf *out, const struct print_options *opts);
+int export_add(struct export *x, const char *filename);
+int export_write(struct export *x, const char *path);
+void export_free(struct export *x);
+#endif
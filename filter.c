@@ -0,0 +1,305 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <fnmatch.h>
+#include "data.h"
+#include "names.h"
+#include "tables.h"
+#include "parser.h"
+#include "filter.h"
+
+/* Names of the fields a filter can look at. The times follow FILTER_AUTHTIME
+ * and the next ones.
+ */
+static const char *const time_fields[FILTER_TIMES] = {
+    "authtime", "starttime", "endtime", "renew_till"
+};
+
+#define FLAG_ENTRY(bit, name) { bit, name },
+static const struct {
+    uint32_t bit;
+    const char *name;
+} flag_names[] = {
+    TICKET_FLAGS(FLAG_ENTRY)
+};
+
+void cc_filter_init(struct cc_filter *f) {
+    int i;
+
+    memset(f, 0, sizeof(*f));
+    f->enctype = -1;
+    for (i = 0; i < FILTER_TIMES; i++) {
+        f->time_max[i] = UINT32_MAX;
+    }
+}
+
+// "name" or "name,name..." of ticket flags, any case
+static int parse_flags(const char *value, uint32_t *flags) {
+    size_t i, len;
+
+    *flags = 0;
+    while (*value) {
+        len = strcspn(value, ",|");
+        for (i = 0; i < sizeof(flag_names) / sizeof(flag_names[0]); i++) {
+            if (strlen(flag_names[i].name) == len && !strncasecmp(flag_names[i].name, value, len)) {
+                break;
+            }
+        }
+        if (i == sizeof(flag_names) / sizeof(flag_names[0])) {
+            return CC_ERR_INVALID;
+        }
+        *flags |= flag_names[i].bit;
+        value += len;
+        if (*value) {
+            value++;
+        }
+    }
+    return *flags ? CC_OK : CC_ERR_INVALID;
+}
+
+// A number or the name of an enctype
+static int parse_enctype(const char *value, int *enctype) {
+    char *end;
+    long n;
+    uint32_t i;
+
+    n = strtol(value, &end, 0);
+    if (end != value && !*end && n >= 0 && n <= UINT16_MAX) {
+        *enctype = n;
+        return CC_OK;
+    }
+    for (i = 0; i <= ENCTYPE_MAX; i++) {
+        if (enctype_table[i].str && !strcasecmp(enctype_table[i].str, value)) {
+            *enctype = i;
+            return CC_OK;
+        }
+    }
+    return CC_ERR_INVALID;
+}
+
+/* Seconds since the epoch, "now", or a time relative to now as +N or -N with
+ * an optional unit: s, m, h or d.
+ */
+static int parse_time(const char *value, time_t now, uint32_t *result) {
+    char *end;
+    long long t;
+
+    if (!strcmp(value, "now")) {
+        t = now;
+    } else {
+        t = strtoll(value, &end, 10);
+        if (end == value) {
+            return CC_ERR_INVALID;
+        }
+        switch (*end) {
+        case 'd':
+            t *= 24;
+            // fall through
+        case 'h':
+            t *= 60;
+            // fall through
+        case 'm':
+            t *= 60;
+            // fall through
+        case 's':
+            end++;
+            // fall through
+        case '\0':
+            break;
+        default:
+            return CC_ERR_INVALID;
+        }
+        if (*end || (end[-1] >= 'a' && value[0] != '+' && value[0] != '-')) {
+            return CC_ERR_INVALID;
+        }
+        if (value[0] == '+' || value[0] == '-') {
+            t += now;
+        }
+    }
+    if (t < 0) {
+        t = 0;
+    } else if (t > UINT32_MAX) {
+        t = UINT32_MAX;
+    }
+    *result = t;
+    return CC_OK;
+}
+
+static int parse_time_bound(struct cc_filter *f, int field, const char *op, const char *value, time_t now) {
+    uint32_t t, *min = &f->time_min[field], *max = &f->time_max[field];
+
+    if (parse_time(value, now, &t) < 0) {
+        return CC_ERR_INVALID;
+    }
+    if (!strcmp(op, "<")) {
+        if (t == 0) {
+            *min = 1;
+            *max = 0;
+        } else if (t - 1 < *max) {
+            *max = t - 1;
+        }
+    } else if (!strcmp(op, "<=")) {
+        if (t < *max) {
+            *max = t;
+        }
+    } else if (!strcmp(op, ">")) {
+        if (t == UINT32_MAX) {
+            *min = 1;
+            *max = 0;
+        } else if (t + 1 > *min) {
+            *min = t + 1;
+        }
+    } else if (!strcmp(op, ">=")) {
+        if (t > *min) {
+            *min = t;
+        }
+    } else if (!strcmp(op, "=")) {
+        if (t > *min) {
+            *min = t;
+        }
+        if (t < *max) {
+            *max = t;
+        }
+    } else {
+        return CC_ERR_INVALID;
+    }
+    return CC_OK;
+}
+
+/* Add a condition to a filter. The expressions are "field op value":
+ *   client=glob, server=glob       on the principal as printed
+ *   enctype=type                   number or name
+ *   flags=name[,name...]           all of them set
+ *   flags!=name[,name...]          none of them set
+ *   authtime, starttime, endtime, renew_till with <, <=, >, >= or =
+ *                                  against a time (see parse_time())
+ * The globs are not copied: expr must live as long as the filter.
+ */
+int cc_filter_parse(struct cc_filter *f, const char *expr, time_t now) {
+    char field[16], op[3];
+    const char *value;
+    size_t len;
+    uint32_t flags;
+    int i;
+
+    len = strcspn(expr, "<>=!");
+    if (!expr[len] || len >= sizeof(field)) {
+        return CC_ERR_INVALID;
+    }
+    memcpy(field, expr, len);
+    field[len] = '\0';
+    value = expr + len;
+    len = strspn(value, "<>=!");
+    if (len >= sizeof(op)) {
+        return CC_ERR_INVALID;
+    }
+    memcpy(op, value, len);
+    op[len] = '\0';
+    value += len;
+
+    f->active = 1;
+    if (!strcmp(field, "client") || !strcmp(field, "server")) {
+        const char **globs = field[0] == 'c' ? f->client : f->server;
+        int *count = field[0] == 'c' ? &f->client_count : &f->server_count;
+
+        if (strcmp(op, "=") || *count == FILTER_MAX_TERMS) {
+            return CC_ERR_INVALID;
+        }
+        globs[(*count)++] = value;
+        return CC_OK;
+    }
+    if (!strcmp(field, "enctype")) {
+        if (strcmp(op, "=")) {
+            return CC_ERR_INVALID;
+        }
+        return parse_enctype(value, &f->enctype);
+    }
+    if (!strcmp(field, "flags")) {
+        if (parse_flags(value, &flags) < 0) {
+            return CC_ERR_INVALID;
+        }
+        if (!strcmp(op, "=")) {
+            f->flags_set |= flags;
+        } else if (!strcmp(op, "!=")) {
+            f->flags_clear |= flags;
+        } else {
+            return CC_ERR_INVALID;
+        }
+        return CC_OK;
+    }
+    for (i = 0; i < FILTER_TIMES; i++) {
+        if (!strcmp(field, time_fields[i])) {
+            return parse_time_bound(f, i, op, value, now);
+        }
+    }
+    return CC_ERR_INVALID;
+}
+
+/* Match the principal, as "component/component@REALM", against all the
+ * globs.
+ */
+static int match_principal(const char *const *globs, int count, const struct principal *princ) {
+    char stack[MAXSTRINGLEN], *name = stack;
+    size_t size, len = 0;
+    uint32_t i;
+    int match = 1;
+
+    if (!count) {
+        return 1;
+    }
+    size = princ->realm.length + 2;
+    for (i = 0; i < princ->comp_count; i++) {
+        size += princ->components[i].length + 1;
+    }
+    if (size > sizeof(stack)) {
+        name = malloc(size);
+        if (!name) {
+            return 0;
+        }
+    }
+    for (i = 0; i < princ->comp_count; i++) {
+        if (i) {
+            name[len++] = '/';
+        }
+        memcpy(name + len, princ->components[i].value, princ->components[i].length);
+        len += princ->components[i].length;
+    }
+    name[len++] = '@';
+    memcpy(name + len, princ->realm.value, princ->realm.length);
+    len += princ->realm.length;
+    name[len] = '\0';
+
+    for (i = 0; i < count && match; i++) {
+        match = fnmatch(globs[i], name, 0) == 0;
+    }
+    if (name != stack) {
+        free(name);
+    }
+    return match;
+}
+
+int cc_filter_client(const struct cc_filter *f, const struct principal *princ) {
+    return match_principal(f->client, f->client_count, princ);
+}
+
+int cc_filter_server(const struct cc_filter *f, const struct principal *princ) {
+    return match_principal(f->server, f->server_count, princ);
+}
+
+// The times and the flags
+int cc_filter_times(const struct cc_filter *f, const struct credential *cred) {
+    const uint32_t times[FILTER_TIMES] = {
+        cred->authtime, cred->starttime, cred->endtime, cred->renew_till
+    };
+    int i;
+
+    for (i = 0; i < FILTER_TIMES; i++) {
+        if (times[i] < f->time_min[i] || times[i] > f->time_max[i]) {
+            return 0;
+        }
+    }
+    return (cred->ticket_flags & f->flags_set) == f->flags_set &&
+           !(cred->ticket_flags & f->flags_clear);
+}
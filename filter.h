@@ -0,0 +1,39 @@
+#ifndef FILTER_H_INCLUDED
+#define FILTER_H_INCLUDED
+
+#include <stdint.h>
+#include <time.h>
+#include "data.h"
+
+/* Times a filter can bound, in the order of the credential */
+#define FILTER_AUTHTIME                 0
+#define FILTER_STARTTIME                1
+#define FILTER_ENDTIME                  2
+#define FILTER_RENEW_TILL               3
+#define FILTER_TIMES                    4
+
+#define FILTER_MAX_TERMS                16
+
+/* Which credentials to decode. All the conditions must hold. They are
+ * evaluated as soon as the fields they look at are read, and a credential
+ * that fails one is skipped by length from there.
+ */
+struct cc_filter {
+    const char *client[FILTER_MAX_TERMS];   /* globs on the client principal */
+    int client_count;
+    const char *server[FILTER_MAX_TERMS];   /* globs on the server principal */
+    int server_count;
+    int enctype;                            /* -1 for any */
+    uint32_t flags_set;                     /* flags that must be set */
+    uint32_t flags_clear;                   /* flags that must not be */
+    uint32_t time_min[FILTER_TIMES];        /* bounds included */
+    uint32_t time_max[FILTER_TIMES];
+    int active;                             /* anything to check at all */
+};
+
+void cc_filter_init(struct cc_filter *f);
+int cc_filter_parse(struct cc_filter *f, const char *expr, time_t now);
+int cc_filter_client(const struct cc_filter *f, const struct principal *princ);
+int cc_filter_server(const struct cc_filter *f, const struct principal *princ);
+int cc_filter_times(const struct cc_filter *f, const struct credential *cred);
+#endif
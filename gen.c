@@ -0,0 +1,227 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include "data.h"
+#include "parser.h"
+
+#define GEN_REALM                       "EXAMPLE.COM"
+#define GEN_EPOCH                       1700000000
+#define GEN_LIFETIME                    (10 * 3600)
+#define GEN_RENEW                       (7 * 24 * 3600)
+#define GEN_AD_WIN2K_PAC                128
+#define GEN_ADDRTYPE_INET               2
+#define GEN_ENCTYPE                     18      /* aes256-cts-hmac-sha1-96 */
+#define GEN_KEY_SIZE                    32
+
+/* Generator of synthetic ccaches (version 4), for the benchmarks. The content
+ * only depends on the options and the seed.
+ */
+
+struct gen_options {
+    unsigned long count;                /* credentials */
+    unsigned components;                /* of the server principals */
+    unsigned addresses;
+    unsigned authdatas;
+    unsigned long authdata_size;
+    unsigned long ticket_size;
+    uint64_t seed;
+};
+
+static uint64_t rng;
+
+// xorshift64
+static uint64_t gen_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static void put8(FILE *f, uint8_t value) {
+    putc(value, f);
+}
+
+static void put16(FILE *f, uint16_t value) {
+    putc(value >> 8, f);
+    putc(value, f);
+}
+
+static void put32(FILE *f, uint32_t value) {
+    put16(f, value >> 16);
+    put16(f, value);
+}
+
+static void gen_data(FILE *f, const void *value, uint32_t length) {
+    put32(f, length);
+    fwrite(value, 1, length, f);
+}
+
+static void put_string(FILE *f, const char *value) {
+    gen_data(f, value, strlen(value));
+}
+
+static void put_random(FILE *f, unsigned long length) {
+    uint64_t r = 0;
+    unsigned long i;
+
+    put32(f, length);
+    for (i = 0; i < length; i++) {
+        if (!(i % 8)) {
+            r = gen_random();
+        }
+        putc(r >> (i % 8) * 8, f);
+    }
+}
+
+static void gen_principal(FILE *f, uint32_t name_type, const char *const *components, unsigned count) {
+    unsigned i;
+
+    put32(f, name_type);
+    put32(f, count);
+    put_string(f, GEN_REALM);
+    for (i = 0; i < count; i++) {
+        put_string(f, components[i]);
+    }
+}
+
+// krbtgt/REALM first, then services on a few hosts
+static void put_server(FILE *f, const struct gen_options *opts, unsigned long n) {
+    char names[3][MAXSTRINGLEN];
+    const char *components[opts->components];
+    unsigned i;
+
+    if (!n) {
+        components[0] = "krbtgt";
+        components[1] = GEN_REALM;
+        gen_principal(f, 2, components, 2);
+        return;
+    }
+    snprintf(names[0], sizeof(names[0]), "%s", n % 3 ? "HTTP" : "cifs");
+    snprintf(names[1], sizeof(names[1]), "host%lu.example.com", n % 97);
+    snprintf(names[2], sizeof(names[2]), "part%lu", n % 13);
+    for (i = 0; i < opts->components; i++) {
+        components[i] = names[i < 2 ? i : 2];
+    }
+    gen_principal(f, 2, components, opts->components);
+}
+
+static void gen_credential(FILE *f, const struct gen_options *opts, unsigned long n) {
+    static const char *const client[] = { "alice" };
+    uint32_t authtime = GEN_EPOCH + n * 60;
+    uint8_t address[4] = { 10, 0, n >> 8, n };
+    unsigned i;
+
+    gen_principal(f, 1, client, 1);
+    put_server(f, opts, n);
+    put16(f, GEN_ENCTYPE);
+    put_random(f, GEN_KEY_SIZE);
+    put32(f, authtime);
+    put32(f, authtime + (n ? n % 60 : 0));
+    put32(f, authtime + GEN_LIFETIME);
+    put32(f, authtime + GEN_RENEW);
+    put8(f, 0);
+    put32(f, TKT_FLG_FORWARDABLE | TKT_FLG_RENEWABLE | TKT_FLG_PRE_AUTH |
+             (n ? 0 : TKT_FLG_INITIAL) | TKT_FLG_ENC_PA_REP);
+    put32(f, opts->addresses);
+    for (i = 0; i < opts->addresses; i++) {
+        address[1] = i;
+        put16(f, GEN_ADDRTYPE_INET);
+        gen_data(f, address, sizeof(address));
+    }
+    put32(f, opts->authdatas);
+    for (i = 0; i < opts->authdatas; i++) {
+        put16(f, GEN_AD_WIN2K_PAC);
+        put_random(f, opts->authdata_size);
+    }
+    put_random(f, opts->ticket_size);
+    put32(f, 0);
+}
+
+static void put_ccache(FILE *f, const struct gen_options *opts) {
+    static const char *const client[] = { "alice" };
+    unsigned long n;
+
+    put8(f, CCACHE_MAGIC);
+    put8(f, CCACHE_VERSION);
+    // One DeltaTime field: tag 1, 8 bytes of zero offset
+    put16(f, 12);
+    put16(f, 1);
+    put16(f, 8);
+    put32(f, 0);
+    put32(f, 0);
+    gen_principal(f, 1, client, 1);
+    for (n = 0; n < opts->count; n++) {
+        gen_credential(f, opts, n);
+    }
+}
+
+static void usage(char *exe) {
+    printf("Usage: %s [-n count] [-c components] [-a addresses] [-d authdata]\n", exe);
+    printf("          [-D authdata_size] [-t ticket_size] [-r seed] ccache_file|-\n");
+    printf("\n");
+    printf("  -n count      credentials (default 1000)\n");
+    printf("  -c count      components of the server principals, at least 2 (default 2)\n");
+    printf("  -a count      addresses per credential (default 1)\n");
+    printf("  -d count      authdata (PAC) per credential (default 1)\n");
+    printf("  -D size       bytes of each authdata (default 512)\n");
+    printf("  -t size       bytes of each ticket (default 1024)\n");
+    printf("  -r seed       seed of the random bytes (default 1)\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct gen_options opts = { 1000, 2, 1, 1, 512, 1024, 1 };
+    const char *filename;
+    FILE *f;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:a:d:D:t:r:")) != -1) {
+        switch (opt) {
+        case 'n':
+            opts.count = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            opts.components = strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            opts.addresses = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            opts.authdatas = strtoul(optarg, NULL, 0);
+            break;
+        case 'D':
+            opts.authdata_size = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            opts.ticket_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            opts.seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    filename = argv[optind];
+    if (!filename || opts.components < 2 || opts.components > 64) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    rng = opts.seed ? opts.seed : 1;
+
+    f = strcmp(filename, "-") ? fopen(filename, "wb") : stdout;
+    if (!f) {
+        printf("Error opening %s: %s\n", filename, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    put_ccache(f, &opts);
+    if (fflush(f) == EOF || ferror(f) || (f != stdout && fclose(f) == EOF)) {
+        fprintf(stderr, "Error writing %s: %s\n", filename, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,246 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "data.h"
+#include "arena.h"
+#include "parser.h"
+#include "intern.h"
+
+#define INTERN_STACK_IDS                32
+
+// FNV-1a, also used by the readers of the tables written from an intern table
+uint32_t cc_intern_hash(const void *data, uint32_t length) {
+    const uint8_t *value = data;
+    uint32_t h = 0x811c9dc5;
+    uint32_t i;
+
+    for (i = 0; i < length; i++) {
+        h = (h ^ value[i]) * 0x01000193;
+    }
+    return h;
+}
+
+void cc_intern_init(struct cc_intern *t) {
+    memset(t, 0, sizeof(*t));
+    arena_init(&t->arena, INTERN_BLOCK);
+}
+
+// Double the slots, kept at most half full
+static int intern_grow(struct cc_intern *t) {
+    uint32_t size = t->mask ? (t->mask + 1) * 2 : INTERN_MIN_SLOTS;
+    uint32_t *slots, i, j;
+
+    if (size > UINT32_MAX / 2) {
+        return CC_ERR_NOMEM;
+    }
+    slots = calloc(size, sizeof(uint32_t));
+    if (!slots) {
+        return CC_ERR_NOMEM;
+    }
+    for (i = 0; i < t->count; i++) {
+        for (j = t->hashes[i] & (size - 1); slots[j]; j = (j + 1) & (size - 1))
+            ;
+        slots[j] = i + 1;
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->mask = size - 1;
+    return CC_OK;
+}
+
+static int intern_find(const struct cc_intern *t, const void *value, uint32_t length, uint32_t h,
+                       uint32_t *id) {
+    uint32_t i, slot;
+
+    if (!t->mask) {
+        return CC_ERR_NOT_FOUND;
+    }
+    for (i = h & t->mask; (slot = t->slots[i]); i = (i + 1) & t->mask) {
+        const struct data *s = &t->strings[slot - 1];
+
+        if (t->hashes[slot - 1] == h && s->length == length && !memcmp(s->value, value, length)) {
+            *id = slot - 1;
+            return CC_OK;
+        }
+    }
+    return CC_ERR_NOT_FOUND;
+}
+
+// The ID of a string already in the table, or CC_ERR_NOT_FOUND
+int cc_intern_find(const struct cc_intern *t, const void *value, uint32_t length, uint32_t *id) {
+    return intern_find(t, value, length, cc_intern_hash(value, length), id);
+}
+
+/* Get the ID of a string, adding it to the table if it isn't there yet.
+ * Returns CC_OK, or CC_ERR_NOMEM.
+ */
+int cc_intern(struct cc_intern *t, const void *value, uint32_t length, uint32_t *id) {
+    uint32_t h = cc_intern_hash(value, length);
+    uint32_t i;
+    char *copy;
+
+    if (intern_find(t, value, length, h, id) == CC_OK) {
+        return CC_OK;
+    }
+
+    if (t->count >= t->mask / 2 && intern_grow(t) < 0) {
+        return CC_ERR_NOMEM;
+    }
+    if (t->count == t->size) {
+        uint32_t size = t->size ? t->size * 2 : INTERN_MIN_SLOTS / 2;
+        struct data *strings = realloc(t->strings, size * sizeof(struct data));
+        uint32_t *hashes;
+
+        if (!strings) {
+            return CC_ERR_NOMEM;
+        }
+        t->strings = strings;
+        hashes = realloc(t->hashes, size * sizeof(uint32_t));
+        if (!hashes) {
+            return CC_ERR_NOMEM;
+        }
+        t->hashes = hashes;
+        t->size = size;
+    }
+    copy = arena_alloc(&t->arena, length);
+    if (!copy) {
+        return CC_ERR_NOMEM;
+    }
+    memcpy(copy, value, length);
+    t->strings[t->count].length = length;
+    t->strings[t->count].value = copy;
+    t->hashes[t->count] = h;
+    for (i = h & t->mask; t->slots[i]; i = (i + 1) & t->mask)
+        ;
+    t->slots[i] = t->count + 1;
+    *id = t->count++;
+    return CC_OK;
+}
+
+// The string of an ID given by cc_intern(), NULL if there is none
+const struct data *cc_intern_get(const struct cc_intern *t, uint32_t id) {
+    return id < t->count ? &t->strings[id] : NULL;
+}
+
+void cc_intern_free(struct cc_intern *t) {
+    free(t->strings);
+    free(t->hashes);
+    free(t->slots);
+    arena_free(&t->arena);
+    memset(t, 0, sizeof(*t));
+}
+
+void cc_names_init(struct cc_names *n) {
+    cc_intern_init(&n->strings);
+    cc_intern_init(&n->principals);
+}
+
+/* Intern a sequence of string IDs: the realm, then the components */
+static int names_sequence(struct cc_names *n, const uint32_t *ids, uint32_t count, uint32_t *id) {
+    return cc_intern(&n->principals, ids, count * sizeof(uint32_t), id);
+}
+
+/* Get the ID of a principal, from its realm and components. The name type
+ * isn't part of it, like in the printed name.
+ */
+int cc_names_principal(struct cc_names *n, const struct principal *princ, uint32_t *id) {
+    uint32_t stack[INTERN_STACK_IDS], *ids = stack;
+    uint32_t i, count = princ->comp_count + 1;
+    int rc;
+
+    if (count > INTERN_STACK_IDS) {
+        ids = malloc(count * sizeof(uint32_t));
+        if (!ids) {
+            return CC_ERR_NOMEM;
+        }
+    }
+    rc = cc_intern(&n->strings, princ->realm.value, princ->realm.length, &ids[0]);
+    for (i = 0; rc == CC_OK && i < princ->comp_count; i++) {
+        rc = cc_intern(&n->strings, princ->components[i].value, princ->components[i].length, &ids[i + 1]);
+    }
+    if (rc == CC_OK) {
+        rc = names_sequence(n, ids, count, id);
+    }
+    if (ids != stack) {
+        free(ids);
+    }
+    return rc;
+}
+
+/* The ID of a principal already interned, or CC_ERR_NOT_FOUND */
+int cc_names_find(const struct cc_names *n, const struct principal *princ, uint32_t *id) {
+    uint32_t stack[INTERN_STACK_IDS], *ids = stack;
+    uint32_t i, count = princ->comp_count + 1;
+    int rc;
+
+    if (count > INTERN_STACK_IDS) {
+        ids = malloc(count * sizeof(uint32_t));
+        if (!ids) {
+            return CC_ERR_NOMEM;
+        }
+    }
+    rc = cc_intern_find(&n->strings, princ->realm.value, princ->realm.length, &ids[0]);
+    for (i = 0; rc == CC_OK && i < princ->comp_count; i++) {
+        rc = cc_intern_find(&n->strings, princ->components[i].value, princ->components[i].length, &ids[i + 1]);
+    }
+    if (rc == CC_OK) {
+        rc = cc_intern_find(&n->principals, ids, count * sizeof(uint32_t), id);
+    }
+    if (ids != stack) {
+        free(ids);
+    }
+    return rc;
+}
+
+/* The string IDs of a principal: the realm first, then the components.
+ * *count is set to their number, so the components are *count - 1.
+ */
+const uint32_t *cc_names_ids(const struct cc_names *n, uint32_t id, uint32_t *count) {
+    const struct data *seq = cc_intern_get(&n->principals, id);
+
+    if (!seq) {
+        *count = 0;
+        return NULL;
+    }
+    *count = seq->length / sizeof(uint32_t);
+    return (const uint32_t *) seq->value;
+}
+
+/* Get the ID in n of a principal interned in another table, like the one of
+ * another thread.
+ */
+int cc_names_merge(struct cc_names *n, const struct cc_names *from, uint32_t from_id, uint32_t *id) {
+    uint32_t stack[INTERN_STACK_IDS], *ids = stack;
+    const uint32_t *from_ids;
+    uint32_t i, count;
+    int rc = CC_OK;
+
+    from_ids = cc_names_ids(from, from_id, &count);
+    if (!from_ids) {
+        return CC_ERR_NOT_FOUND;
+    }
+    if (count > INTERN_STACK_IDS) {
+        ids = malloc(count * sizeof(uint32_t));
+        if (!ids) {
+            return CC_ERR_NOMEM;
+        }
+    }
+    for (i = 0; rc == CC_OK && i < count; i++) {
+        const struct data *s = cc_intern_get(&from->strings, from_ids[i]);
+
+        rc = cc_intern(&n->strings, s->value, s->length, &ids[i]);
+    }
+    if (rc == CC_OK) {
+        rc = names_sequence(n, ids, count, id);
+    }
+    if (ids != stack) {
+        free(ids);
+    }
+    return rc;
+}
+
+void cc_names_free(struct cc_names *n) {
+    cc_intern_free(&n->strings);
+    cc_intern_free(&n->principals);
+}
@@ -0,0 +1,50 @@
+#ifndef INTERN_H_INCLUDED
+#define INTERN_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include "data.h"
+#include "arena.h"
+
+#define INTERN_MIN_SLOTS                64
+#define INTERN_BLOCK                    (64 * 1024)
+
+/* Hash set of byte strings, each with a stable ID: the IDs are given from 0 in
+ * the order the strings are first seen, and stay valid as long as the table.
+ * The strings are copied, so that they outlive the ccaches they come from.
+ * Not thread safe: use one table per thread, and cc_names_merge() for the
+ * principals.
+ */
+struct cc_intern {
+    struct data *strings;       /* by ID */
+    uint32_t *hashes;           /* by ID */
+    uint32_t count;
+    uint32_t size;              /* of strings and hashes */
+    uint32_t *slots;            /* open addressing on the hash: ID + 1, 0 if free */
+    uint32_t mask;              /* slots - 1 */
+    struct arena arena;         /* the copies */
+};
+
+/* A principal interned in two tables: its realm and components in one, and
+ * the sequence of their IDs in another. Equal principals get the same ID, and
+ * compare as integers.
+ */
+struct cc_names {
+    struct cc_intern strings;
+    struct cc_intern principals;
+};
+
+uint32_t cc_intern_hash(const void *value, uint32_t length);
+void cc_intern_init(struct cc_intern *t);
+int cc_intern(struct cc_intern *t, const void *value, uint32_t length, uint32_t *id);
+int cc_intern_find(const struct cc_intern *t, const void *value, uint32_t length, uint32_t *id);
+const struct data *cc_intern_get(const struct cc_intern *t, uint32_t id);
+void cc_intern_free(struct cc_intern *t);
+
+void cc_names_init(struct cc_names *n);
+int cc_names_principal(struct cc_names *n, const struct principal *princ, uint32_t *id);
+int cc_names_find(const struct cc_names *n, const struct principal *princ, uint32_t *id);
+const uint32_t *cc_names_ids(const struct cc_names *n, uint32_t id, uint32_t *count);
+int cc_names_merge(struct cc_names *n, const struct cc_names *from, uint32_t from_id, uint32_t *id);
+void cc_names_free(struct cc_names *n);
+#endif
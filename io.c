@@ -0,0 +1,381 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "io.h"
+#include "stats.h"
+
+static void reader_reset(struct reader *r, int fd) {
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    r->size = -1;
+}
+
+/* Open a ccache. "-" is the standard input.
+ * Returns -1 and sets errno on failure.
+ */
+int reader_open(struct reader *r, const char *filename) {
+    int fd, rc, err;
+
+    reader_reset(r, -1);
+    if (!strcmp(filename, "-")) {
+        return reader_fdopen(r, STDIN_FILENO);
+    }
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    rc = reader_fdopen(r, fd);
+    if (rc < 0) {
+        err = errno;
+        close(fd);
+        r->fd = -1;
+        errno = err;
+    }
+    return rc;
+}
+
+/* Set up a reader on an already open file descriptor, choosing the backend
+ * from the type of file. The reader owns the descriptor from now on.
+ */
+int reader_fdopen(struct reader *r, int fd) {
+    struct stat st;
+
+    reader_reset(r, fd);
+    if (fstat(fd, &st) < 0) {
+        return -1;
+    }
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            STATS_ADD(bytes_mapped, st.st_size);
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            r->map = map;
+            r->map_size = st.st_size;
+            r->ptr = map;
+            r->leftover = st.st_size;
+            r->size = st.st_size;
+            r->eof = 1;
+            return 0;
+        }
+    }
+
+    // Not mappable: stream it
+    r->buf = malloc(STREAM_WINDOW);
+    if (!r->buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+    r->bufsize = STREAM_WINDOW;
+    r->ptr = r->buf;
+    if (S_ISREG(st.st_mode)) {
+        r->size = st.st_size;
+    }
+    return 0;
+}
+
+/* Set up a reader on size bytes in memory, that must stay there until
+ * reader_close(). The values decoded point into them, like for a mapped file.
+ */
+void reader_memopen(struct reader *r, const void *data, size_t size) {
+    reader_reset(r, -1);
+    r->map = (void *) data;
+    r->map_size = size;
+    r->borrowed = 1;
+    r->ptr = data;
+    r->leftover = size;
+    r->size = size;
+    r->eof = 1;
+}
+
+/* Open a ccache like reader_open(), but read a regular file whole in *buf
+ * rather than map it: a file truncated or rewritten while it is decoded
+ * can't fault then. *buf is grown as needed, kept by the caller from one file
+ * to the next, and must stay there until reader_close(). Anything else is
+ * streamed as usual. The descriptor stays open until reader_close().
+ * Returns -1 and sets errno on failure.
+ */
+int reader_load(struct reader *r, const char *filename, uint8_t **buf, size_t *bufsize) {
+    struct stat st;
+    size_t done = 0;
+    ssize_t n;
+    int fd, err;
+
+    reader_reset(r, -1);
+    if (!strcmp(filename, "-")) {
+        return reader_fdopen(r, STDIN_FILENO);
+    }
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        goto fail;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        if (reader_fdopen(r, fd) < 0) {
+            goto fail;
+        }
+        return 0;
+    }
+    if ((size_t) st.st_size > *bufsize) {
+        uint8_t *b = realloc(*buf, st.st_size);
+
+        if (!b) {
+            errno = ENOMEM;
+            goto fail;
+        }
+        *buf = b;
+        *bufsize = st.st_size;
+    }
+    // A file shrinking meanwhile is taken as it is, the parser will tell
+    while (done < (size_t) st.st_size) {
+        n = pread(fd, *buf + done, st.st_size - done, done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            goto fail;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    STATS_ADD(bytes_loaded, done);
+    reader_memopen(r, *buf, done);
+    r->fd = fd;
+    return 0;
+
+fail:
+    err = errno;
+    close(fd);
+    r->fd = -1;
+    errno = err;
+    return -1;
+}
+
+void reader_close(struct reader *r) {
+    if (r->map && !r->borrowed) {
+        munmap(r->map, r->map_size);
+    }
+    free(r->buf);
+    if (r->fd >= 0 && r->fd != STDIN_FILENO) {
+        close(r->fd);
+    }
+    reader_reset(r, -1);
+}
+
+/* Make at least need contiguous bytes available at r->ptr, refilling the
+ * window if the backend is streaming.
+ * Returns -1 if the file ends before that (or on read errors).
+ */
+int reader_fill(struct reader *r, size_t need) {
+    ssize_t n;
+
+    if (r->leftover >= need) {
+        return 0;
+    }
+    if (r->eof || need > r->bufsize) {
+        return -1;
+    }
+    // Move what is left to the beginning of the window and read after it
+    if (r->leftover) {
+        memmove(r->buf, r->ptr, r->leftover);
+    }
+    r->ptr = r->buf;
+    while (r->leftover < need) {
+        STATS_START(start);
+        n = read(r->fd, r->buf + r->leftover, r->bufsize - r->leftover);
+        STATS_STOP(start, io_ns);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            r->eof = 1;
+            return -1;
+        }
+        STATS_ADD(bytes_read, n);
+        r->leftover += n;
+    }
+    return 0;
+}
+
+/* Copy length bytes to dst, consuming them. The value doesn't need to fit in
+ * the window.
+ */
+int reader_read(struct reader *r, void *dst, size_t length) {
+    uint8_t *out = dst;
+
+    while (length) {
+        size_t chunk;
+
+        if (r->leftover == 0 && reader_fill(r, 1) < 0) {
+            return -1;
+        }
+        chunk = length < r->leftover ? length : r->leftover;
+        memcpy(out, r->ptr, chunk);
+        out += chunk;
+        r->ptr += chunk;
+        r->leftover -= chunk;
+        r->offset += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+/* Move past length bytes without looking at them. A mapped file is not
+ * touched at all, a streamed one is read and thrown away.
+ */
+int reader_skip(struct reader *r, size_t length) {
+    if (reader_is_mapped(r)) {
+        if (length > r->leftover) {
+            return -1;
+        }
+        r->ptr += length;
+        r->leftover -= length;
+        r->offset += length;
+        return 0;
+    }
+    while (length) {
+        size_t chunk;
+
+        if (r->leftover == 0 && reader_fill(r, 1) < 0) {
+            return -1;
+        }
+        chunk = length < r->leftover ? length : r->leftover;
+        r->ptr += chunk;
+        r->leftover -= chunk;
+        r->offset += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+/* Tell if there is anything left to decode */
+int reader_more(struct reader *r) {
+    return r->leftover > 0 || reader_fill(r, 1) == 0;
+}
+
+/* Move to an absolute offset. Only a mapped file can be read out of order */
+int reader_seek(struct reader *r, off_t offset) {
+    if (!reader_is_mapped(r) || offset < 0 || offset > r->map_size) {
+        return -1;
+    }
+    r->ptr = (const uint8_t *) r->map + offset;
+    r->offset = offset;
+    r->leftover = r->map_size - offset;
+    return 0;
+}
+
+/* Upper bound of the bytes left in the file, used to sanity check counts
+ * before allocating for them.
+ */
+ssize_t reader_remaining(const struct reader *r) {
+    if (r->size < 0) {
+        return SSIZE_MAX;
+    }
+    return r->size - r->offset;
+}
+
+/* Start a writer on fd, with a buffer of size bytes (0 for the default).
+ * Returns -1 and sets errno on failure.
+ */
+int writer_init(struct writer *w, int fd, size_t size) {
+    memset(w, 0, sizeof(*w));
+    w->fd = fd;
+    w->size = size ? size : WRITER_BUFFER;
+    w->buf = malloc(w->size);
+    if (!w->buf) {
+        return -1;
+    }
+    return 0;
+}
+
+static int writer_drain(struct writer *w) {
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < w->len) {
+        n = write(w->fd, w->buf + done, w->len - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            w->error = errno;
+            return -1;
+        }
+        STATS_ADD(bytes_written, n);
+        done += n;
+    }
+    w->len = 0;
+    return 0;
+}
+
+/* Append bytes. Anything bigger than the buffer goes straight to the file.
+ * Returns -1 once a write has failed.
+ */
+int writer_write(struct writer *w, const void *data, size_t length) {
+    if (w->error) {
+        return -1;
+    }
+    w->offset += length;
+    if (w->size - w->len >= length) {
+        memcpy(w->buf + w->len, data, length);
+        w->len += length;
+        return 0;
+    }
+    if (writer_drain(w) < 0) {
+        return -1;
+    }
+    if (length < w->size) {
+        memcpy(w->buf, data, length);
+        w->len = length;
+        return 0;
+    }
+    while (length) {
+        ssize_t n = write(w->fd, data, length);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            w->error = errno;
+            return -1;
+        }
+        STATS_ADD(bytes_written, n);
+        data = (const uint8_t *) data + n;
+        length -= n;
+    }
+    return 0;
+}
+
+/* Write out what is buffered.
+ * Returns -1 and sets errno if this or an earlier write failed.
+ */
+int writer_flush(struct writer *w) {
+    if (!w->error) {
+        writer_drain(w);
+    }
+    if (w->error) {
+        errno = w->error;
+        return -1;
+    }
+    return 0;
+}
+
+void writer_free(struct writer *w) {
+    free(w->buf);
+    w->buf = NULL;
+}
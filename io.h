@@ -0,0 +1,76 @@
+#ifndef IO_H_INCLUDED
+#define IO_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define STREAM_WINDOW                   (64 * 1024)
+#define MAXDATALEN                      (16 * 1024 * 1024)
+#define WRITER_BUFFER                   (64 * 1024)
+
+/* Source of the ccache bytes.
+ *
+ * Regular files are mapped in memory and the window is the whole file: the
+ * decoded values can point straight into it. A file already loaded in memory
+ * (see load.h), or read whole by reader_load(), is read the same way, from
+ * the caller's buffer.
+ * Anything else (stdin, pipes, FIFOs, /proc/<pid>/fd entries) is read through
+ * a fixed size window that is refilled as the data is consumed, so the memory
+ * used doesn't depend on the size of the ccache.
+ */
+struct reader {
+    const uint8_t *ptr;     /* next byte to decode */
+    ssize_t leftover;       /* bytes available in the window from ptr */
+    off_t offset;           /* offset in the file of ptr */
+    off_t size;             /* size of the file, -1 if not known */
+    int fd;
+    int eof;
+    void *map;              /* mmap backend */
+    size_t map_size;
+    int borrowed;           /* map is the caller's memory, not unmapped */
+    uint8_t *buf;           /* streaming backend */
+    size_t bufsize;
+};
+
+/* Destination of encoded bytes, buffered and written to fd in bulk. The first
+ * failure is kept in error (an errno value): the writes after it do nothing
+ * and writer_flush() reports it.
+ */
+struct writer {
+    int fd;
+    uint8_t *buf;
+    size_t len;
+    size_t size;
+    off_t offset;           /* bytes written so far, buffered ones included */
+    int error;
+};
+
+int reader_open(struct reader *r, const char *filename);
+int reader_fdopen(struct reader *r, int fd);
+void reader_memopen(struct reader *r, const void *data, size_t size);
+int reader_load(struct reader *r, const char *filename, uint8_t **buf, size_t *bufsize);
+void reader_close(struct reader *r);
+int reader_fill(struct reader *r, size_t need);
+int reader_read(struct reader *r, void *dst, size_t length);
+int reader_skip(struct reader *r, size_t length);
+int reader_more(struct reader *r);
+int reader_seek(struct reader *r, off_t offset);
+ssize_t reader_remaining(const struct reader *r);
+int writer_init(struct writer *w, int fd, size_t size);
+int writer_write(struct writer *w, const void *data, size_t length);
+int writer_flush(struct writer *w);
+void writer_free(struct writer *w);
+
+/* Move past length bytes known to be in the window */
+static inline void reader_advance(struct reader *r, size_t length) {
+    r->ptr += length;
+    r->leftover -= length;
+    r->offset += length;
+}
+
+/* True if the values can be borrowed from the window */
+static inline int reader_is_mapped(const struct reader *r) {
+    return r->map != NULL;
+}
+#endif
@@ -0,0 +1,636 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "load.h"
+#include "pool.h"
+#include "stats.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#ifdef __NR_io_uring_setup
+#define LOAD_HAVE_URING                 1
+#else
+#define LOAD_HAVE_URING                 0
+#endif
+
+static const char *const load_names[] = { "mmap", "pread", "io_uring" };
+
+const char *load_name(int backend) {
+    return backend >= LOAD_MMAP && backend <= LOAD_URING ? load_names[backend] : "unknown";
+}
+
+/* Buffer of a worker or of a ring slot, kept from a file to the next */
+struct load_buffer {
+    uint8_t *data;
+    size_t size;
+};
+
+static int load_reserve(struct load_buffer *b, size_t size) {
+    if (size <= b->size) {
+        return 0;
+    }
+    // Nothing in it is kept: no need to copy with realloc()
+    free(b->data);
+    b->data = malloc(size);
+    b->size = b->data ? size : 0;
+    return b->data ? 0 : -1;
+}
+
+/* The mmap and pread backends: a job per file on the thread pool */
+struct load_pool {
+    int backend;
+    load_path_fn path;
+    load_fn fn;
+    void *arg;
+    struct load_buffer *buffers;        /* per worker */
+};
+
+// Read a whole regular file in a buffer, or leave file->data NULL
+static void load_pread(struct load_file *file, struct load_buffer *b) {
+    struct stat st;
+    size_t done = 0;
+    ssize_t n;
+    int fd;
+    STATS_START(start);
+
+    fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size < LOAD_MAX_SIZE &&
+        load_reserve(b, st.st_size) == 0) {
+        // A file shrinking meanwhile is taken as it is, the parser will tell
+        while (done < (size_t) st.st_size) {
+            n = pread(fd, b->data + done, st.st_size - done, done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                done = 0;
+            }
+            if (n <= 0) {
+                break;
+            }
+            done += n;
+        }
+        if (done) {
+            file->data = b->data;
+            file->size = done;
+            STATS_ADD(bytes_loaded, done);
+        }
+    }
+    close(fd);
+    STATS_STOP(start, io_ns);
+}
+
+static void load_pool_job(void *data, size_t job, int worker) {
+    struct load_pool *p = data;
+    struct load_file file;
+
+    file.job = job;
+    file.path = p->path(p->arg, job);
+    file.data = NULL;
+    file.size = 0;
+    if (p->backend == LOAD_PREAD && strcmp(file.path, "-")) {
+        load_pread(&file, &p->buffers[worker]);
+    }
+    p->fn(p->arg, &file, worker);
+}
+
+static int load_pool_run(int backend, int nthreads, size_t njobs, load_path_fn path, load_fn fn, void *arg) {
+    struct load_pool p;
+    int i, rc;
+
+    p.backend = backend;
+    p.path = path;
+    p.fn = fn;
+    p.arg = arg;
+    p.buffers = calloc(nthreads, sizeof(struct load_buffer));
+    if (!p.buffers) {
+        errno = ENOMEM;
+        return -1;
+    }
+    rc = pool_run(nthreads, njobs, load_pool_job, &p);
+    for (i = 0; i < nthreads; i++) {
+        free(p.buffers[i].data);
+    }
+    free(p.buffers);
+    return rc < 0 ? rc : backend;
+}
+
+#if LOAD_HAVE_URING
+/* The io_uring backend. Each file goes through a slot: an openat of its path,
+ * then a read of the whole file into the buffer of the slot, linked to the
+ * close of the descriptor. The size comes from an fstat() of the descriptor
+ * in between: the kernel always runs an IORING_OP_STATX on a worker thread,
+ * which costs more than the read. The loaded files are queued for the
+ * workers, which run the callback and give the slot back.
+ *
+ * There is no thread dedicated to the ring: a worker needing a file while
+ * none is ready tops up the submissions and waits for completions, and the
+ * others wait for it. So with LOAD_DEPTH files in flight the syscalls are
+ * batched, and the kernel reads the next files while the workers decode.
+ */
+
+#define SLOT_FREE                       0
+#define SLOT_OPENING                    1       /* openat in flight */
+#define SLOT_READING                    2       /* read and close, or only close */
+#define SLOT_READY                      3
+#define SLOT_BUSY                       4       /* in the callback */
+
+#define OP_OPEN                         0
+#define OP_READ                         1
+#define OP_CLOSE                        2
+
+struct load_ring {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned tail;                      /* SQEs filled so far */
+    unsigned unsubmitted;               /* filled but not given to the kernel yet */
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *map;
+    size_t map_size;
+    size_t sqes_size;
+};
+
+struct load_slot {
+    struct load_file file;
+    int state;                          /* SLOT_* */
+    int fd;
+    int pending;                        /* operations in flight */
+    struct load_buffer buf;
+    struct load_slot *next;             /* in the free or ready list */
+};
+
+struct load {
+    struct load_ring ring;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct load_slot *slots;
+    int nslots;
+    struct load_slot *free;
+    struct load_slot *ready;            /* oldest first */
+    struct load_slot *ready_last;
+    size_t next;                        /* next job to start */
+    size_t njobs;
+    int inflight;                       /* slots with operations in flight */
+    int driving;                        /* a worker is waiting on the ring */
+    int broken;                         /* the ring failed: nothing is loaded anymore */
+    load_path_fn path;
+    load_fn fn;
+    void *arg;
+};
+
+struct load_worker {
+    struct load *load;
+    int id;
+};
+
+// The operations used must all be there (Linux 5.6)
+static int ring_probe(struct load_ring *ring) {
+    static const int ops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+    struct io_uring_probe *probe;
+    size_t i;
+    int rc;
+
+    probe = calloc(1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+    if (!probe) {
+        return -1;
+    }
+    rc = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256);
+    for (i = 0; rc >= 0 && i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+            errno = ENOSYS;
+            rc = -1;
+        }
+    }
+    free(probe);
+    return rc < 0 ? -1 : 0;
+}
+
+static void ring_close(struct load_ring *ring) {
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->map) {
+        munmap(ring->map, ring->map_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+}
+
+/* Set up a ring of entries SQEs, with the raw syscalls (no liburing).
+ * Returns -1 and sets errno if io_uring isn't available.
+ */
+static int ring_init(struct load_ring *ring, unsigned entries) {
+    struct io_uring_params p;
+    size_t sq_size, cq_size;
+    uint8_t *map;
+    unsigned i, *array;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0) {
+        return -1;
+    }
+    // A single mapping of both rings came with Linux 5.4, before the operations needed
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || ring_probe(ring) < 0) {
+        ring_close(ring);
+        errno = ENOSYS;
+        return -1;
+    }
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->map_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                     IORING_OFF_SQ_RING);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        ring_close(ring);
+        return -1;
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        ring_close(ring);
+        return -1;
+    }
+
+    map = ring->map;
+    ring->entries = p.sq_entries;
+    ring->sq_head = (unsigned *) (map + p.sq_off.head);
+    ring->sq_tail = (unsigned *) (map + p.sq_off.tail);
+    ring->sq_mask = *(unsigned *) (map + p.sq_off.ring_mask);
+    ring->cq_head = (unsigned *) (map + p.cq_off.head);
+    ring->cq_tail = (unsigned *) (map + p.cq_off.tail);
+    ring->cq_mask = *(unsigned *) (map + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (map + p.cq_off.cqes);
+    ring->tail = *ring->sq_tail;
+    // The SQEs are filled in order: the indirection array never changes
+    array = (unsigned *) (map + p.sq_off.array);
+    for (i = 0; i < p.sq_entries; i++) {
+        array[i] = i;
+    }
+    return 0;
+}
+
+static unsigned ring_space(const struct load_ring *ring) {
+    return ring->entries - (ring->tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE));
+}
+
+// The next SQE, cleared; there must be space for it
+static struct io_uring_sqe *ring_sqe(struct load_ring *ring, struct load_slot *slot, size_t index, int op) {
+    struct io_uring_sqe *sqe = &ring->sqes[ring->tail & ring->sq_mask];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uint64_t) index << 2 | op;
+    ring->tail++;
+    ring->unsubmitted++;
+    slot->pending++;
+    return sqe;
+}
+
+/* Give the new SQEs to the kernel, and wait for a completion if wait is set.
+ * Returns -1 and sets errno if the ring can't be used anymore.
+ */
+static int ring_enter(struct load_ring *ring, int wait) {
+    int rc;
+
+    __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+    for (;;) {
+        rc = syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted, wait,
+                     wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (rc >= 0) {
+            ring->unsubmitted -= rc;
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        // Out of resources for now: what completed frees some
+        return errno == EAGAIN || errno == EBUSY ? 0 : -1;
+    }
+}
+
+static void load_ready(struct load *l, struct load_slot *slot) {
+    slot->state = SLOT_READY;
+    slot->next = NULL;
+    if (l->ready) {
+        l->ready_last->next = slot;
+    } else {
+        l->ready = slot;
+    }
+    l->ready_last = slot;
+}
+
+// Submit the openat of the next file
+static void load_start(struct load *l, struct load_slot *slot) {
+    size_t index = slot - l->slots;
+    struct io_uring_sqe *sqe;
+
+    slot->file.job = l->next++;
+    slot->file.path = l->path(l->arg, slot->file.job);
+    slot->file.data = NULL;
+    slot->file.size = 0;
+    slot->fd = -1;
+    slot->pending = 0;
+    if (l->broken || !strcmp(slot->file.path, "-")) {
+        load_ready(l, slot);
+        return;
+    }
+    slot->state = SLOT_OPENING;
+    l->inflight++;
+
+    sqe = ring_sqe(&l->ring, slot, index, OP_OPEN);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t) slot->file.path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+}
+
+/* Once opened, read the whole file with the close linked to it, or only
+ * close it if it isn't to be loaded.
+ */
+static void load_read(struct load *l, struct load_slot *slot) {
+    size_t index = slot - l->slots;
+    struct io_uring_sqe *sqe;
+    struct stat st;
+
+    if (slot->fd < 0) {
+        l->inflight--;
+        load_ready(l, slot);
+        return;
+    }
+    if (fstat(slot->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size < LOAD_MAX_SIZE &&
+        load_reserve(&slot->buf, st.st_size) == 0) {
+        sqe = ring_sqe(&l->ring, slot, index, OP_READ);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = slot->fd;
+        sqe->addr = (uintptr_t) slot->buf.data;
+        sqe->len = st.st_size;
+        sqe->off = 0;
+        sqe->flags = IOSQE_IO_LINK;
+    }
+    sqe = ring_sqe(&l->ring, slot, index, OP_CLOSE);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = slot->fd;
+    slot->state = SLOT_READING;
+}
+
+static void load_complete(struct load *l, const struct io_uring_cqe *cqe) {
+    struct load_slot *slot = &l->slots[cqe->user_data >> 2];
+    int res = cqe->res;
+
+    switch (cqe->user_data & 3) {
+    case OP_OPEN:
+        slot->fd = res;
+        break;
+    case OP_READ:
+        if (res > 0) {
+            slot->file.data = slot->buf.data;
+            slot->file.size = res;
+            STATS_ADD(bytes_loaded, res);
+        }
+        break;
+    case OP_CLOSE:
+        // A short or failed read breaks the link
+        if (res == -ECANCELED) {
+            close(slot->fd);
+        }
+        break;
+    }
+    if (--slot->pending) {
+        return;
+    }
+    if (slot->state == SLOT_OPENING) {
+        load_read(l, slot);
+        return;
+    }
+    l->inflight--;
+    load_ready(l, slot);
+}
+
+static void load_reap(struct load *l) {
+    struct load_ring *ring = &l->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        load_complete(l, &ring->cqes[head & ring->cq_mask]);
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* The ring failed: what is in flight is handed out unloaded, and so is
+ * everything after, for the callback to open it. Only the descriptors
+ * already opened are lost, and the buffers of the reads in flight: closing
+ * the ring doesn't stop the kernel from writing to them, so they are left to
+ * it, never reused nor freed.
+ */
+static void load_break(struct load *l) {
+    int i;
+
+    l->broken = 1;
+    for (i = 0; i < l->nslots; i++) {
+        struct load_slot *slot = &l->slots[i];
+
+        if (slot->state == SLOT_READING) {
+            slot->buf.data = NULL;
+            slot->buf.size = 0;
+        }
+        if (slot->state == SLOT_OPENING || slot->state == SLOT_READING) {
+            slot->file.data = NULL;
+            slot->file.size = 0;
+            load_ready(l, slot);
+        }
+    }
+    l->inflight = 0;
+}
+
+/* The next file for a worker, driving the ring if none is ready.
+ * Returns NULL when every file has been handed out.
+ */
+static struct load_slot *load_next(struct load *l) {
+    struct load_slot *slot = NULL;
+    int rc;
+
+    pthread_mutex_lock(&l->lock);
+    for (;;) {
+        if (l->ready) {
+            slot = l->ready;
+            l->ready = slot->next;
+            slot->state = SLOT_BUSY;
+            break;
+        }
+        if (l->next == l->njobs && !l->inflight) {
+            break;
+        }
+        if (l->driving) {
+            pthread_cond_wait(&l->cond, &l->lock);
+            continue;
+        }
+        // An openat per file, then a read and a close
+        while (l->free && l->next < l->njobs && l->inflight < LOAD_DEPTH && ring_space(&l->ring) >= 2) {
+            struct load_slot *s = l->free;
+
+            l->free = s->next;
+            load_start(l, s);
+        }
+        if (l->ready) {
+            continue;
+        }
+        if (!l->inflight) {
+            // Every slot is in a callback: wait for one to come back
+            pthread_cond_wait(&l->cond, &l->lock);
+            continue;
+        }
+        l->driving = 1;
+        pthread_mutex_unlock(&l->lock);
+        STATS_START(start);
+        rc = ring_enter(&l->ring, 1);
+        STATS_STOP(start, io_ns);
+        pthread_mutex_lock(&l->lock);
+        load_reap(l);
+        if (rc < 0) {
+            load_break(l);
+        }
+        l->driving = 0;
+        pthread_cond_broadcast(&l->cond);
+    }
+    pthread_mutex_unlock(&l->lock);
+    return slot;
+}
+
+static void load_release(struct load *l, struct load_slot *slot) {
+    pthread_mutex_lock(&l->lock);
+    slot->state = SLOT_FREE;
+    slot->next = l->free;
+    l->free = slot;
+    pthread_cond_broadcast(&l->cond);
+    pthread_mutex_unlock(&l->lock);
+}
+
+static void *load_worker(void *data) {
+    struct load_worker *w = data;
+    struct load *l = w->load;
+    struct load_slot *slot;
+
+    while ((slot = load_next(l))) {
+        l->fn(l->arg, &slot->file, w->id);
+        load_release(l, slot);
+    }
+    return NULL;
+}
+
+/* Returns 1 if io_uring can't be used, for the caller to fall back */
+static int load_uring_run(int nthreads, size_t njobs, load_path_fn path, load_fn fn, void *arg) {
+    struct load l;
+    struct load_worker *workers;
+    pthread_t *threads;
+    int i, started;
+
+    memset(&l, 0, sizeof(l));
+    // Room for the four operations of every file in flight
+    if (ring_init(&l.ring, 2 * LOAD_DEPTH) < 0) {
+        return 1;
+    }
+    l.nslots = LOAD_DEPTH + nthreads;
+    l.slots = calloc(l.nslots, sizeof(struct load_slot));
+    workers = calloc(nthreads, sizeof(struct load_worker));
+    threads = calloc(nthreads, sizeof(pthread_t));
+    if (!l.slots || !workers || !threads) {
+        free(l.slots);
+        free(workers);
+        free(threads);
+        ring_close(&l.ring);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = l.nslots - 1; i >= 0; i--) {
+        l.slots[i].next = l.free;
+        l.free = &l.slots[i];
+    }
+    l.njobs = njobs;
+    l.path = path;
+    l.fn = fn;
+    l.arg = arg;
+    pthread_mutex_init(&l.lock, NULL);
+    pthread_cond_init(&l.cond, NULL);
+
+    // The caller is worker 0, like in pool_run()
+    for (started = 0; started < nthreads; started++) {
+        workers[started].load = &l;
+        workers[started].id = started;
+        if (started && pthread_create(&threads[started], NULL, load_worker, &workers[started])) {
+            break;
+        }
+    }
+    load_worker(&workers[0]);
+    for (i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Nothing is in flight anymore, or only reads into buffers given up by load_break()
+    ring_close(&l.ring);
+    pthread_cond_destroy(&l.cond);
+    pthread_mutex_destroy(&l.lock);
+    for (i = 0; i < l.nslots; i++) {
+        free(l.slots[i].buf.data);
+    }
+    free(l.slots);
+    free(workers);
+    free(threads);
+    return 0;
+}
+#endif
+
+/* Run fn on nthreads workers (0 for one per CPU) for each of njobs files,
+ * with the files in memory as far as the backend allows. LOAD_URING falls
+ * back to LOAD_PREAD where io_uring isn't available (older kernels, seccomp
+ * filters).
+ * Returns the backend used, or -1 and sets errno if the workers couldn't be
+ * started.
+ */
+int load_run(int backend, int nthreads, size_t njobs, load_path_fn path, load_fn fn, void *arg) {
+    if (nthreads <= 0) {
+        nthreads = pool_default_threads();
+    }
+    if (nthreads > njobs) {
+        nthreads = njobs ? njobs : 1;
+    }
+#if LOAD_HAVE_URING
+    if (backend == LOAD_URING) {
+        int rc = load_uring_run(nthreads, njobs, path, fn, arg);
+
+        if (rc <= 0) {
+            return rc < 0 ? rc : LOAD_URING;
+        }
+    }
+#endif
+    if (backend == LOAD_URING) {
+        backend = LOAD_PREAD;
+    }
+    return load_pool_run(backend, nthreads, njobs, path, fn, arg);
+}
@@ -0,0 +1,35 @@
+#ifndef LOAD_H_INCLUDED
+#define LOAD_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* How load_run() gets the files in memory */
+#define LOAD_MMAP                       0       /* it doesn't: the callback opens them */
+#define LOAD_PREAD                      1       /* open, fstat, read and close on each worker */
+#define LOAD_URING                      2       /* batched through io_uring, else LOAD_PREAD */
+
+#define LOAD_DEPTH                      64      /* files in flight in the ring */
+#define LOAD_MAX_SIZE                   (256 * 1024)    /* files this big are left to be mapped */
+
+/* A file handed to the callback, with its bytes valid until it returns. data
+ * is NULL when the file wasn't loaded: it isn't a regular file, it is empty
+ * or at least LOAD_MAX_SIZE bytes, or opening or reading it failed. The
+ * callback opens it the usual way then, which reports the failures.
+ */
+struct load_file {
+    size_t job;
+    const char *path;
+    const uint8_t *data;
+    size_t size;
+};
+
+/* The path of job, and the callback run on the workers for each file as it
+ * is loaded (in no particular order), like pool_fn.
+ */
+typedef const char *(*load_path_fn)(void *arg, size_t job);
+typedef void (*load_fn)(void *arg, const struct load_file *file, int worker);
+
+int load_run(int backend, int nthreads, size_t njobs, load_path_fn path, load_fn fn, void *arg);
+const char *load_name(int backend);
+#endif
@@ -0,0 +1,192 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "data.h"
+#include "arena.h"
+#include "io.h"
+#include "parser.h"
+#include "intern.h"
+
+/* The credentials of a ccache by server principal. The principals are
+ * interned by realm and components, like cc_names_principal() does, and the
+ * credentials of each are kept together, newest first.
+ */
+struct cc_servers {
+    struct cc_names names;
+    uint32_t *first;            /* by principal ID, one more: its range in creds */
+    uint32_t *creds;            /* credential numbers, for cc_get() */
+};
+
+struct server_entry {
+    uint32_t id;
+    uint32_t endtime;
+    uint32_t n;
+};
+
+// By server, then endtime from the newest; the last one in the file first on a tie
+static int compare_entries(const void *a, const void *b) {
+    const struct server_entry *x = a, *y = b;
+
+    if (x->id != y->id) {
+        return x->id < y->id ? -1 : 1;
+    }
+    if (x->endtime != y->endtime) {
+        return x->endtime > y->endtime ? -1 : 1;
+    }
+    return x->n > y->n ? -1 : x->n < y->n;
+}
+
+static int servers_fail(struct ccache *cc, struct cc_servers *s, struct server_entry *entries,
+                        int err, const char *where) {
+    free(entries);
+    cc_servers_free(s);
+    cc->where = where;
+    return err;
+}
+
+/* Build the table of the credentials by server, once: a pass over the index
+ * decoding only the principals, the times and the flags of every credential
+ * (the filter is left to cc_get()). It needs a mapped file.
+ */
+int cc_servers_build(struct ccache *cc) {
+    struct cc_servers *s;
+    struct server_entry *entries;
+    struct credential cred;
+    struct arena arena;
+    struct reader r;
+    size_t n, count;
+    int rc;
+
+    if (cc->servers) {
+        return CC_OK;
+    }
+    rc = cc_index_build(cc);
+    if (rc < 0) {
+        return rc;
+    }
+    count = cc->index.count;
+    if (count >= UINT32_MAX) {
+        cc->where = "index";
+        return CC_ERR_NOMEM;
+    }
+    s = calloc(1, sizeof(*s));
+    entries = malloc((count + 1) * sizeof(struct server_entry));
+    if (!s || !entries) {
+        free(s);
+        free(entries);
+        cc->where = "index";
+        return CC_ERR_NOMEM;
+    }
+    cc_names_init(&s->names);
+
+    arena_init(&arena, 0);
+    for (n = 0; n < count; n++) {
+        r = cc->reader;
+        reader_seek(&r, cc->index.entries[n].offset);
+        r.leftover = cc->index.entries[n].length;
+        arena_reset(&arena);
+        rc = check_credential_filter(&r, &cred, &arena, NULL, 1);
+        if (rc == CC_OK) {
+            rc = cc_names_principal(&s->names, &cred.server, &entries[n].id);
+        }
+        if (rc < 0) {
+            arena_free(&arena);
+            cc->count = n;
+            return servers_fail(cc, s, entries, rc, rc == CC_ERR_NOMEM ? "index" : "credential");
+        }
+        entries[n].endtime = cred.endtime;
+        entries[n].n = n;
+    }
+    arena_free(&arena);
+    qsort(entries, count, sizeof(struct server_entry), compare_entries);
+
+    s->first = calloc(s->names.principals.count + 1, sizeof(uint32_t));
+    s->creds = malloc((count + 1) * sizeof(uint32_t));
+    if (!s->first || !s->creds) {
+        return servers_fail(cc, s, entries, CC_ERR_NOMEM, "index");
+    }
+    for (n = 0; n < count; n++) {
+        s->creds[n] = entries[n].n;
+        s->first[entries[n].id + 1]++;
+    }
+    for (n = 0; n < s->names.principals.count; n++) {
+        s->first[n + 1] += s->first[n];
+    }
+    free(entries);
+    cc->servers = s;
+    return CC_OK;
+}
+
+/* The credentials for a server principal, as numbers to give cc_get(),
+ * newest first (by endtime). The name type isn't compared, like krb5 does by
+ * default. The table is built by the first call; the others are a hash
+ * lookup. *creds stays valid until cc_close().
+ * Returns CC_OK, CC_ERR_NOT_FOUND if there are none, or the error of the
+ * build.
+ */
+int cc_find_server(struct ccache *cc, const struct principal *server, const uint32_t **creds, size_t *count) {
+    struct cc_servers *s;
+    uint32_t id;
+    int rc;
+
+    *creds = NULL;
+    *count = 0;
+    rc = cc_servers_build(cc);
+    if (rc < 0) {
+        return rc;
+    }
+    s = cc->servers;
+    rc = cc_names_find(&s->names, server, &id);
+    if (rc < 0) {
+        return rc;
+    }
+    *creds = s->creds + s->first[id];
+    *count = s->first[id + 1] - s->first[id];
+    return CC_OK;
+}
+
+/* Same as cc_find_server() for a principal written comp/comp@REALM, as
+ * print_principal() does: the realm is after the last '@', and the
+ * components are separated by '/'.
+ */
+int cc_find_server_name(struct ccache *cc, const char *name, const uint32_t **creds, size_t *count) {
+    const char *at = strrchr(name, '@'), *p, *end;
+    struct principal princ;
+    uint32_t i;
+    int rc;
+
+    if (!at) {
+        at = name + strlen(name);
+    }
+    memset(&princ, 0, sizeof(princ));
+    princ.realm.value = *at ? at + 1 : at;
+    princ.realm.length = strlen(princ.realm.value);
+    princ.comp_count = 1;
+    for (p = name; p < at; p++) {
+        princ.comp_count += *p == '/';
+    }
+    princ.components = malloc(princ.comp_count * sizeof(struct data));
+    if (!princ.components) {
+        return CC_ERR_NOMEM;
+    }
+    for (i = 0, p = name; i < princ.comp_count; i++, p = end + 1) {
+        for (end = p; end < at && *end != '/'; end++)
+            ;
+        princ.components[i].value = p;
+        princ.components[i].length = end - p;
+    }
+    rc = cc_find_server(cc, &princ, creds, count);
+    free(princ.components);
+    return rc;
+}
+
+void cc_servers_free(struct cc_servers *s) {
+    if (!s) {
+        return;
+    }
+    cc_names_free(&s->names);
+    free(s->first);
+    free(s->creds);
+    free(s);
+}
@@ -0,0 +1,975 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include "data.h"
+#include "names.h"
+#include "tables.h"
+#include "parser.h"
+#include "compact.h"
+#include "pool.h"
+#include "load.h"
+#include "scan.h"
+#include "metrics.h"
+
+#define METRICS_NAME(id, name, help) name,
+#define METRICS_HELP(id, name, help) help,
+static const char *const family_names[METRICS_NFAMILIES] = { METRICS_FAMILIES(METRICS_NAME) };
+static const char *const family_helps[METRICS_NFAMILIES] = { METRICS_FAMILIES(METRICS_HELP) };
+#undef METRICS_NAME
+#undef METRICS_HELP
+
+struct flag_name {
+    uint32_t flag;
+    const char *name;
+};
+
+#define FLAG_ENTRY(flag, name) { flag, name },
+static const struct flag_name flag_names[] = { TICKET_FLAGS(FLAG_ENTRY) };
+#undef FLAG_ENTRY
+
+#define NFLAGS                          (sizeof(flag_names) / sizeof(flag_names[0]))
+
+int metrics_init(struct metrics *m, char **paths, int npaths, const struct print_options *opts,
+                 int nthreads, int io, unsigned interval) {
+    int i, f;
+
+    memset(m, 0, sizeof(*m));
+    m->paths = paths;
+    m->npaths = npaths;
+    m->opts = opts;
+    m->nthreads = nthreads;
+    m->io = io;
+    m->interval = interval ? interval : METRICS_INTERVAL;
+    m->fd = -1;
+    m->wake = -1;
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->cond, NULL);
+    m->nworkers = nthreads > 0 ? nthreads : pool_default_threads();
+    m->workers = calloc(m->nworkers, sizeof(struct metrics_worker));
+    if (!m->workers) {
+        return -1;
+    }
+    for (i = 0; i < m->nworkers; i++) {
+        struct metrics_worker *w = &m->workers[i];
+
+        if (out_init(&w->names, -1, 1024) < 0) {
+            return -1;
+        }
+        for (f = 0; f < METRICS_NFAMILIES; f++) {
+            if (out_init(&w->parts[f], -1, 1024) < 0) {
+                return -1;
+            }
+        }
+    }
+    m->conns = calloc(METRICS_CLIENTS, sizeof(struct metrics_conn));
+    if (!m->conns) {
+        return -1;
+    }
+    for (i = 0; i < METRICS_CLIENTS; i++) {
+        m->conns[i].fd = -1;
+        if (out_init(&m->conns[i].reply, -1, 1024) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Listen on a Unix socket (a path with a '/', or unix:path) or on a TCP port
+ * of the loopback interface: PORT, 127.0.0.1:PORT, localhost:PORT or
+ * [::1]:PORT. A socket left by a process that is gone is replaced.
+ * Returns -1 and sets errno on failure, EINVAL for any other address.
+ */
+int metrics_listen(struct metrics *m, const char *address) {
+    struct sockaddr_storage ss;
+    socklen_t length;
+    const char *colon;
+    unsigned long port;
+    char *end;
+    int fd, one = 1;
+
+    memset(&ss, 0, sizeof(ss));
+    if (!strncmp(address, "unix:", 5) || strchr(address, '/')) {
+        struct sockaddr_un *un = (struct sockaddr_un *) &ss;
+        struct stat st;
+        int probe;
+
+        if (!strncmp(address, "unix:", 5)) {
+            address += 5;
+        }
+        if (!*address || strlen(address) >= sizeof(un->sun_path)) {
+            errno = !*address ? EINVAL : ENAMETOOLONG;
+            return -1;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, address);
+        length = sizeof(struct sockaddr_un);
+        // Nobody answers on a stale socket
+        if (lstat(address, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (probe >= 0 && connect(probe, (struct sockaddr *) un, length) == 0) {
+                close(probe);
+                errno = EADDRINUSE;
+                return -1;
+            }
+            if (probe >= 0) {
+                close(probe);
+            }
+            unlink(address);
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd < 0) {
+            return -1;
+        }
+    } else {
+        colon = strrchr(address, ':');
+        port = strtoul(colon ? colon + 1 : address, &end, 10);
+        if (*end || end == (colon ? colon + 1 : address) || !port || port > 65535) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (colon && colon - address == 5 && !strncmp(address, "[::1]", 5)) {
+            struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &ss;
+
+            sin6->sin6_family = AF_INET6;
+            sin6->sin6_port = htons(port);
+            sin6->sin6_addr = in6addr_loopback;
+            length = sizeof(struct sockaddr_in6);
+        } else if (!colon || (colon - address == 9 && !strncmp(address, "localhost", 9)) ||
+                   (colon - address == 9 && !strncmp(address, "127.0.0.1", 9))) {
+            struct sockaddr_in *sin = (struct sockaddr_in *) &ss;
+
+            sin->sin_family = AF_INET;
+            sin->sin_port = htons(port);
+            sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            length = sizeof(struct sockaddr_in);
+        } else {
+            // Credentials telemetry is not for the network
+            errno = EINVAL;
+            return -1;
+        }
+        fd = socket(ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (bind(fd, (struct sockaddr *) &ss, length) < 0 || listen(fd, METRICS_BACKLOG) < 0) {
+        int err = errno;
+
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    m->fd = fd;
+    return 0;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(((const struct scan_file *) a)->path, ((const struct scan_file *) b)->path);
+}
+
+/* List the paths again, and match the files found with the ones known by
+ * their path: both are sorted. Those gone are dropped with their series.
+ * Returns 1 if the set of files changed, -1 on failure.
+ */
+static int metrics_list(struct metrics *m) {
+    struct metrics_file *files;
+    struct scan scan;
+    size_t i = 0, j, n = 0;
+    int k, changed = 0;
+
+    scan_init(&scan, NULL, m->opts);
+    for (k = 0; k < m->npaths; k++) {
+        if (scan_add_path(&scan, m->paths[k]) == 0) {
+            continue;
+        }
+        // A ccache missing or out of reach is served as an error
+        if (errno == ENOMEM || scan_add_file(&scan, m->paths[k], 0) < 0) {
+            scan_free(&scan);
+            return -1;
+        }
+    }
+    qsort(scan.files, scan.count, sizeof(struct scan_file), compare_paths);
+    files = calloc(scan.count ? scan.count : 1, sizeof(struct metrics_file));
+    if (!files) {
+        scan_free(&scan);
+        return -1;
+    }
+    for (j = 0; j < scan.count; j++) {
+        struct scan_file *sf = &scan.files[j];
+        int cmp = -1;
+
+        // Given twice, or both given and found in a directory
+        if (n && !strcmp(files[n - 1].path, sf->path)) {
+            files[n - 1].discovered &= sf->discovered;
+            continue;
+        }
+        while (i < m->count && (cmp = strcmp(m->files[i].path, sf->path)) < 0) {
+            free(m->files[i].path);
+            free(m->files[i].text);
+            i++;
+            changed = 1;
+        }
+        if (i < m->count && !cmp) {
+            files[n] = m->files[i++];
+        } else {
+            files[n].path = sf->path;
+            sf->path = NULL;
+            changed = 1;
+        }
+        files[n++].discovered = sf->discovered;
+    }
+    for (; i < m->count; i++) {
+        free(m->files[i].path);
+        free(m->files[i].text);
+        changed = 1;
+    }
+    free(m->files);
+    m->files = files;
+    m->count = n;
+    scan_free(&scan);
+    return changed;
+}
+
+// The client principal of a credential, added to the file being read if new
+static struct metrics_client *metrics_client(struct metrics_worker *w, const struct credential *cred) {
+    struct metrics_client *c;
+    size_t start = w->names.len, length, i;
+
+    print_principal(&w->names, &cred->client);
+    if (w->names.error) {
+        return NULL;
+    }
+    length = w->names.len - start;
+    for (i = 0; i < w->nclients; i++) {
+        c = &w->clients[i];
+        if (c->length == length && !memcmp(w->names.buf + c->name, w->names.buf + start, length)) {
+            w->names.len = start;
+            return c;
+        }
+    }
+    if (w->nclients == w->clients_size) {
+        size_t size = w->clients_size ? w->clients_size * 2 : 8;
+
+        c = realloc(w->clients, size * sizeof(struct metrics_client));
+        if (!c) {
+            return NULL;
+        }
+        w->clients = c;
+        w->clients_size = size;
+    }
+    c = &w->clients[w->nclients++];
+    memset(c, 0, sizeof(*c));
+    c->name = start;
+    c->length = length;
+    c->endtime = UINT32_MAX;
+    return c;
+}
+
+static int metrics_count(struct metrics_worker *w, const struct credential *cred) {
+    struct metrics_client *c;
+    struct metrics_enctype *e;
+    size_t i, client;
+
+    // The configuration entries krb5 keeps as credentials are no tickets
+    if (cred->server.realm.length == sizeof(CC_CONF_REALM) - 1 &&
+        !memcmp(cred->server.realm.value, CC_CONF_REALM, sizeof(CC_CONF_REALM) - 1)) {
+        return CC_OK;
+    }
+    c = metrics_client(w, cred);
+    if (!c) {
+        return CC_ERR_NOMEM;
+    }
+    c->count++;
+    if (cred->endtime < c->endtime) {
+        c->endtime = cred->endtime;
+    }
+    if (cred->ticket_flags & TKT_FLG_RENEWABLE && (!c->renew_till || cred->renew_till < c->renew_till)) {
+        c->renew_till = cred->renew_till;
+    }
+    for (i = 0; i < NFLAGS; i++) {
+        if (cred->ticket_flags & flag_names[i].flag) {
+            c->flags[i]++;
+        }
+    }
+
+    client = c - w->clients;
+    for (i = 0; i < w->nenctypes; i++) {
+        e = &w->enctypes[i];
+        if (e->client == client && e->enctype == cred->keyblock.enctype) {
+            e->count++;
+            return CC_OK;
+        }
+    }
+    if (w->nenctypes == w->enctypes_size) {
+        size_t size = w->enctypes_size ? w->enctypes_size * 2 : 8;
+
+        e = realloc(w->enctypes, size * sizeof(struct metrics_enctype));
+        if (!e) {
+            return CC_ERR_NOMEM;
+        }
+        w->enctypes = e;
+        w->enctypes_size = size;
+    }
+    w->enctypes[w->nenctypes++] = (struct metrics_enctype) { client, cred->keyblock.enctype, 1 };
+    return CC_OK;
+}
+
+// A label value, with the escapes of the exposition format
+static void out_label(struct outbuf *o, const char *str, size_t length) {
+    size_t i;
+
+    out_char(o, '"');
+    for (i = 0; i < length; i++) {
+        switch (str[i]) {
+        case '\\':
+            out_lit(o, "\\\\");
+            break;
+        case '"':
+            out_lit(o, "\\\"");
+            break;
+        case '\n':
+            out_lit(o, "\\n");
+            break;
+        default:
+            out_char(o, str[i]);
+        }
+    }
+    out_char(o, '"');
+}
+
+// The name and labels of a series, up to the last label (left open)
+static void series_start(struct metrics_worker *w, int family, const char *path,
+                         const struct metrics_client *c) {
+    struct outbuf *o = &w->parts[family];
+
+    out_str(o, family_names[family]);
+    out_lit(o, "{file=");
+    out_label(o, path, strlen(path));
+    if (c) {
+        out_lit(o, ",principal=");
+        out_label(o, w->names.buf + c->name, c->length);
+    }
+}
+
+static void series_end(struct outbuf *o, uint64_t value) {
+    out_lit(o, "} ");
+    out_u64(o, value);
+    out_char(o, '\n');
+}
+
+/* Render the series of a file from the counts of its clients, or its error
+ * when err is set, and replace the ones of its last read.
+ */
+static int metrics_render(struct metrics_worker *w, struct metrics_file *f, const char *error) {
+    struct outbuf *o;
+    size_t i, k, total = 0;
+    char *text;
+    int family;
+
+    for (family = 0; family < METRICS_NFAMILIES; family++) {
+        w->parts[family].len = 0;
+    }
+    for (i = 0; !error && i < w->nclients; i++) {
+        const struct metrics_client *c = &w->clients[i];
+
+        series_start(w, METRICS_CREDENTIALS, f->path, c);
+        series_end(&w->parts[METRICS_CREDENTIALS], c->count);
+        series_start(w, METRICS_ENDTIME, f->path, c);
+        series_end(&w->parts[METRICS_ENDTIME], c->endtime);
+        if (c->renew_till) {
+            series_start(w, METRICS_RENEW_TILL, f->path, c);
+            series_end(&w->parts[METRICS_RENEW_TILL], c->renew_till);
+        }
+        o = &w->parts[METRICS_FLAGS];
+        for (k = 0; k < NFLAGS; k++) {
+            if (!c->flags[k]) {
+                continue;
+            }
+            series_start(w, METRICS_FLAGS, f->path, c);
+            out_lit(o, ",flag=");
+            out_label(o, flag_names[k].name, strlen(flag_names[k].name));
+            series_end(o, c->flags[k]);
+        }
+        o = &w->parts[METRICS_ENCTYPES];
+        for (k = 0; k < w->nenctypes; k++) {
+            const struct metrics_enctype *e = &w->enctypes[k];
+            const char *name;
+            size_t length;
+
+            if (e->client != i) {
+                continue;
+            }
+            series_start(w, METRICS_ENCTYPES, f->path, c);
+            out_lit(o, ",enctype=\"");
+            name = enctype_name(e->enctype, &length);
+            if (name) {
+                out_mem(o, name, length);
+            } else {
+                out_u64(o, e->enctype);
+            }
+            out_char(o, '"');
+            series_end(o, e->count);
+        }
+    }
+    if (error) {
+        o = &w->parts[METRICS_ERRORS];
+        series_start(w, METRICS_ERRORS, f->path, NULL);
+        out_lit(o, ",error=");
+        out_label(o, error, strlen(error));
+        series_end(o, 1);
+    }
+
+    for (family = 0; family < METRICS_NFAMILIES; family++) {
+        if (w->parts[family].error) {
+            return -1;
+        }
+        total += w->parts[family].len;
+    }
+    text = malloc(total ? total : 1);
+    if (!text) {
+        return -1;
+    }
+    free(f->text);
+    f->text = text;
+    for (family = 0, total = 0; family < METRICS_NFAMILIES; family++) {
+        f->parts[family] = total;
+        memcpy(text + total, w->parts[family].buf, w->parts[family].len);
+        total += w->parts[family].len;
+    }
+    f->parts[METRICS_NFAMILIES] = total;
+    return 0;
+}
+
+static const char *metrics_path(void *arg, size_t job) {
+    struct metrics *m = arg;
+
+    return m->files[m->jobs[job].file].path;
+}
+
+/* Read a file that changed and render its series. A file given that is
+ * caught while it is being written keeps the series of its last read, and is
+ * tried again on the next look; whatever a directory holds beside ccaches has
+ * none, until it changes.
+ */
+static void metrics_job(void *arg, const struct load_file *loaded, int worker) {
+    struct metrics *m = arg;
+    struct metrics_job *job = &m->jobs[loaded->job];
+    struct metrics_file *f = &m->files[job->file];
+    struct metrics_worker *w = &m->workers[worker];
+    struct credential *cred;
+    struct ccache *cc;
+    const char *error = NULL;
+    int ret;
+
+    w->names.len = 0;
+    w->names.error = 0;
+    w->nclients = 0;
+    w->nenctypes = 0;
+    // Never mapped: a served ccache truncated during a look can't bring the server down
+    if (loaded->data) {
+        ret = cc_memopen(&cc, loaded->data, loaded->size);
+    } else {
+        ret = cc_load(&cc, f->path, &w->data, &w->data_size);
+    }
+    if (ret == CC_OK) {
+        cc_set_filter(cc, m->opts->filter);
+        // Only the principals, times, flags and enctype are needed
+        cc_set_summary(cc, 1);
+    }
+    while (ret == CC_OK && (ret = cc_next(cc, &cred)) == CC_OK) {
+        ret = metrics_count(w, cred);
+    }
+
+    f->read = 0;
+    if (f->discovered && (ret == CC_ERR_NOT_CCACHE || ret == CC_ERR_VERSION || ret == CC_ERR_TRUNCATED)) {
+        w->nclients = 0;
+    } else if (ret == CC_ERR_TRUNCATED) {
+        cc_close(cc);
+        return;
+    } else if (ret < 0) {
+        error = ret == CC_ERR_IO && cc ? strerror(cc->sys_errno) : cc_strerror(ret);
+    }
+    cc_close(cc);
+    if (metrics_render(w, f, error) < 0) {
+        return;
+    }
+    if (job->stat_ok) {
+        f->read = 1;
+        f->mtime = job->st.st_mtim;
+        f->size = job->st.st_size;
+        f->dev = job->st.st_dev;
+        f->ino = job->st.st_ino;
+    }
+}
+
+// Drop a reference to a body, under the lock
+static void body_release(struct metrics_body *b) {
+    if (b && !--b->refs) {
+        out_free(&b->text);
+        free(b);
+    }
+}
+
+// The series of all the files, family by family
+static void metrics_build(struct metrics *m, struct metrics_body *b) {
+    int family;
+    size_t i;
+
+    for (family = 0; family < METRICS_NFAMILIES; family++) {
+        out_lit(&b->text, "# HELP ");
+        out_str(&b->text, family_names[family]);
+        out_char(&b->text, ' ');
+        out_str(&b->text, family_helps[family]);
+        out_lit(&b->text, "\n# TYPE ");
+        out_str(&b->text, family_names[family]);
+        out_lit(&b->text, " gauge\n");
+        for (i = 0; i < m->count; i++) {
+            const struct metrics_file *f = &m->files[i];
+
+            if (f->text) {
+                out_mem(&b->text, f->text + f->parts[family], f->parts[family + 1] - f->parts[family]);
+            }
+        }
+    }
+    b->files = m->count;
+}
+
+/* Look at the files: list the paths again, and read the files whose mtime,
+ * size or inode changed since their last read, or that weren't read yet. The
+ * body is built again only if some file changed, and published for the
+ * scrapes to come.
+ * Returns -1 and sets errno on failure.
+ */
+int metrics_check(struct metrics *m) {
+    struct metrics_body *body = NULL;
+    struct metrics_job *jobs;
+    size_t i;
+    int changed, err;
+
+    changed = metrics_list(m);
+    if (changed < 0) {
+        return -1;
+    }
+    jobs = realloc(m->jobs, (m->count ? m->count : 1) * sizeof(struct metrics_job));
+    if (!jobs) {
+        return -1;
+    }
+    m->jobs = jobs;
+    m->njobs = 0;
+    for (i = 0; i < m->count; i++) {
+        struct metrics_file *f = &m->files[i];
+        struct metrics_job *job = &m->jobs[m->njobs];
+
+        job->file = i;
+        job->stat_ok = stat(f->path, &job->st) == 0;
+        if (f->read && job->stat_ok && job->st.st_mtim.tv_sec == f->mtime.tv_sec &&
+            job->st.st_mtim.tv_nsec == f->mtime.tv_nsec && job->st.st_size == f->size &&
+            job->st.st_dev == f->dev && job->st.st_ino == f->ino) {
+            continue;
+        }
+        m->njobs++;
+    }
+    if (m->njobs && load_run(m->io, m->nworkers, m->njobs, metrics_path, metrics_job, m) < 0) {
+        return -1;
+    }
+    // Only the looks publish a body: they read m->body without the lock
+    if (changed || m->njobs || !m->body) {
+        body = calloc(1, sizeof(struct metrics_body));
+        if (!body || out_init(&body->text, -1, m->body ? m->body->text.len : 0) < 0) {
+            free(body);
+            return -1;
+        }
+        metrics_build(m, body);
+        if (body->text.error) {
+            err = body->text.error;
+            out_free(&body->text);
+            free(body);
+            errno = err;
+            return -1;
+        }
+        body->refs = 1;
+    }
+    pthread_mutex_lock(&m->lock);
+    m->reads += m->njobs;
+    m->checked = time(NULL);
+    if (body) {
+        body_release(m->body);
+        m->body = body;
+    }
+    pthread_mutex_unlock(&m->lock);
+    return 0;
+}
+
+/* The looks after the first, every interval seconds until stopped. The first
+ * that fails ends them, and closes the wake pipe for metrics_run() to return.
+ */
+static void *metrics_checker(void *arg) {
+    struct metrics *m = arg;
+    struct timespec next;
+    int err = 0;
+
+    clock_gettime(CLOCK_REALTIME, &next);
+    pthread_mutex_lock(&m->lock);
+    while (!err) {
+        next.tv_sec += m->interval;
+        while (!m->stop && pthread_cond_timedwait(&m->cond, &m->lock, &next) != ETIMEDOUT) {
+        }
+        if (m->stop) {
+            break;
+        }
+        pthread_mutex_unlock(&m->lock);
+        clock_gettime(CLOCK_REALTIME, &next);
+        if (metrics_check(m) < 0) {
+            err = errno;
+        }
+        pthread_mutex_lock(&m->lock);
+    }
+    m->error = err;
+    pthread_mutex_unlock(&m->lock);
+    if (err) {
+        close(m->wake);
+    }
+    return NULL;
+}
+
+// Free the slot of a connection, answered or given up
+static void conn_close(struct metrics *m, struct metrics_conn *c) {
+    close(c->fd);
+    c->fd = -1;
+    c->len = 0;
+    c->niov = 0;
+    if (c->body) {
+        pthread_mutex_lock(&m->lock);
+        body_release(c->body);
+        pthread_mutex_unlock(&m->lock);
+        c->body = NULL;
+    }
+}
+
+/* Send what the socket takes of the reply left.
+ * Returns 1 once all of it is sent, 0 if the socket is full, -1 on failure.
+ */
+static int send_reply(struct metrics_conn *c) {
+    struct msghdr msg;
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg));
+    while (c->niov) {
+        msg.msg_iov = c->iov;
+        msg.msg_iovlen = c->niov;
+        n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        while (c->niov && (size_t) n >= c->iov[0].iov_len) {
+            n -= c->iov[0].iov_len;
+            c->niov--;
+            memmove(c->iov, c->iov + 1, c->niov * sizeof(struct iovec));
+        }
+        if (c->niov) {
+            c->iov[0].iov_base = (char *) c->iov[0].iov_base + n;
+            c->iov[0].iov_len -= n;
+        }
+    }
+    return 1;
+}
+
+static void reply_status(struct metrics_conn *c, const char *status, const char *extra) {
+    int n;
+
+    n = snprintf(c->header, sizeof(c->header), "HTTP/1.1 %s\r\nContent-Type: text/plain\r\n%s"
+                 "Content-Length: %zu\r\nConnection: close\r\n\r\n%s\n",
+                 status, extra, strlen(status) + 1, status);
+    c->iov[0].iov_base = c->header;
+    c->iov[0].iov_len = n;
+    c->niov = 1;
+}
+
+/* Answer a scrape: the body published by the last look, then the series of
+ * the server itself, that change with every look.
+ */
+static void reply_metrics(struct metrics *m, struct metrics_conn *c, int head) {
+    uint64_t reads;
+    time_t checked;
+    int n;
+
+    pthread_mutex_lock(&m->lock);
+    c->body = m->body;
+    c->body->refs++;
+    reads = m->reads;
+    checked = m->checked;
+    pthread_mutex_unlock(&m->lock);
+
+    c->reply.len = 0;
+    c->reply.error = 0;
+    out_lit(&c->reply, "# HELP cccache_files Files served, listed from the paths given\n");
+    out_lit(&c->reply, "# TYPE cccache_files gauge\ncccache_files ");
+    out_u64(&c->reply, c->body->files);
+    out_lit(&c->reply, "\n# HELP cccache_reads_total Files read since the start, the first time or after they changed\n");
+    out_lit(&c->reply, "# TYPE cccache_reads_total counter\ncccache_reads_total ");
+    out_u64(&c->reply, reads);
+    out_lit(&c->reply, "\n# HELP cccache_last_check_timestamp_seconds Last look at the files, in seconds since the epoch\n");
+    out_lit(&c->reply, "# TYPE cccache_last_check_timestamp_seconds gauge\ncccache_last_check_timestamp_seconds ");
+    out_u64(&c->reply, checked);
+    out_char(&c->reply, '\n');
+    if (c->reply.error) {
+        reply_status(c, "500 Internal Server Error", "");
+        return;
+    }
+    n = snprintf(c->header, sizeof(c->header), "HTTP/1.1 200 OK\r\n"
+                 "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                 "Content-Length: %zu\r\nConnection: close\r\n\r\n", c->body->text.len + c->reply.len);
+    c->iov[0].iov_base = c->header;
+    c->iov[0].iov_len = n;
+    c->iov[1].iov_base = c->body->text.buf;
+    c->iov[1].iov_len = c->body->text.len;
+    c->iov[2].iov_base = c->reply.buf;
+    c->iov[2].iov_len = c->reply.len;
+    c->niov = head ? 1 : 3;
+}
+
+/* Read what came of the request, and answer it once its headers are all
+ * there. Only GET and HEAD of /metrics are served; the connection is closed
+ * after the reply.
+ */
+static void conn_read(struct metrics *m, struct metrics_conn *c) {
+    const char *target, *end;
+    size_t target_len;
+    ssize_t n;
+    int head;
+
+    while (c->len < METRICS_REQUEST_MAX) {
+        n = recv(c->fd, c->request + c->len, METRICS_REQUEST_MAX - c->len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (n <= 0) {
+            break;
+        }
+        c->len += n;
+        c->request[c->len] = '\0';
+        if (strstr(c->request, "\r\n\r\n") || strstr(c->request, "\n\n")) {
+            break;
+        }
+    }
+    c->request[c->len] = '\0';
+
+    end = strchr(c->request, '\n');
+    if (!strncmp(c->request, "GET ", 4)) {
+        head = 0;
+        target = c->request + 4;
+    } else if (!strncmp(c->request, "HEAD ", 5)) {
+        head = 1;
+        target = c->request + 5;
+    } else {
+        reply_status(c, end ? "405 Method Not Allowed" : "400 Bad Request",
+                     end ? "Allow: GET, HEAD\r\n" : "");
+        return;
+    }
+    if (!end) {
+        reply_status(c, "400 Bad Request", "");
+        return;
+    }
+    target_len = strcspn(target, " ?\r\n");
+    if (target_len != 8 || strncmp(target, "/metrics", 8)) {
+        reply_status(c, "404 Not Found", "");
+        return;
+    }
+    reply_metrics(m, c, head);
+}
+
+// Go on with a connection whose socket is ready
+static void conn_step(struct metrics *m, struct metrics_conn *c) {
+    if (!c->niov) {
+        conn_read(m, c);
+        if (!c->niov) {
+            return;
+        }
+    }
+    if (send_reply(c)) {
+        conn_close(m, c);
+    }
+}
+
+/* Take the connections waiting, as long as there are free slots for them.
+ * Returns -1 and sets errno on failure.
+ */
+static int metrics_accept(struct metrics *m, time_t now) {
+    int i = 0, fd, flags;
+
+    while (i < METRICS_CLIENTS) {
+        struct metrics_conn *c = &m->conns[i];
+
+        if (c->fd >= 0) {
+            i++;
+            continue;
+        }
+        fd = accept(m->fd, NULL, NULL);
+        if (fd < 0) {
+            // The client gave up before it was accepted
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->deadline = now + METRICS_TIMEOUT;
+        i++;
+    }
+    return 0;
+}
+
+/* Serve the metrics. The files are looked at once first, then every interval
+ * seconds by a thread of their own, so that the scrapes are answered during
+ * the looks. The clients are served together, each given METRICS_TIMEOUT
+ * seconds from its connection to the end of its reply.
+ * Only returns on failure, with errno set.
+ */
+int metrics_run(struct metrics *m) {
+    struct pollfd pfds[METRICS_CLIENTS + 2];
+    pthread_t checker;
+    int wake[2], listening, timeout, err, i, n;
+    time_t now;
+
+    if (metrics_check(m) < 0 || pipe(wake) < 0) {
+        return -1;
+    }
+    m->wake = wake[1];
+    err = pthread_create(&checker, NULL, metrics_checker, m);
+    if (err) {
+        close(wake[0]);
+        close(wake[1]);
+        errno = err;
+        return -1;
+    }
+
+    for (;;) {
+        now = time(NULL);
+        timeout = -1;
+        pfds[0].fd = wake[0];
+        pfds[0].events = POLLIN;
+        n = 1;
+        for (i = 0; i < METRICS_CLIENTS; i++) {
+            struct metrics_conn *c = &m->conns[i];
+
+            if (c->fd < 0) {
+                continue;
+            }
+            if (c->deadline <= now) {
+                conn_close(m, c);
+                continue;
+            }
+            pfds[n].fd = c->fd;
+            pfds[n].events = c->niov ? POLLOUT : POLLIN;
+            n++;
+            if (timeout < 0 || (c->deadline - now) * 1000 < timeout) {
+                timeout = (c->deadline - now) * 1000;
+            }
+        }
+        // The others wait in the backlog for a free slot
+        listening = n - 1 < METRICS_CLIENTS;
+        if (listening) {
+            pfds[n].fd = m->fd;
+            pfds[n].events = POLLIN;
+            n++;
+        }
+        if (poll(pfds, n, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err = errno;
+            break;
+        }
+        if (pfds[0].revents) {
+            // The looks failed
+            err = 0;
+            break;
+        }
+        for (i = 0, n = 1; i < METRICS_CLIENTS; i++) {
+            if (m->conns[i].fd >= 0 && pfds[n++].revents) {
+                conn_step(m, &m->conns[i]);
+            }
+        }
+        if (listening && pfds[n].revents && metrics_accept(m, now) < 0) {
+            err = errno;
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&m->lock);
+    m->stop = 1;
+    pthread_cond_signal(&m->cond);
+    pthread_mutex_unlock(&m->lock);
+    pthread_join(checker, NULL);
+    if (m->error) {
+        err = m->error;
+    } else {
+        close(wake[1]);
+    }
+    close(wake[0]);
+    m->wake = -1;
+    for (i = 0; i < METRICS_CLIENTS; i++) {
+        if (m->conns[i].fd >= 0) {
+            conn_close(m, &m->conns[i]);
+        }
+    }
+    errno = err;
+    return -1;
+}
+
+void metrics_free(struct metrics *m) {
+    size_t i;
+    int w, f;
+
+    for (i = 0; i < m->count; i++) {
+        free(m->files[i].path);
+        free(m->files[i].text);
+    }
+    free(m->files);
+    free(m->jobs);
+    for (w = 0; m->workers && w < m->nworkers; w++) {
+        out_free(&m->workers[w].names);
+        for (f = 0; f < METRICS_NFAMILIES; f++) {
+            out_free(&m->workers[w].parts[f]);
+        }
+        free(m->workers[w].clients);
+        free(m->workers[w].enctypes);
+        free(m->workers[w].data);
+    }
+    free(m->workers);
+    for (w = 0; m->conns && w < METRICS_CLIENTS; w++) {
+        out_free(&m->conns[w].reply);
+    }
+    free(m->conns);
+    body_release(m->body);
+    pthread_mutex_destroy(&m->lock);
+    pthread_cond_destroy(&m->cond);
+    if (m->fd >= 0) {
+        close(m->fd);
+    }
+}
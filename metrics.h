@@ -0,0 +1,156 @@
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "out.h"
+#include "print.h"
+
+#define METRICS_INTERVAL                15      /* seconds between two looks at the files */
+#define METRICS_TIMEOUT                 5       /* seconds a client has to send its request and take the reply */
+#define METRICS_REQUEST_MAX             4096    /* bytes of the request read, headers included */
+#define METRICS_BACKLOG                 16
+#define METRICS_CLIENTS                 64      /* connections served at once, the others wait in the backlog */
+
+/* Families of the series of a ccache, all gauges. The exposition format wants
+ * the series of a family together, so each file keeps its part of every family
+ * and the body puts them one after the other, family by family.
+ */
+#define METRICS_FAMILIES(X) \
+    X(CREDENTIALS,  "cccache_credentials", \
+      "Credentials in the ccache, by client principal") \
+    X(ENDTIME,      "cccache_endtime_min_seconds", \
+      "Earliest endtime of the credentials of a client principal, in seconds since the epoch") \
+    X(RENEW_TILL,   "cccache_renew_till_min_seconds", \
+      "Earliest renew_till of the renewable credentials of a client principal, in seconds since the epoch") \
+    X(FLAGS,        "cccache_flag_credentials", \
+      "Credentials of a client principal with a ticket flag set") \
+    X(ENCTYPES,     "cccache_enctype_credentials", \
+      "Credentials of a client principal by session key enctype") \
+    X(ERRORS,       "cccache_file_error", \
+      "Files that can't be parsed, with the error")
+
+#define METRICS_ENUM(id, name, help) METRICS_##id,
+enum {
+    METRICS_FAMILIES(METRICS_ENUM)
+    METRICS_NFAMILIES
+};
+#undef METRICS_ENUM
+
+/* A served ccache. It is read again only when its mtime, size or inode
+ * change; its series are rendered once, when it is read.
+ */
+struct metrics_file {
+    char *path;
+    int discovered;             /* found in a directory: skipped if it isn't a ccache */
+    int read;                   /* mtime, size and inode are those of the last read */
+    struct timespec mtime;
+    off_t size;
+    dev_t dev;
+    ino_t ino;
+    char *text;                 /* series of the last read, family by family */
+    size_t parts[METRICS_NFAMILIES + 1];        /* offsets of the families in text */
+};
+
+/* A file to read again, with what stat() said of it just before */
+struct metrics_job {
+    size_t file;
+    int stat_ok;
+    struct stat st;
+};
+
+/* Counts of the credentials of a client principal, while a file is read */
+struct metrics_client {
+    size_t name;                /* offset in the names of the worker */
+    size_t length;
+    uint64_t count;
+    uint32_t endtime;           /* earliest */
+    uint32_t renew_till;        /* earliest of the renewable ones, 0 if none */
+    uint64_t flags[32];         /* by entry of TICKET_FLAGS */
+};
+
+struct metrics_enctype {
+    size_t client;
+    uint32_t enctype;
+    uint64_t count;
+};
+
+/* What a thread needs to read a file, kept from one file to the next */
+struct metrics_worker {
+    struct outbuf names;        /* client principals, as printed */
+    struct outbuf parts[METRICS_NFAMILIES];
+    struct metrics_client *clients;
+    size_t nclients;
+    size_t clients_size;
+    struct metrics_enctype *enctypes;
+    size_t nenctypes;
+    size_t enctypes_size;
+    uint8_t *data;              /* file not loaded by load_run(), read rather than mapped */
+    size_t data_size;
+};
+
+/* Series of all the files, as of a look at them. A look that changed something
+ * publishes a new one rather than writing over the one scrapes are sending.
+ */
+struct metrics_body {
+    struct outbuf text;
+    size_t files;               /* files served */
+    unsigned refs;              /* scrapes sending it, plus one while it is the last built */
+};
+
+/* A connection, from its request to the end of its reply */
+struct metrics_conn {
+    int fd;                     /* -1 if the slot is free */
+    time_t deadline;            /* closed then, whatever is left to do */
+    size_t len;                 /* bytes of the request read */
+    char request[METRICS_REQUEST_MAX + 1];
+    char header[256];
+    struct outbuf reply;        /* global series of a scrape */
+    struct metrics_body *body;  /* sent by the reply, NULL if none */
+    struct iovec iov[3];        /* reply left to send, none while reading */
+    int niov;
+};
+
+/* Set of ccaches whose metrics are served over HTTP. The paths given, which
+ * may be directories and globs, are listed again every interval seconds, and
+ * the files that changed are read, batched like the scan mode, by a thread of
+ * their own. A scrape only sends the body published by the last look,
+ * whatever the number of files, and the clients are served together.
+ */
+struct metrics {
+    char **paths;
+    int npaths;
+    struct metrics_file *files; /* sorted on the path */
+    size_t count;
+    const struct print_options *opts;
+    int nthreads;               /* to read the files, 0 for one per CPU */
+    int io;                     /* LOAD_* */
+    unsigned interval;
+    struct metrics_worker *workers;
+    int nworkers;
+    struct metrics_job *jobs;   /* files read by the current look */
+    size_t njobs;
+    pthread_mutex_t lock;       /* body, reads, checked and stop, shared with the scrapes */
+    pthread_cond_t cond;        /* signaled to stop the looks */
+    struct metrics_body *body;  /* published by the last look that changed something */
+    uint64_t reads;             /* files read since the start */
+    time_t checked;             /* last look at the files */
+    int stop;
+    int error;                  /* errno of the look that failed */
+    int wake;                   /* closed by the looks when they fail */
+    struct metrics_conn *conns; /* METRICS_CLIENTS of them */
+    int fd;                     /* listening socket */
+};
+
+int metrics_init(struct metrics *m, char **paths, int npaths, const struct print_options *opts,
+                 int nthreads, int io, unsigned interval);
+int metrics_listen(struct metrics *m, const char *address);
+int metrics_check(struct metrics *m);
+int metrics_run(struct metrics *m);
+void metrics_free(struct metrics *m);
+#endif
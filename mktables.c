@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "names.h"
+#include "tables.h"
+
+/* Build time generator of tables.c: it expands the lists of names.h in
+ * dense tables indexed by value, and precomputes the names of every
+ * combination of flags for each byte of the ticket flags.
+ */
+
+struct name {
+    uint32_t value;
+    const char *str;
+};
+
+#define ENTRY(value, str) { value, str },
+
+static const struct name flags[] = { TICKET_FLAGS(ENTRY) };
+static const struct name enctypes[] = { ENCTYPES(ENTRY) };
+static const struct name name_types[] = { NAME_TYPES(ENTRY) };
+static const struct name addrtypes[] = { ADDRTYPES(ENTRY) };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static void dense_table(const char *name, const struct name *names, size_t count, uint32_t max) {
+    uint32_t v;
+    size_t i;
+
+    printf("const struct name_entry %s[%u] = {\n", name, max + 1);
+    for (v = 0; v <= max; v++) {
+        for (i = 0; i < count; i++) {
+            if (names[i].value == v) {
+                break;
+            }
+        }
+        if (i < count) {
+            printf("    { %zu, \"%s\" },\n", strlen(names[i].str), names[i].str);
+        } else {
+            printf("    { 0, NULL },\n");
+        }
+    }
+    printf("};\n\n");
+}
+
+// Flags are listed from the most significant bit: so are their names
+static void flag_byte_table(int byte) {
+    char names[FLAG_RENDER_MAX];
+    unsigned combo;
+    int bit;
+    size_t i;
+
+    printf("    {\n");
+    for (combo = 0; combo < 256; combo++) {
+        names[0] = '\0';
+        for (bit = 7; bit >= 0; bit--) {
+            uint32_t flag = (uint32_t) (1u << bit) << (byte * 8);
+
+            if (!(combo & (1u << bit))) {
+                continue;
+            }
+            for (i = 0; i < COUNT(flags); i++) {
+                if (flags[i].value == flag) {
+                    strcat(names, flags[i].str);
+                    strcat(names, "|");
+                }
+            }
+        }
+        printf("        { %zu, \"%s\" },\n", strlen(names), names);
+    }
+    printf("    },\n");
+}
+
+int main(void) {
+    int byte;
+
+    printf("/* Generated by mktables from names.h, do not edit */\n\n");
+    printf("#include <stddef.h>\n#include <stdint.h>\n#include \"tables.h\"\n\n");
+
+    // Index 0 is the most significant byte
+    printf("const struct name_entry flag_table[4][256] = {\n");
+    for (byte = 3; byte >= 0; byte--) {
+        flag_byte_table(byte);
+    }
+    printf("};\n\n");
+
+    dense_table("enctype_table", enctypes, COUNT(enctypes), ENCTYPE_MAX);
+    dense_table("name_type_table", name_types, COUNT(name_types), NAME_TYPE_MAX);
+    dense_table("addrtype_table", addrtypes, COUNT(addrtypes), ADDRTYPE_MAX);
+
+    return 0;
+}
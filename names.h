@@ -0,0 +1,66 @@
+#ifndef NAMES_H_INCLUDED
+#define NAMES_H_INCLUDED
+
+#include "data.h"
+
+/* Symbolic names of the values found in a ccache. These lists are read by
+ * mktables, which turns them in the lookup tables of tables.c, by the filters
+ * to parse flag names, and by the metrics to label the flag counts.
+ */
+
+#define TICKET_FLAGS(X) \
+    X(TKT_FLG_FORWARDABLE,              "FORWARDABLE") \
+    X(TKT_FLG_FORWARDED,                "FORWARDED") \
+    X(TKT_FLG_PROXIABLE,                "PROXIABLE") \
+    X(TKT_FLG_PROXY,                    "PROXY") \
+    X(TKT_FLG_MAY_POSTDATE,             "MAY_POSTDATE") \
+    X(TKT_FLG_POSTDATED,                "POSTDATED") \
+    X(TKT_FLG_INVALID,                  "INVALID") \
+    X(TKT_FLG_RENEWABLE,                "RENEWABLE") \
+    X(TKT_FLG_INITIAL,                  "INITIAL") \
+    X(TKT_FLG_PRE_AUTH,                 "PRE_AUTH") \
+    X(TKT_FLG_HW_AUTH,                  "HW_AUTH") \
+    X(TKT_FLG_TRANSIT_POLICY_CHECKED,   "TRANSIT_POLICY_CHECKED") \
+    X(TKT_FLG_OK_AS_DELEGATE,           "OK_AS_DELEGATE") \
+    X(TKT_FLG_ENC_PA_REP,               "ENC_PA_REP") \
+    X(TKT_FLG_ANONYMOUS,                "ANONYMOUS")
+
+#define ENCTYPES(X) \
+    X(1,    "des-cbc-crc") \
+    X(2,    "des-cbc-md4") \
+    X(3,    "des-cbc-md5") \
+    X(5,    "des3-cbc-md5") \
+    X(7,    "des3-cbc-sha1") \
+    X(16,   "des3-cbc-sha1-kd") \
+    X(17,   "aes128-cts-hmac-sha1-96") \
+    X(18,   "aes256-cts-hmac-sha1-96") \
+    X(19,   "aes128-cts-hmac-sha256-128") \
+    X(20,   "aes256-cts-hmac-sha384-192") \
+    X(23,   "arcfour-hmac") \
+    X(24,   "arcfour-hmac-exp") \
+    X(25,   "camellia128-cts-cmac") \
+    X(26,   "camellia256-cts-cmac")
+
+#define NAME_TYPES(X) \
+    X(0,    "NT-UNKNOWN") \
+    X(1,    "NT-PRINCIPAL") \
+    X(2,    "NT-SRV-INST") \
+    X(3,    "NT-SRV-HST") \
+    X(4,    "NT-SRV-XHST") \
+    X(5,    "NT-UID") \
+    X(6,    "NT-X500-PRINCIPAL") \
+    X(7,    "NT-SMTP-NAME") \
+    X(10,   "NT-ENTERPRISE") \
+    X(11,   "NT-WELLKNOWN") \
+    X(12,   "NT-SRV-HST-DOMAIN")
+
+#define ADDRTYPES(X) \
+    X(2,    "IPv4") \
+    X(3,    "CHAOS") \
+    X(5,    "XNS") \
+    X(6,    "ISO") \
+    X(12,   "DECNET") \
+    X(16,   "APPLETALK") \
+    X(20,   "NETBIOS") \
+    X(24,   "IPv6")
+#endif
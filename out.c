@@ -0,0 +1,226 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include "out.h"
+#include "encode.h"
+#include "stats.h"
+
+/* Set up a buffer of size bytes writing to fd, or growing in memory if fd
+ * is -1.
+ */
+int out_init(struct outbuf *o, int fd, size_t size) {
+    o->fd = fd;
+    o->len = 0;
+    o->error = 0;
+    o->size = size ? size : (fd < 0 ? OUTBUF_MEM_SIZE : OUTBUF_SIZE);
+    o->buf = malloc(o->size);
+    if (!o->buf) {
+        o->size = 0;
+        o->error = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+// Write everything buffered to the file descriptor
+static int out_write(struct outbuf *o) {
+    size_t done = 0;
+    ssize_t n;
+
+    STATS_START(start);
+
+    while (done < o->len) {
+        n = write(o->fd, o->buf + done, o->len - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            o->error = errno;
+            break;
+        }
+        done += n;
+    }
+    STATS_STOP(start, write_ns);
+    STATS_ADD(bytes_written, done);
+    o->len = 0;
+    return o->error ? -1 : 0;
+}
+
+/* Make room for length more bytes, writing out or growing the buffer.
+ * Returns -1 if that is not possible, and the data is dropped.
+ */
+int out_reserve(struct outbuf *o, size_t length) {
+    size_t size;
+    char *buf;
+
+    if (o->error) {
+        return -1;
+    }
+    if (o->fd >= 0) {
+        if (o->len) {
+            out_write(o);
+        }
+        if (length <= o->size) {
+            return o->error ? -1 : 0;
+        }
+    }
+    // Grow it: in memory, or for a single value bigger than the buffer
+    size = o->size ? o->size : OUTBUF_MEM_SIZE;
+    while (size - o->len < length) {
+        size *= 2;
+    }
+    buf = realloc(o->buf, size);
+    if (!buf) {
+        o->error = ENOMEM;
+        return -1;
+    }
+    o->buf = buf;
+    o->size = size;
+    return 0;
+}
+
+/* Write out what is buffered. Returns -1 if anything failed so far, with
+ * the errno value in o->error.
+ */
+int out_flush(struct outbuf *o) {
+    if (o->fd >= 0 && o->len && !o->error) {
+        out_write(o);
+    }
+    return o->error ? -1 : 0;
+}
+
+void out_free(struct outbuf *o) {
+    free(o->buf);
+    o->buf = NULL;
+    o->len = o->size = 0;
+}
+
+/* Append what another buffer holds */
+void out_buf(struct outbuf *o, const struct outbuf *src) {
+    out_mem(o, src->buf, src->len);
+}
+
+void out_u64(struct outbuf *o, uint64_t value) {
+    char digits[20];
+    int n = sizeof(digits);
+
+    do {
+        digits[--n] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    out_mem(o, digits + n, sizeof(digits) - n);
+}
+
+void out_i64(struct outbuf *o, int64_t value) {
+    if (value < 0) {
+        out_char(o, '-');
+        out_u64(o, -(uint64_t) value);
+    } else {
+        out_u64(o, value);
+    }
+}
+
+/* Lower case hexadecimal, without leading zeroes (like %x) */
+void out_hex(struct outbuf *o, uint64_t value) {
+    static const char hex[] = "0123456789abcdef";
+    char digits[16];
+    int n = sizeof(digits);
+
+    do {
+        digits[--n] = hex[value & 0xf];
+        value >>= 4;
+    } while (value);
+    out_mem(o, digits + n, sizeof(digits) - n);
+}
+
+/* Pad with spaces what was written to width (like %-*s) */
+void out_pad(struct outbuf *o, size_t written, size_t width) {
+    static const char spaces[] = "                                                ";
+
+    while (written < width) {
+        size_t n = width - written;
+
+        if (n > sizeof(spaces) - 1) {
+            n = sizeof(spaces) - 1;
+        }
+        out_mem(o, spaces, n);
+        written += n;
+    }
+}
+
+/* Bytes that can't go in a JSON string as they are: 1 for the ones with a
+ * short escape, 2 for the ones needing \u00XX
+ */
+static const uint8_t json_escape[256] = {
+    [0 ... 0x1f] = 2,
+    ['\b'] = 1, ['\f'] = 1, ['\n'] = 1, ['\r'] = 1, ['\t'] = 1,
+    ['"'] = 1, ['\\'] = 1, [0x7f] = 2,
+};
+
+/* Write a quoted JSON string. The runs of bytes that don't need escaping are
+ * copied in one go.
+ */
+void out_json_str(struct outbuf *o, const char *str, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    const uint8_t *s = (const uint8_t *) str;
+    size_t i, start = 0;
+
+    out_char(o, '"');
+    for (i = 0; i < length; i++) {
+        uint8_t c = s[i];
+        char esc[6];
+
+        if (!json_escape[c]) {
+            continue;
+        }
+        out_mem(o, s + start, i - start);
+        start = i + 1;
+        esc[0] = '\\';
+        if (json_escape[c] == 1) {
+            switch (c) {
+            case '\b': esc[1] = 'b'; break;
+            case '\f': esc[1] = 'f'; break;
+            case '\n': esc[1] = 'n'; break;
+            case '\r': esc[1] = 'r'; break;
+            case '\t': esc[1] = 't'; break;
+            default:   esc[1] = c; break;
+            }
+            out_mem(o, esc, 2);
+        } else {
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0xf];
+            out_mem(o, esc, 6);
+        }
+    }
+    out_mem(o, s + start, length - start);
+    out_char(o, '"');
+}
+
+/* Write a binary value in hex or base64 (ENCODE_*), encoded straight into
+ * the buffer a chunk at a time.
+ */
+void out_encode(struct outbuf *o, const void *data, size_t length, int encoding) {
+    const uint8_t *p = data;
+    size_t n, need;
+
+    while (length) {
+        n = length < ENCODE_CHUNK ? length : ENCODE_CHUNK;
+        need = encoding == ENCODE_HEX ? HEX_LENGTH(n) : BASE64_LENGTH(n);
+        if (o->size - o->len < need && out_reserve(o, need) < 0) {
+            return;
+        }
+        if (encoding == ENCODE_HEX) {
+            o->len += hex_encode(o->buf + o->len, p, n);
+        } else {
+            o->len += base64_encode(o->buf + o->len, p, n);
+        }
+        p += n;
+        length -= n;
+    }
+}
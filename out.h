@@ -0,0 +1,58 @@
+#ifndef OUT_H_INCLUDED
+#define OUT_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define OUTBUF_SIZE                     (1024 * 1024)
+#define OUTBUF_MEM_SIZE                 (16 * 1024)
+
+/* Output buffer. With a file descriptor it is written out in bulk when full
+ * and by out_flush(); without one (fd -1) it grows in memory, to be copied
+ * somewhere else in one go with out_buf().
+ * Failures are sticky: they are kept in error and reported by out_flush().
+ */
+struct outbuf {
+    char *buf;
+    size_t len;
+    size_t size;
+    int fd;
+    int error;
+};
+
+int out_init(struct outbuf *o, int fd, size_t size);
+int out_flush(struct outbuf *o);
+void out_free(struct outbuf *o);
+int out_reserve(struct outbuf *o, size_t length);
+void out_buf(struct outbuf *o, const struct outbuf *src);
+void out_u64(struct outbuf *o, uint64_t value);
+void out_i64(struct outbuf *o, int64_t value);
+void out_hex(struct outbuf *o, uint64_t value);
+void out_pad(struct outbuf *o, size_t written, size_t width);
+void out_json_str(struct outbuf *o, const char *str, size_t length);
+void out_encode(struct outbuf *o, const void *data, size_t length, int encoding);
+
+static inline void out_mem(struct outbuf *o, const void *data, size_t length) {
+    if (o->size - o->len < length && out_reserve(o, length) < 0) {
+        return;
+    }
+    memcpy(o->buf + o->len, data, length);
+    o->len += length;
+}
+
+static inline void out_char(struct outbuf *o, char c) {
+    if (o->len == o->size && out_reserve(o, 1) < 0) {
+        return;
+    }
+    o->buf[o->len++] = c;
+}
+
+static inline void out_str(struct outbuf *o, const char *str) {
+    out_mem(o, str, strlen(str));
+}
+
+/* Literal strings: the length is known at compile time */
+#define out_lit(o, lit) out_mem(o, lit, sizeof(lit) - 1)
+#endif
@@ -0,0 +1,1318 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "data.h"
+#include "arena.h"
+#include "io.h"
+#include "parser.h"
+#include "pool.h"
+#include "filter.h"
+#include "stats.h"
+
+/* Positions in a credential skim_rest() can start from */
+#define CRED_SERVER                     0       /* after the client */
+#define CRED_KEYBLOCK                   1       /* after the server */
+#define CRED_KEY                        2       /* after the enctype */
+#define CRED_ADDRESSES                  3       /* after the flags */
+
+/* authtime, starttime, endtime, renew_till, is_skey and ticket_flags */
+#define CRED_TIMES_SIZE                 (4 * 4 + 1 + 4)
+
+/* span_credential() gave up: decode with the checked readers */
+#define SPAN_FALLBACK                   3
+
+/* Most items of item_size bytes the rest of the file can hold, to check the
+ * counts before allocating for them. The size of a stream is not known: it
+ * is taken as MAXDATALEN bytes at most.
+ */
+static size_t max_items(const struct reader *r, size_t item_size) {
+    ssize_t left = reader_remaining(r);
+
+    if (r->size < 0 && left > MAXDATALEN) {
+        left = MAXDATALEN;
+    }
+    return left / item_size;
+}
+
+/* A read failed: tell a short file from an I/O error */
+static int read_error(const struct reader *r) {
+    return r->eof ? CC_ERR_TRUNCATED : CC_ERR_IO;
+}
+
+// Check the file header
+int check_file_header(struct reader *r) {
+    int rc;
+    uint8_t result;
+
+    rc = getBE(r, &result);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    if (result != CCACHE_MAGIC) {
+        return CC_ERR_NOT_CCACHE;
+    }
+    LOG("File header number: %d\n", result);
+    rc = getBE(r, &result);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    if (result != CCACHE_VERSION) {
+        return CC_ERR_VERSION;
+    }
+    LOG("File header version: %d\n", result);
+    return CC_OK;
+}
+
+// Decode a header field. Only the DeltaTime (tag 1) is known, anything else
+// is skipped by its length.
+static int check_field(struct reader *r, struct field *field) {
+    int rc;
+
+    rc = get_and_swap(r, &field->tag, 16);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    LOG("Field tag: %d\n", field->tag);
+
+    rc = get_and_swap(r, &field->length, 16);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    LOG("Field length: %d\n", field->length);
+
+    if (field->tag != 1 || field->length != 8) {
+        field->time1 = field->time2 = 0;
+        return reader_skip(r, field->length) < 0 ? read_error(r) : CC_OK;
+    }
+
+    rc = get_and_swap(r, &field->time1, 32);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    LOG("Field time1: %d\n", field->time1);
+
+    rc = get_and_swap(r, &field->time2, 32);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    LOG("Field time2: %d\n", field->time2);
+    return CC_OK;
+}
+
+// Decode the header: its length followed by as many fields as fit in it.
+// The DeltaTime field, if any, is the one kept.
+int check_header(struct reader *r, struct header *hdr) {
+    int rc;
+    off_t end;
+
+    memset(hdr, 0, sizeof(*hdr));
+    rc = get_and_swap(r, &hdr->length, 16);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    LOG("Header length: %d\n", hdr->length);
+    end = r->offset + hdr->length;
+    while (r->offset < end) {
+        struct field field;
+
+        rc = check_field(r, &field);
+        if (rc < 0) {
+            return rc;
+        }
+        if (field.tag == 1) {
+            hdr->field = field;
+        }
+    }
+    return r->offset == end ? CC_OK : CC_ERR_INVALID;
+}
+
+// Read a counted octet string. When the file is mapped the result is a view
+// into it: nothing is copied, the reader is only moved past the value. When it
+// is streamed the value is copied in the arena, as the window gets reused.
+int check_data(struct reader *r, struct data *result, struct arena *arena) {
+    int rc;
+    uint32_t length;
+    char *value;
+
+    rc = get_and_swap(r, &length, 32);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    LOG("    Data length: %d\n", length);
+    if (length > reader_remaining(r)) {
+        return CC_ERR_TRUNCATED;
+    }
+
+    result->length = length;
+    if (reader_is_mapped(r)) {
+        // The window may be one credential of the index, shorter than the file
+        if (length > (size_t) r->leftover) {
+            return CC_ERR_TRUNCATED;
+        }
+        result->value = (const char *) r->ptr;
+        r->ptr += length;
+        r->leftover -= length;
+        r->offset += length;
+    } else {
+        if (length > MAXDATALEN) {
+            return CC_ERR_INVALID;
+        }
+        value = arena_alloc(arena, length);
+        if (!value) {
+            return CC_ERR_NOMEM;
+        }
+        rc = reader_read(r, value, length);
+        if (rc < 0) {
+            return read_error(r);
+        }
+        STATS_ADD(bytes_copied, length);
+        result->value = value;
+    }
+    LOG("Data value: %.*s\n", result->length, result->value);
+    return CC_OK;
+}
+
+// Decode a principal. The components array is allocated from the arena,
+// the realm and the components themselves are views into the file.
+static int read_principal(struct reader *r, struct principal *princ, struct arena *arena) {
+    int rc; 
+    ssize_t i;
+    uint32_t name_type;
+    uint32_t count;
+    struct data *comp;
+
+    rc = get_and_swap(r, &name_type, 32);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    LOG("  Principal name type: %d\n", name_type);
+    princ->name_type = name_type;
+
+    rc = get_and_swap(r, &count, 32);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    LOG("  Principal components count %d\n", count);
+    // Every component takes at least its 4 bytes length
+    if (count > max_items(r, 4)) {
+        return CC_ERR_INVALID;
+    }
+    princ->comp_count = count;
+
+    //realm
+    rc = check_data(r, &princ->realm, arena);
+    if (rc < 0) {
+        return rc;
+    }
+
+    //components
+    comp = (struct data *)arena_alloc(arena, count * sizeof(struct data));
+    if (!comp) {
+        return CC_ERR_NOMEM;
+    }
+    for (i = 0; i < count; i++) {
+        rc = check_data(r, &comp[i], arena);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    princ->components = comp;
+    return CC_OK;
+}
+
+int check_principal(struct reader *r, struct principal *princ, struct arena *arena) {
+    int rc;
+    STATS_START(start);
+
+    rc = read_principal(r, princ, arena);
+    STATS_STOP(start, principal_ns);
+    STATS_ADD(principals, 1);
+    return rc;
+}
+
+int check_keyblock(struct reader *r, struct keyblock *key, struct arena *arena) {
+    int rc;
+
+    LOG("-- Keyblock%s\n", "");
+    rc = get_and_swap(r, &key->enctype, 16);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    LOG("Enc type: 0x%x\n", key->enctype);
+    return check_data(r, &key->data, arena);
+}
+
+static int check_address(struct reader *r, struct address *addr, struct arena *arena) {
+    int rc;
+
+    LOG("-- address%s\n", "");
+    rc = get_and_swap(r, &addr->addrtype, 16);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    LOG("address type: 0x%x\n", addr->addrtype);
+    return check_data(r, &addr->data, arena);
+}
+
+int check_addresses(struct reader *r, struct addresses *addrs, struct arena *arena) {
+    int rc;
+    ssize_t i;
+    uint32_t count;
+
+    LOG("-- addresses%s\n", "");
+    rc = get_and_swap(r, &count, 32);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    LOG("count: %d\n", count);
+    // Every address takes at least 6 bytes (type and length)
+    if (count > max_items(r, 6)) {
+        return CC_ERR_INVALID;
+    }
+    addrs->count = count;
+    addrs->addresses = (struct address *) arena_alloc(arena, count * sizeof(struct address));
+    if (!addrs->addresses) {
+        return CC_ERR_NOMEM;
+    }
+    for (i = 0; i < count; i++){
+        rc = check_address(r, &addrs->addresses[i], arena);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    return CC_OK;
+}
+
+static int check_authdata(struct reader *r, struct authdata *auth, struct arena *arena) {
+    int rc;
+
+    LOG("-- auth data%s\n", "");
+    rc = get_and_swap(r, &auth->ad_type, 16);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    LOG("auth data type: 0x%x\n", auth->ad_type);
+    return check_data(r, &auth->data, arena);
+}
+
+int check_authdatas(struct reader *r, struct authdatas *auths, struct arena *arena) {
+    int rc;
+    ssize_t i;
+    uint32_t count;
+
+    LOG("-- auth datas%s\n", "");
+    rc = get_and_swap(r, &count, 32);
+    if (rc < 0) {
+        return read_error(r);
+    }
+    LOG("count: %d\n", count);
+    // Every authdata takes at least 6 bytes (type and length)
+    if (count > max_items(r, 6)) {
+        return CC_ERR_INVALID;
+    }
+    auths->count = count;
+    auths->authdatas = (struct authdata *) arena_alloc(arena, count * sizeof(struct authdata));
+    if (!auths->authdatas) {
+        return CC_ERR_NOMEM;
+    }
+    for (i = 0; i < count; i++){
+        rc = check_authdata(r, &auths->authdatas[i], arena);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    return CC_OK;
+}
+
+// The times, is_skey and the flags, checked once as a single span
+static int check_times(struct reader *r, struct credential *cred) {
+    const uint8_t *p;
+
+    if (reader_fill(r, CRED_TIMES_SIZE) < 0) {
+        return read_error(r);
+    }
+    p = r->ptr;
+    cred->authtime = loadBE32(p);
+    cred->starttime = loadBE32(p + 4);
+    cred->endtime = loadBE32(p + 8);
+    cred->renew_till = loadBE32(p + 12);
+    cred->is_skey = p[16];
+    cred->ticket_flags = loadBE32(p + 17);
+    reader_advance(r, CRED_TIMES_SIZE);
+    return CC_OK;
+}
+
+// The addresses, the authdata and the tickets
+static int check_tickets(struct reader *r, struct credential *cred, struct arena *arena) {
+    int rc;
+
+    rc = check_addresses(r, &cred->addresses, arena);
+    if (rc < 0) {
+        return rc;
+    }
+    rc = check_authdatas(r, &cred->authdatas, arena);
+    if (rc < 0) {
+        return rc;
+    }
+    rc = check_data(r, &cred->ticket, arena);
+    if (rc < 0) {
+        return rc;
+    }
+    return check_data(r, &cred->second_ticket, arena);
+}
+
+// Decode one credential, in the order of the file format
+static int check_credential_checked(struct reader *r, struct credential *cred, struct arena *arena) {
+    int rc;
+
+    rc = check_principal(r, &cred->client, arena);
+    if (rc < 0) {
+        return rc;
+    }
+    rc = check_principal(r, &cred->server, arena);
+    if (rc < 0) {
+        return rc;
+    }
+    rc = check_keyblock(r, &cred->keyblock, arena);
+    if (rc < 0) {
+        return rc;
+    }
+    rc = check_times(r, cred);
+    if (rc < 0) {
+        return rc;
+    }
+    return check_tickets(r, cred, arena);
+}
+
+// Skip a counted octet string by its length
+static int skim_data(struct reader *r) {
+    uint32_t length;
+
+    if (get_and_swap(r, &length, 32) < 0) {
+        return read_error(r);
+    }
+    // Nor past the window of a mapped reader, that may be one credential
+    if (length > reader_remaining(r) || (reader_is_mapped(r) && length > (size_t) r->leftover) ||
+        reader_skip(r, length) < 0) {
+        return CC_ERR_TRUNCATED;
+    }
+    return CC_OK;
+}
+
+static int skim_principal(struct reader *r) {
+    int rc;
+    uint32_t i, name_type, count;
+
+    if (get_and_swap(r, &name_type, 32) < 0 || get_and_swap(r, &count, 32) < 0) {
+        return read_error(r);
+    }
+    if (count > max_items(r, 4)) {
+        return CC_ERR_INVALID;
+    }
+    // realm and components
+    for (i = 0; i <= count; i++) {
+        rc = skim_data(r);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    return CC_OK;
+}
+
+// Skip a list of (16 bits type, data), as the addresses and the authdatas
+static int skim_typed_list(struct reader *r) {
+    int rc;
+    uint16_t type;
+    uint32_t i, count;
+
+    if (get_and_swap(r, &count, 32) < 0) {
+        return read_error(r);
+    }
+    if (count > max_items(r, 6)) {
+        return CC_ERR_INVALID;
+    }
+    for (i = 0; i < count; i++) {
+        if (get_and_swap(r, &type, 16) < 0) {
+            return read_error(r);
+        }
+        rc = skim_data(r);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    return CC_OK;
+}
+
+/* Skip what is left of a credential from one of the CRED_* positions,
+ * looking only at the counts and the lengths.
+ */
+static int skim_rest(struct reader *r, int from) {
+    int rc;
+    uint16_t enctype;
+
+    switch (from) {
+    case CRED_SERVER:
+        rc = skim_principal(r);
+        if (rc < 0) {
+            return rc;
+        }
+        // fall through
+    case CRED_KEYBLOCK:
+        if (get_and_swap(r, &enctype, 16) < 0) {
+            return read_error(r);
+        }
+        // fall through
+    case CRED_KEY:
+        rc = skim_data(r);
+        if (rc < 0) {
+            return rc;
+        }
+        // authtime, starttime, endtime, renew_till, is_skey, ticket_flags
+        if (reader_skip(r, CRED_TIMES_SIZE) < 0) {
+            return read_error(r);
+        }
+        // fall through
+    case CRED_ADDRESSES:
+        rc = skim_typed_list(r);
+        if (rc < 0) {
+            return rc;
+        }
+        rc = skim_typed_list(r);
+        if (rc < 0) {
+            return rc;
+        }
+        // ticket and second ticket
+        rc = skim_data(r);
+        if (rc < 0) {
+            return rc;
+        }
+        return skim_data(r);
+    }
+    return CC_ERR_INVALID;
+}
+
+/* Move past a credential looking only at the counts and the lengths: nothing
+ * is decoded or allocated, and the values of a mapped file are not touched.
+ */
+int skim_credential(struct reader *r) {
+    int rc;
+
+    rc = skim_principal(r);
+    if (rc < 0) {
+        return rc;
+    }
+    return skim_rest(r, CRED_SERVER);
+}
+
+/* Encoders, the counterparts of the check_* functions: they write the
+ * version 4 format and return -1 once the writer has failed.
+ */
+int put_principal(struct writer *w, const struct principal *princ) {
+    uint32_t i;
+
+    putBE32(w, princ->name_type);
+    putBE32(w, princ->comp_count);
+    put_data(w, &princ->realm);
+    for (i = 0; i < princ->comp_count; i++) {
+        put_data(w, &princ->components[i]);
+    }
+    return w->error ? -1 : 0;
+}
+
+int put_credential(struct writer *w, const struct credential *cred) {
+    uint32_t i;
+
+    put_principal(w, &cred->client);
+    put_principal(w, &cred->server);
+    putBE16(w, cred->keyblock.enctype);
+    put_data(w, &cred->keyblock.data);
+    putBE32(w, cred->authtime);
+    putBE32(w, cred->starttime);
+    putBE32(w, cred->endtime);
+    putBE32(w, cred->renew_till);
+    putBE(w, cred->is_skey);
+    putBE32(w, cred->ticket_flags);
+    putBE32(w, cred->addresses.count);
+    for (i = 0; i < cred->addresses.count; i++) {
+        putBE16(w, cred->addresses.addresses[i].addrtype);
+        put_data(w, &cred->addresses.addresses[i].data);
+    }
+    putBE32(w, cred->authdatas.count);
+    for (i = 0; i < cred->authdatas.count; i++) {
+        putBE16(w, cred->authdatas.authdatas[i].ad_type);
+        put_data(w, &cred->authdatas.authdatas[i].data);
+    }
+    put_data(w, &cred->ticket);
+    put_data(w, &cred->second_ticket);
+    return w->error ? -1 : 0;
+}
+
+/* Fast path for the credentials of a mapped file. The fields are read with
+ * unchecked loads from a span of the window: a single comparison with its
+ * end validates each run of fixed size fields and each length, instead of a
+ * call and a check per field. Whatever doesn't fit makes the caller start
+ * again with the checked readers, which tell what is wrong.
+ */
+struct span {
+    const uint8_t *p;
+    const uint8_t *end;
+};
+
+#define span_left(s)                    ((size_t) ((s)->end - (s)->p))
+
+static inline int span_data(struct span *s, struct data *result) {
+    uint32_t length;
+
+    if (span_left(s) < 4) {
+        return -1;
+    }
+    length = loadBE32(s->p);
+    s->p += 4;
+    if (length > span_left(s)) {
+        return -1;
+    }
+    result->length = length;
+    result->value = (const char *) s->p;
+    s->p += length;
+    return 0;
+}
+
+static int span_principal_fields(struct span *s, struct principal *princ, struct arena *arena) {
+    uint32_t i, count;
+    struct data *comp;
+
+    if (span_left(s) < 8) {
+        return -1;
+    }
+    princ->name_type = loadBE32(s->p);
+    count = loadBE32(s->p + 4);
+    s->p += 8;
+    if (count > span_left(s) / 4 || span_data(s, &princ->realm) < 0) {
+        return -1;
+    }
+    comp = arena_alloc(arena, count * sizeof(struct data));
+    if (!comp) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (span_data(s, &comp[i]) < 0) {
+            return -1;
+        }
+    }
+    princ->comp_count = count;
+    princ->components = comp;
+    return 0;
+}
+
+static int span_principal(struct span *s, struct principal *princ, struct arena *arena) {
+    int rc;
+    STATS_START(start);
+
+    rc = span_principal_fields(s, princ, arena);
+    STATS_STOP(start, principal_ns);
+    STATS_ADD(principals, 1);
+    return rc;
+}
+
+static int span_addresses(struct span *s, struct addresses *addrs, struct arena *arena) {
+    uint32_t i, count;
+
+    if (span_left(s) < 4) {
+        return -1;
+    }
+    count = loadBE32(s->p);
+    s->p += 4;
+    if (count > span_left(s) / 6) {
+        return -1;
+    }
+    addrs->addresses = arena_alloc(arena, count * sizeof(struct address));
+    if (!addrs->addresses) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (span_left(s) < 6) {
+            return -1;
+        }
+        addrs->addresses[i].addrtype = loadBE16(s->p);
+        s->p += 2;
+        if (span_data(s, &addrs->addresses[i].data) < 0) {
+            return -1;
+        }
+    }
+    addrs->count = count;
+    return 0;
+}
+
+static int span_authdatas(struct span *s, struct authdatas *auths, struct arena *arena) {
+    uint32_t i, count;
+
+    if (span_left(s) < 4) {
+        return -1;
+    }
+    count = loadBE32(s->p);
+    s->p += 4;
+    if (count > span_left(s) / 6) {
+        return -1;
+    }
+    auths->authdatas = arena_alloc(arena, count * sizeof(struct authdata));
+    if (!auths->authdatas) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (span_left(s) < 6) {
+            return -1;
+        }
+        auths->authdatas[i].ad_type = loadBE16(s->p);
+        s->p += 2;
+        if (span_data(s, &auths->authdatas[i].data) < 0) {
+            return -1;
+        }
+    }
+    auths->count = count;
+    return 0;
+}
+
+static int span_skim_list(struct span *s) {
+    struct data skipped;
+    uint32_t i, count;
+
+    if (span_left(s) < 4) {
+        return -1;
+    }
+    count = loadBE32(s->p);
+    s->p += 4;
+    for (i = 0; i < count; i++) {
+        if (span_left(s) < 6) {
+            return -1;
+        }
+        s->p += 2;
+        if (span_data(s, &skipped) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Like skim_rest(), within the span
+static int span_skim_rest(struct span *s, int from) {
+    struct data skipped;
+    uint32_t i, count;
+
+    switch (from) {
+    case CRED_SERVER:
+        if (span_left(s) < 8) {
+            return -1;
+        }
+        count = loadBE32(s->p + 4);
+        s->p += 8;
+        // realm and components
+        for (i = 0; i <= count; i++) {
+            if (span_data(s, &skipped) < 0) {
+                return -1;
+            }
+        }
+        // fall through
+    case CRED_KEYBLOCK:
+        if (span_left(s) < 2) {
+            return -1;
+        }
+        s->p += 2;
+        // fall through
+    case CRED_KEY:
+        if (span_data(s, &skipped) < 0 || span_left(s) < CRED_TIMES_SIZE) {
+            return -1;
+        }
+        s->p += CRED_TIMES_SIZE;
+        // fall through
+    case CRED_ADDRESSES:
+        if (span_skim_list(s) < 0 || span_skim_list(s) < 0 ||
+            span_data(s, &skipped) < 0 || span_data(s, &skipped) < 0) {
+            return -1;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+/* The credential at the position of a mapped reader, within its window: the
+ * rest of the file, or only the credential when its length is known from the
+ * index. Same results as check_credential_filter(), or SPAN_FALLBACK.
+ */
+static int span_credential(struct reader *r, struct credential *cred, struct arena *arena,
+                           const struct cc_filter *filter, int summary) {
+    struct span s = { r->ptr, r->ptr + r->leftover };
+    const uint8_t *p;
+    int rc, from, result = CC_SKIPPED;
+
+    if (span_principal(&s, &cred->client, arena) < 0) {
+        return SPAN_FALLBACK;
+    }
+    if (filter && !cc_filter_client(filter, &cred->client)) {
+        from = CRED_SERVER;
+        goto skim;
+    }
+    if (span_principal(&s, &cred->server, arena) < 0 || span_left(&s) < 2) {
+        return SPAN_FALLBACK;
+    }
+    if (filter && !cc_filter_server(filter, &cred->server)) {
+        from = CRED_KEYBLOCK;
+        goto skim;
+    }
+    cred->keyblock.enctype = loadBE16(s.p);
+    s.p += 2;
+    if (filter && filter->enctype >= 0 && cred->keyblock.enctype != filter->enctype) {
+        from = CRED_KEY;
+        goto skim;
+    }
+    if (span_data(&s, &cred->keyblock.data) < 0 || span_left(&s) < CRED_TIMES_SIZE) {
+        return SPAN_FALLBACK;
+    }
+    p = s.p;
+    cred->authtime = loadBE32(p);
+    cred->starttime = loadBE32(p + 4);
+    cred->endtime = loadBE32(p + 8);
+    cred->renew_till = loadBE32(p + 12);
+    cred->is_skey = p[16];
+    cred->ticket_flags = loadBE32(p + 17);
+    s.p += CRED_TIMES_SIZE;
+    if (filter && !cc_filter_times(filter, cred)) {
+        from = CRED_ADDRESSES;
+        goto skim;
+    }
+    if (summary) {
+        memset(&cred->keyblock.data, 0, sizeof(cred->keyblock.data));
+        memset(&cred->addresses, 0, sizeof(cred->addresses));
+        memset(&cred->authdatas, 0, sizeof(cred->authdatas));
+        memset(&cred->ticket, 0, sizeof(cred->ticket));
+        memset(&cred->second_ticket, 0, sizeof(cred->second_ticket));
+        from = CRED_ADDRESSES;
+        result = CC_OK;
+        goto skim;
+    }
+    if (span_addresses(&s, &cred->addresses, arena) < 0 ||
+        span_authdatas(&s, &cred->authdatas, arena) < 0 ||
+        span_data(&s, &cred->ticket) < 0 ||
+        span_data(&s, &cred->second_ticket) < 0) {
+        return SPAN_FALLBACK;
+    }
+    reader_advance(r, s.p - r->ptr);
+    return CC_OK;
+
+skim:
+    reader_advance(r, s.p - r->ptr);
+    if (span_skim_rest(&s, from) == 0) {
+        reader_advance(r, s.p - r->ptr);
+        return result;
+    }
+    // Let the checked readers tell what is wrong
+    rc = skim_rest(r, from);
+    return rc < 0 ? rc : result;
+}
+
+int check_credential(struct reader *r, struct credential *cred, struct arena *arena) {
+    return check_credential_filter(r, cred, arena, NULL, 0);
+}
+
+static int decode_credential(struct reader *r, struct credential *cred, struct arena *arena,
+                             const struct cc_filter *filter, int summary) {
+    int rc;
+
+    if (filter && !filter->active) {
+        filter = NULL;
+    }
+    if (reader_is_mapped(r)) {
+        struct reader start = *r;
+
+        rc = span_credential(r, cred, arena, filter, summary);
+        if (rc != SPAN_FALLBACK) {
+            return rc;
+        }
+        *r = start;
+    }
+    if (!filter && !summary) {
+        return check_credential_checked(r, cred, arena);
+    }
+    rc = check_principal(r, &cred->client, arena);
+    if (rc < 0) {
+        return rc;
+    }
+    if (filter && !cc_filter_client(filter, &cred->client)) {
+        rc = skim_rest(r, CRED_SERVER);
+        return rc < 0 ? rc : CC_SKIPPED;
+    }
+    rc = check_principal(r, &cred->server, arena);
+    if (rc < 0) {
+        return rc;
+    }
+    if (filter && !cc_filter_server(filter, &cred->server)) {
+        rc = skim_rest(r, CRED_KEYBLOCK);
+        return rc < 0 ? rc : CC_SKIPPED;
+    }
+    if (get_and_swap(r, &cred->keyblock.enctype, 16) < 0) {
+        return read_error(r);
+    }
+    if (filter && filter->enctype >= 0 && cred->keyblock.enctype != filter->enctype) {
+        rc = skim_rest(r, CRED_KEY);
+        return rc < 0 ? rc : CC_SKIPPED;
+    }
+    if (summary) {
+        memset(&cred->keyblock.data, 0, sizeof(cred->keyblock.data));
+        rc = skim_data(r);
+    } else {
+        rc = check_data(r, &cred->keyblock.data, arena);
+    }
+    if (rc < 0) {
+        return rc;
+    }
+    rc = check_times(r, cred);
+    if (rc < 0) {
+        return rc;
+    }
+    if (filter && !cc_filter_times(filter, cred)) {
+        rc = skim_rest(r, CRED_ADDRESSES);
+        return rc < 0 ? rc : CC_SKIPPED;
+    }
+    if (summary) {
+        memset(&cred->addresses, 0, sizeof(cred->addresses));
+        memset(&cred->authdatas, 0, sizeof(cred->authdatas));
+        memset(&cred->ticket, 0, sizeof(cred->ticket));
+        memset(&cred->second_ticket, 0, sizeof(cred->second_ticket));
+        return skim_rest(r, CRED_ADDRESSES);
+    }
+    return check_tickets(r, cred, arena);
+}
+
+/* Decode a credential, checking the filter as soon as the fields it looks
+ * at are read: a credential that doesn't match is skipped from there by
+ * length, without decoding its key, addresses, authdata or tickets.
+ * Returns CC_SKIPPED for those, with the reader after the credential.
+ * With summary, only the principals, the enctype, the times and the flags
+ * are decoded: the rest is skipped by length and left empty, and the bytes
+ * of the key and the tickets are never read.
+ */
+int check_credential_filter(struct reader *r, struct credential *cred, struct arena *arena,
+                            const struct cc_filter *filter, int summary) {
+    int rc;
+    STATS_START(start);
+
+    rc = decode_credential(r, cred, arena, filter, summary);
+    STATS_STOP(start, credential_ns);
+    if (rc == CC_OK) {
+        STATS_ADD(credentials, 1);
+    } else if (rc == CC_SKIPPED) {
+        STATS_ADD(skipped, 1);
+    }
+    return rc;
+}
+
+static void cc_init(struct ccache *cc) {
+    memset(cc, 0, sizeof(*cc));
+    cc->reader.fd = -1;
+    arena_init(&cc->princ_arena, 0);
+    arena_init(&cc->cred_arena, 0);
+}
+
+// Record a failure and give back its code
+static int cc_fail(struct ccache *cc, int err, const char *where) {
+    cc->where = where;
+    if (err == CC_ERR_IO) {
+        cc->sys_errno = errno;
+    }
+    return err;
+}
+
+/* Decode everything that comes before the credentials */
+static int cc_start(struct ccache *cc) {
+    int rc;
+    STATS_START(start);
+
+    rc = check_file_header(&cc->reader);
+    if (rc < 0) {
+        return cc_fail(cc, rc, "file header");
+    }
+    rc = check_header(&cc->reader, &cc->header);
+    if (rc < 0) {
+        return cc_fail(cc, rc, "header");
+    }
+    rc = check_principal(&cc->reader, &cc->default_principal, &cc->princ_arena);
+    if (rc < 0) {
+        return cc_fail(cc, rc, "default principal");
+    }
+    cc->creds_start = cc->reader.offset;
+    STATS_STOP(start, header_ns);
+    return CC_OK;
+}
+
+/* Open a ccache ("-" for the standard input) and decode it up to the default
+ * principal. On failure *cc is still set if it could be allocated, so that the
+ * caller can look at where it failed, and it must be released with cc_close().
+ */
+int cc_open(struct ccache **cc, const char *filename) {
+    struct ccache *c;
+    STATS_START(start);
+
+    *cc = c = malloc(sizeof(*c));
+    if (!c) {
+        return CC_ERR_NOMEM;
+    }
+    cc_init(c);
+    STATS_ADD(files, 1);
+    if (reader_open(&c->reader, filename) < 0) {
+        return cc_fail(c, CC_ERR_IO, "open");
+    }
+    STATS_STOP(start, io_ns);
+    return cc_start(c);
+}
+
+/* Same as cc_open(), but a regular file is read whole in *buf instead of
+ * mapped (see reader_load()), for the processes that stay running over files
+ * rewritten in place: a truncation while it is decoded can't kill them with
+ * SIGBUS. *buf is the caller's, reused from one file to the next; it must
+ * stay there until cc_close().
+ */
+int cc_load(struct ccache **cc, const char *filename, uint8_t **buf, size_t *bufsize) {
+    struct ccache *c;
+    STATS_START(start);
+
+    *cc = c = malloc(sizeof(*c));
+    if (!c) {
+        return CC_ERR_NOMEM;
+    }
+    cc_init(c);
+    STATS_ADD(files, 1);
+    if (reader_load(&c->reader, filename, buf, bufsize) < 0) {
+        return cc_fail(c, CC_ERR_IO, "open");
+    }
+    STATS_STOP(start, io_ns);
+    return cc_start(c);
+}
+
+/* Same as cc_open() for an open file descriptor, that the ccache takes over */
+int cc_fdopen(struct ccache **cc, int fd) {
+    struct ccache *c;
+    STATS_START(start);
+
+    *cc = c = malloc(sizeof(*c));
+    if (!c) {
+        return CC_ERR_NOMEM;
+    }
+    cc_init(c);
+    STATS_ADD(files, 1);
+    if (reader_fdopen(&c->reader, fd) < 0) {
+        return cc_fail(c, CC_ERR_IO, "open");
+    }
+    STATS_STOP(start, io_ns);
+    return cc_start(c);
+}
+
+/* Same as cc_open() for a ccache already in memory, like the files of
+ * load_run(). The bytes must stay there until cc_close().
+ */
+int cc_memopen(struct ccache **cc, const void *data, size_t size) {
+    struct ccache *c;
+
+    *cc = c = malloc(sizeof(*c));
+    if (!c) {
+        return CC_ERR_NOMEM;
+    }
+    cc_init(c);
+    STATS_ADD(files, 1);
+    reader_memopen(&c->reader, data, size);
+    return cc_start(c);
+}
+
+/* Decode the next credential. On CC_OK *cred points to it and it stays valid
+ * until the next call. CC_END is returned after the last one.
+ */
+int cc_next(struct ccache *cc, struct credential **cred) {
+    int rc;
+
+    *cred = NULL;
+    // The credentials rejected by the filter are skipped over
+    do {
+        if (!reader_more(&cc->reader)) {
+            if (!cc->reader.eof) {
+                return cc_fail(cc, CC_ERR_IO, "credential");
+            }
+            return CC_END;
+        }
+        arena_reset(&cc->cred_arena);
+        cc->cred_offset = cc->reader.offset;
+        rc = check_credential_filter(&cc->reader, &cc->cred, &cc->cred_arena, cc->filter,
+                                     cc->summary);
+        if (rc < 0) {
+            return cc_fail(cc, rc, "credential");
+        }
+        cc->count++;
+    } while (rc == CC_SKIPPED);
+    *cred = &cc->cred;
+    return CC_OK;
+}
+
+/* Only decode the credentials matching filter from now on: cc_next() skips
+ * the others, cc_get() and cc_decode_parallel() leave them out. The filter
+ * must live until cc_close().
+ */
+void cc_set_filter(struct ccache *cc, const struct cc_filter *filter) {
+    cc->filter = filter;
+}
+
+/* Decode only the principals, the enctype, the times and the flags of the
+ * credentials from now on (see check_credential_filter()).
+ */
+void cc_set_summary(struct ccache *cc, int summary) {
+    cc->summary = summary;
+}
+
+/* Move the cursor of cc_next() to offset, the end of credential count - 1
+ * found by an earlier pass over the same file, typically before credentials
+ * were appended to it. It needs a mapped file.
+ */
+int cc_resume(struct ccache *cc, off_t offset, uint32_t count) {
+    if (!reader_is_mapped(&cc->reader)) {
+        return cc_fail(cc, CC_ERR_NOT_SEEKABLE, "resume");
+    }
+    if (offset < cc->creds_start || reader_seek(&cc->reader, offset) < 0) {
+        return cc_fail(cc, CC_ERR_INVALID, "resume");
+    }
+    cc->count = count;
+    cc->cred_offset = offset;
+    return CC_OK;
+}
+
+/* Build the index of the credentials with a skim of the whole file. It needs
+ * a mapped file, and it doesn't move the position used by cc_next().
+ */
+int cc_index_build(struct ccache *cc) {
+    struct reader r;
+    struct cc_index *idx = &cc->index;
+    int rc;
+
+    if (cc->indexed) {
+        return CC_OK;
+    }
+    if (!reader_is_mapped(&cc->reader)) {
+        return cc_fail(cc, CC_ERR_NOT_SEEKABLE, "index");
+    }
+    // A mapped reader doesn't own anything that moves: a copy of it can
+    // walk the file on its own
+    r = cc->reader;
+    reader_seek(&r, cc->creds_start);
+    idx->count = 0;
+    while (r.leftover > 0) {
+        off_t offset = r.offset;
+
+        rc = skim_credential(&r);
+        if (rc < 0) {
+            cc->count = idx->count;
+            return cc_fail(cc, rc, "credential");
+        }
+        if (idx->count == idx->size) {
+            size_t size = idx->size ? idx->size * 2 : 64;
+            struct cc_index_entry *entries;
+
+            entries = realloc(idx->entries, size * sizeof(struct cc_index_entry));
+            if (!entries) {
+                return cc_fail(cc, CC_ERR_NOMEM, "index");
+            }
+            idx->entries = entries;
+            idx->size = size;
+        }
+        idx->entries[idx->count].offset = offset;
+        idx->entries[idx->count].length = r.offset - offset;
+        idx->count++;
+    }
+    cc->indexed = 1;
+    return CC_OK;
+}
+
+/* Decode only credential n (0 based), building the index first if needed.
+ * Like cc_next(), *cred is valid until the next call. Returns CC_SKIPPED if
+ * the credential doesn't match the filter.
+ */
+int cc_get(struct ccache *cc, size_t n, struct credential **cred) {
+    struct reader r;
+    int rc;
+
+    *cred = NULL;
+    rc = cc_index_build(cc);
+    if (rc < 0) {
+        return rc;
+    }
+    if (n >= cc->index.count) {
+        return CC_ERR_NOT_FOUND;
+    }
+    r = cc->reader;
+    reader_seek(&r, cc->index.entries[n].offset);
+    // The window is only the credential: it is checked once for all
+    r.leftover = cc->index.entries[n].length;
+    arena_reset(&cc->cred_arena);
+    cc->cred_offset = r.offset;
+    rc = check_credential_filter(&r, &cc->cred, &cc->cred_arena, cc->filter, cc->summary);
+    if (rc < 0) {
+        cc->count = n;
+        return cc_fail(cc, rc, "credential");
+    }
+    if (rc == CC_SKIPPED) {
+        return CC_SKIPPED;
+    }
+    *cred = &cc->cred;
+    return CC_OK;
+}
+
+struct parallel_decode {
+    struct ccache *cc;
+    size_t first;
+    size_t last;
+    size_t chunk_size;
+    struct arena *arenas;               /* one per worker */
+    int *errors;                        /* one per chunk */
+    size_t *failed;                     /* credential that failed, per chunk */
+    cc_chunk_fn fn;
+    void *arg;
+};
+
+static void decode_chunk(void *data, size_t chunk, int worker) {
+    struct parallel_decode *pd = data;
+    struct arena *arena = &pd->arenas[worker];
+    struct credential cred;
+    struct reader r;
+    size_t n, end;
+    int rc = CC_OK;
+
+    n = pd->first + chunk * pd->chunk_size;
+    end = n + pd->chunk_size;
+    if (end > pd->last + 1) {
+        end = pd->last + 1;
+    }
+    r = pd->cc->reader;
+    for (; n < end; n++) {
+        arena_reset(arena);
+        reader_seek(&r, pd->cc->index.entries[n].offset);
+        r.leftover = pd->cc->index.entries[n].length;
+        rc = check_credential_filter(&r, &cred, arena, pd->cc->filter, pd->cc->summary);
+        if (rc < 0) {
+            break;
+        }
+        if (rc == CC_SKIPPED) {
+            continue;
+        }
+        rc = pd->fn(pd->arg, chunk, n, &cred);
+        if (rc < 0) {
+            break;
+        }
+    }
+    pd->errors[chunk] = rc < 0 ? rc : CC_OK;
+    pd->failed[chunk] = n;
+}
+
+/* Decode credentials first to last (included) on nthreads threads (0 for one
+ * per CPU). The range is split in chunks of chunk_size credentials that the
+ * threads take from each other as they finish; every thread decodes in its
+ * own arena. It needs a mapped file, as the chunks are found with the index.
+ * Returns the error of the first chunk that failed, if any.
+ */
+int cc_decode_parallel(struct ccache *cc, size_t first, size_t last, size_t chunk_size,
+                       int nthreads, cc_chunk_fn fn, void *arg) {
+    struct parallel_decode pd;
+    size_t chunks, i;
+    int rc, t;
+
+    rc = cc_index_build(cc);
+    if (rc < 0) {
+        return rc;
+    }
+    if (first >= cc->index.count) {
+        return cc->index.count ? CC_ERR_NOT_FOUND : CC_OK;
+    }
+    if (last >= cc->index.count) {
+        last = cc->index.count - 1;
+    }
+    if (nthreads <= 0) {
+        nthreads = pool_default_threads();
+    }
+    if (!chunk_size) {
+        chunk_size = CC_CHUNK_SIZE;
+    }
+    chunks = (last - first) / chunk_size + 1;
+
+    pd.cc = cc;
+    pd.first = first;
+    pd.last = last;
+    pd.chunk_size = chunk_size;
+    pd.fn = fn;
+    pd.arg = arg;
+    pd.arenas = calloc(nthreads, sizeof(struct arena));
+    pd.errors = calloc(chunks, sizeof(int));
+    pd.failed = calloc(chunks, sizeof(size_t));
+    if (!pd.arenas || !pd.errors || !pd.failed) {
+        rc = cc_fail(cc, CC_ERR_NOMEM, "credential");
+        goto out;
+    }
+    for (t = 0; t < nthreads; t++) {
+        arena_init(&pd.arenas[t], 0);
+    }
+
+    if (pool_run(nthreads, chunks, decode_chunk, &pd) < 0) {
+        rc = cc_fail(cc, CC_ERR_NOMEM, "credential");
+    } else {
+        rc = CC_OK;
+        for (i = 0; i < chunks; i++) {
+            if (pd.errors[i] < 0) {
+                cc->count = pd.failed[i];
+                rc = cc_fail(cc, pd.errors[i], "credential");
+                break;
+            }
+        }
+    }
+    for (t = 0; t < nthreads; t++) {
+        arena_free(&pd.arenas[t]);
+    }
+out:
+    free(pd.arenas);
+    free(pd.errors);
+    free(pd.failed);
+    return rc;
+}
+
+void cc_close(struct ccache *cc) {
+    if (!cc) {
+        return;
+    }
+    free(cc->index.entries);
+    cc_servers_free(cc->servers);
+    reader_close(&cc->reader);
+    arena_free(&cc->princ_arena);
+    arena_free(&cc->cred_arena);
+    free(cc);
+}
+
+const char *cc_strerror(int err) {
+    switch (err) {
+    case CC_OK:
+        return "success";
+    case CC_END:
+        return "no more credentials";
+    case CC_ERR_IO:
+        return "I/O error";
+    case CC_ERR_NOMEM:
+        return "out of memory";
+    case CC_ERR_NOT_CCACHE:
+        return "the file doesn't seem to be a ccache file";
+    case CC_ERR_VERSION:
+        return "the file is not a ccache file version 4";
+    case CC_ERR_TRUNCATED:
+        return "the file is truncated";
+    case CC_ERR_INVALID:
+        return "invalid data";
+    case CC_ERR_NOT_SEEKABLE:
+        return "the file can only be read sequentially";
+    case CC_ERR_NOT_FOUND:
+        return "no such credential";
+    }
+    return "unknown error";
+}
@@ -0,0 +1,114 @@
+#ifndef PARSER_H_INCLUDED
+#define PARSER_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "data.h"
+#include "arena.h"
+#include "io.h"
+#include "filter.h"
+
+/* Return codes of the parser. Nothing in the library prints or exits: every
+ * failure is reported with one of the negative codes below.
+ */
+#define CC_OK                           0
+#define CC_END                          1
+#define CC_SKIPPED                      2       /* rejected by the filter */
+#define CC_ERR_IO                       -1
+#define CC_ERR_NOMEM                    -2
+#define CC_ERR_NOT_CCACHE               -3
+#define CC_ERR_VERSION                  -4
+#define CC_ERR_TRUNCATED                -5
+#define CC_ERR_INVALID                  -6
+#define CC_ERR_NOT_SEEKABLE             -7
+#define CC_ERR_NOT_FOUND                -8
+
+#define CC_CHUNK_SIZE                   64
+
+#define CCACHE_MAGIC                    5
+#define CCACHE_VERSION                  4
+
+/* Position of a credential in the file */
+struct cc_index_entry {
+    off_t offset;
+    uint32_t length;
+};
+
+/* Offsets of all the credentials, built by walking only their length
+ * prefixes.
+ */
+struct cc_index {
+    struct cc_index_entry *entries;
+    size_t count;
+    size_t size;
+};
+
+struct cc_servers;
+
+/* An open ccache. The file header, the header and the default principal are
+ * decoded by cc_open(), then cc_next() returns one credential at a time.
+ * The fields are filled by the parser and must be treated as read only.
+ */
+struct ccache {
+    struct reader reader;
+    struct header header;
+    struct principal default_principal;
+    struct credential cred;             /* last credential from cc_next() */
+    struct arena princ_arena;
+    struct arena cred_arena;
+    uint32_t count;                     /* credentials decoded so far */
+    off_t cred_offset;                  /* offset of the last credential */
+    off_t creds_start;                  /* offset of the first credential */
+    struct cc_index index;              /* filled by cc_index_build() */
+    int indexed;
+    struct cc_servers *servers;         /* filled by cc_servers_build() */
+    const struct cc_filter *filter;     /* credentials to decode, NULL for all */
+    int summary;                        /* skip the keys, addresses, authdata, tickets */
+    const char *where;                  /* what was being decoded on error */
+    int sys_errno;                      /* errno for CC_ERR_IO */
+};
+
+int cc_open(struct ccache **cc, const char *filename);
+int cc_fdopen(struct ccache **cc, int fd);
+int cc_load(struct ccache **cc, const char *filename, uint8_t **buf, size_t *bufsize);
+int cc_memopen(struct ccache **cc, const void *data, size_t size);
+int cc_next(struct ccache *cc, struct credential **cred);
+void cc_close(struct ccache *cc);
+void cc_set_filter(struct ccache *cc, const struct cc_filter *filter);
+void cc_set_summary(struct ccache *cc, int summary);
+int cc_resume(struct ccache *cc, off_t offset, uint32_t count);
+int cc_index_build(struct ccache *cc);
+int cc_get(struct ccache *cc, size_t n, struct credential **cred);
+int cc_servers_build(struct ccache *cc);
+int cc_find_server(struct ccache *cc, const struct principal *server, const uint32_t **creds, size_t *count);
+int cc_find_server_name(struct ccache *cc, const char *name, const uint32_t **creds, size_t *count);
+void cc_servers_free(struct cc_servers *servers);
+
+/* Called by cc_decode_parallel() for every credential matching the filter. The credentials of a
+ * chunk come in file order from a single thread, different chunks run at the
+ * same time. cred is valid until the callback returns; a negative return
+ * stops the chunk.
+ */
+typedef int (*cc_chunk_fn)(void *arg, size_t chunk, size_t n, struct credential *cred);
+int cc_decode_parallel(struct ccache *cc, size_t first, size_t last, size_t chunk_size,
+                       int nthreads, cc_chunk_fn fn, void *arg);
+const char *cc_strerror(int err);
+
+/* Low level decoders, working on a reader. What they allocate belongs to the
+ * arena passed as argument.
+ */
+int check_file_header(struct reader *r);
+int check_header(struct reader *r, struct header *hdr);
+int check_data(struct reader *r, struct data *result, struct arena *arena);
+int check_principal(struct reader *r, struct principal *princ, struct arena *arena);
+int check_keyblock(struct reader *r, struct keyblock *key, struct arena *arena);
+int check_addresses(struct reader *r, struct addresses *addrs, struct arena *arena);
+int check_authdatas(struct reader *r, struct authdatas *auths, struct arena *arena);
+int check_credential(struct reader *r, struct credential *cred, struct arena *arena);
+int check_credential_filter(struct reader *r, struct credential *cred, struct arena *arena,
+                            const struct cc_filter *filter, int summary);
+int skim_credential(struct reader *r);
+int put_principal(struct writer *w, const struct principal *princ);
+int put_credential(struct writer *w, const struct credential *cred);
+#endif
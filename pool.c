@@ -0,0 +1,163 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pool.h"
+
+struct pool_worker {
+    struct pool *pool;
+    int id;
+};
+
+/* Number of threads to use when the caller doesn't care */
+int pool_default_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? n : 1;
+}
+
+// Take the most recent job of our own queue
+static int pool_pop(struct pool_deque *dq, size_t *job) {
+    int found = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom > dq->top) {
+        *job = dq->jobs[--dq->bottom];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+// Take the oldest job of somebody else's queue
+static int pool_steal(struct pool_deque *dq, size_t *job) {
+    int found = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom > dq->top) {
+        *job = dq->jobs[dq->top++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static void *pool_thread(void *data) {
+    struct pool_worker *w = data;
+    struct pool *pool = w->pool;
+    size_t job = 0;
+    int i;
+
+    for (;;) {
+        if (pool_pop(&pool->deques[w->id], &job)) {
+            pool->fn(pool->arg, job, w->id);
+            continue;
+        }
+        // Our queue is empty: look for work in the others, starting from
+        // the next one so that the thieves spread out
+        for (i = 1; i < pool->nthreads; i++) {
+            if (pool_steal(&pool->deques[(w->id + i) % pool->nthreads], &job)) {
+                break;
+            }
+        }
+        if (i == pool->nthreads) {
+            // Jobs are never added while running: nothing left anywhere
+            break;
+        }
+        pool->fn(pool->arg, job, w->id);
+    }
+    return NULL;
+}
+
+/* Run njobs jobs on nthreads threads and wait for all of them.
+ * The jobs are split in contiguous runs, one per thread, and threads running
+ * out of work steal from the others, so uneven jobs still keep every thread
+ * busy. With a single thread everything runs in the caller.
+ * Returns -1 and sets errno if the threads can't be started.
+ */
+int pool_run(int nthreads, size_t njobs, pool_fn fn, void *arg) {
+    struct pool pool;
+    struct pool_worker *workers;
+    pthread_t *threads;
+    size_t *jobs, j;
+    int i, started, err = 0;
+
+    if (nthreads <= 0) {
+        nthreads = pool_default_threads();
+    }
+    if (nthreads > njobs) {
+        nthreads = njobs ? njobs : 1;
+    }
+    if (nthreads == 1) {
+        for (j = 0; j < njobs; j++) {
+            fn(arg, j, 0);
+        }
+        return 0;
+    }
+
+    pool.nthreads = nthreads;
+    pool.fn = fn;
+    pool.arg = arg;
+    pool.deques = calloc(nthreads, sizeof(struct pool_deque));
+    workers = calloc(nthreads, sizeof(struct pool_worker));
+    threads = calloc(nthreads, sizeof(pthread_t));
+    jobs = malloc(njobs * sizeof(size_t));
+    if (!pool.deques || !workers || !threads || !jobs) {
+        free(pool.deques);
+        free(workers);
+        free(threads);
+        free(jobs);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (j = 0; j < njobs; j++) {
+        jobs[j] = j;
+    }
+    // Each deque is a slice of the same array, reversed so that its owner
+    // pops the jobs in order while thieves take the ones it would run last.
+    for (i = 0; i < nthreads; i++) {
+        size_t first = njobs * i / nthreads;
+        size_t last = njobs * (i + 1) / nthreads;
+        size_t k;
+
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].jobs = jobs + first;
+        pool.deques[i].top = 0;
+        pool.deques[i].bottom = last - first;
+        for (k = 0; k < (last - first) / 2; k++) {
+            size_t tmp = jobs[first + k];
+            jobs[first + k] = jobs[last - 1 - k];
+            jobs[last - 1 - k] = tmp;
+        }
+    }
+
+    for (started = 0; started < nthreads; started++) {
+        workers[started].pool = &pool;
+        workers[started].id = started;
+        if (started == 0) {
+            continue;
+        }
+        err = pthread_create(&threads[started], NULL, pool_thread, &workers[started]);
+        if (err) {
+            break;
+        }
+    }
+    // The caller is worker 0. If not every thread could be started the
+    // others steal their jobs.
+    pool_thread(&workers[0]);
+    for (i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+    free(pool.deques);
+    free(workers);
+    free(threads);
+    free(jobs);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef POOL_H_INCLUDED
+#define POOL_H_INCLUDED
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* Job callback: job is the index of the job, worker the index of the thread
+ * running it (0 to nthreads - 1), so that per thread state can be kept.
+ */
+typedef void (*pool_fn)(void *arg, size_t job, int worker);
+
+/* Queue of jobs owned by a worker. The owner takes from the bottom, the
+ * other workers steal from the top.
+ */
+struct pool_deque {
+    pthread_mutex_t lock;
+    size_t top;
+    size_t bottom;
+    size_t *jobs;
+};
+
+struct pool {
+    int nthreads;
+    struct pool_deque *deques;
+    pool_fn fn;
+    void *arg;
+};
+
+int pool_default_threads(void);
+int pool_run(int nthreads, size_t njobs, pool_fn fn, void *arg);
+#endif
@@ -0,0 +1,829 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+#include "data.h"
+#include "parser.h"
+#include "out.h"
+#include "timefmt.h"
+#include "tables.h"
+#include "encode.h"
+#include "stats.h"
+#include "snap.h"
+#include "print.h"
+
+// Converts date from epoc to a string, in the format given by mode.
+// The formatting is cached per thread, see timefmt.c.
+void convert_epoch_h(struct outbuf *out, uint32_t *time, const char *what, int mode) {
+    char timebuf[TIME_BUFSIZE];
+
+    out_lit(out, "\t\t");
+    out_str(out, what);
+    out_lit(out, ": ");
+    if (*time == 0)
+        out_char(out, '0');
+    else
+        out_mem(out, timebuf, time_format(timebuf, *time, mode));
+    out_char(out, '\n');
+}
+
+// Print a principal as comp1/comp2/...@REALM
+void print_principal(struct outbuf *out, const struct principal *princ) {
+    ssize_t i;
+
+    for (i = 0; i < princ->comp_count; i++) {
+        if (i) {
+            out_char(out, '/');
+        }
+        out_mem(out, princ->components[i].value, princ->components[i].length);
+    }
+    out_char(out, '@');
+    out_mem(out, princ->realm.value, princ->realm.length);
+}
+
+// Length of a principal printed by print_principal()
+static size_t principal_length(const struct principal *princ) {
+    size_t length = princ->realm.length + 1;
+    ssize_t i;
+
+    for (i = 0; i < princ->comp_count; i++) {
+        length += princ->components[i].length + (i ? 1 : 0);
+    }
+    return length;
+}
+
+// A binary value: dumped if asked to, else as it is up to the first NUL
+static void print_value(struct outbuf *out, const struct data *value, int dump) {
+    if (dump) {
+        out_encode(out, value->value, value->length, dump);
+    } else {
+        out_mem(out, value->value, strnlen(value->value, value->length));
+    }
+}
+
+void print_addresses(struct outbuf *out, const struct addresses *addrs, int dump) {
+    ssize_t i;
+
+    for (i = 0; i < addrs->count; i++) {
+        const struct address *addr = &addrs->addresses[i];
+        const char *name;
+        size_t len;
+
+        out_lit(out, "address type: 0x");
+        out_hex(out, addr->addrtype);
+        name = addrtype_name(addr->addrtype, &len);
+        if (name) {
+            out_lit(out, " (");
+            out_mem(out, name, len);
+            out_char(out, ')');
+        }
+        out_lit(out, " value: ");
+        print_value(out, &addr->data, dump);
+        out_char(out, '\n');
+    }
+}
+
+void print_authdatas(struct outbuf *out, const struct authdatas *auths, int dump) {
+    ssize_t i;
+
+    for (i = 0; i < auths->count; i++) {
+        const struct authdata *auth = &auths->authdatas[i];
+        out_lit(out, "address type: 0x");
+        out_hex(out, auth->ad_type);
+        out_lit(out, " value: ");
+        print_value(out, &auth->data, dump);
+        out_char(out, '\n');
+    }
+}
+
+// Print the flags as hex and by name
+static void print_flags(struct outbuf *out, uint32_t ticket_flags) {
+    char flags[FLAG_RENDER_MAX];
+
+    out_lit(out, "\t\tFlags: ");
+    out_hex(out, ticket_flags);
+    out_lit(out, " (");
+    out_mem(out, flags, flag_render(flags, ticket_flags));
+    out_lit(out, ")\n");
+}
+
+static void print_enctype(struct outbuf *out, uint16_t enctype) {
+    const char *name;
+    size_t len;
+
+    out_lit(out, "\t\tKey type: 0x");
+    out_hex(out, enctype);
+    name = enctype_name(enctype, &len);
+    if (name) {
+        out_lit(out, " (");
+        out_mem(out, name, len);
+        out_char(out, ')');
+    }
+    out_char(out, '\n');
+}
+
+static void print_credential_text(struct outbuf *out, const struct print_options *opts,
+                                  struct credential *cred, ssize_t i) {
+    size_t start;
+
+    start = out->len;
+    out_i64(out, i);
+    out_pad(out, out->len - start, 5);
+    out_lit(out, "\tclient: ");
+    print_principal(out, &cred->client);
+    out_lit(out, "\t\tserver: ");
+    print_principal(out, &cred->server);
+    out_char(out, '\n');
+
+    convert_epoch_h(out, &cred->authtime, "Auth time", opts->time_mode);
+    convert_epoch_h(out, &cred->starttime, "Start time", opts->time_mode);
+    convert_epoch_h(out, &cred->endtime, "End time", opts->time_mode);
+    convert_epoch_h(out, &cred->renew_till, "Renew till", opts->time_mode);
+    out_lit(out, "\t\tis_key: ");
+    out_u64(out, cred->is_skey);
+    out_char(out, '\n');
+    print_flags(out, cred->ticket_flags);
+    print_enctype(out, cred->keyblock.enctype);
+    if (opts->dump) {
+        out_lit(out, "\t\tKey: ");
+        out_encode(out, cred->keyblock.data.value, cred->keyblock.data.length, opts->dump);
+        out_lit(out, "\n\t\tTicket: ");
+        out_encode(out, cred->ticket.value, cred->ticket.length, opts->dump);
+        out_lit(out, "\n\t\tSecond ticket: ");
+        out_encode(out, cred->second_ticket.value, cred->second_ticket.length, opts->dump);
+        out_char(out, '\n');
+    }
+
+    print_addresses(out, &cred->addresses, opts->dump);
+    print_authdatas(out, &cred->authdatas, opts->dump);
+    out_char(out, '\n');
+}
+
+// A principal as a JSON string
+static void print_principal_json(struct outbuf *out, const struct principal *princ) {
+    char buf[MAXSTRINGLEN];
+    struct outbuf tmp;
+
+    // Escape it in one go when it fits on the stack, as it is the usual case
+    if (principal_length(princ) <= sizeof(buf)) {
+        tmp.buf = buf;
+        tmp.len = 0;
+        tmp.size = sizeof(buf);
+        tmp.fd = -1;
+        tmp.error = 0;
+        print_principal(&tmp, princ);
+        out_json_str(out, tmp.buf, tmp.len);
+        return;
+    }
+    out_init(&tmp, -1, principal_length(princ));
+    print_principal(&tmp, princ);
+    out_json_str(out, tmp.buf, tmp.len);
+    out_free(&tmp);
+}
+
+static void print_field_u64(struct outbuf *out, const char *name, uint64_t value) {
+    out_lit(out, ",\"");
+    out_str(out, name);
+    out_lit(out, "\":");
+    out_u64(out, value);
+}
+
+// A time as a number, or as a string when it is formatted (null if not set)
+static void print_field_time(struct outbuf *out, const char *name, uint32_t time, int mode) {
+    char timebuf[TIME_BUFSIZE];
+
+    if (mode == TIMEFMT_RAW) {
+        print_field_u64(out, name, time);
+        return;
+    }
+    out_lit(out, ",\"");
+    out_str(out, name);
+    out_lit(out, "\":");
+    if (!time) {
+        out_lit(out, "null");
+        return;
+    }
+    out_json_str(out, timebuf, time_format(timebuf, time, mode));
+}
+
+// The name of a value, if it has one
+static void print_field_name(struct outbuf *out, const char *field, const char *name, size_t len) {
+    if (!name) {
+        return;
+    }
+    out_lit(out, ",\"");
+    out_str(out, field);
+    out_lit(out, "\":\"");
+    // The names of the tables never need escaping
+    out_mem(out, name, len);
+    out_char(out, '"');
+}
+
+// A binary value as a JSON string, in the encoding of dump
+static void print_field_dump(struct outbuf *out, const char *name, const struct data *value, int dump) {
+    out_lit(out, ",\"");
+    out_str(out, name);
+    out_lit(out, "\":\"");
+    // Neither hex nor base64 needs escaping
+    out_encode(out, value->value, value->length, dump);
+    out_char(out, '"');
+}
+
+static void print_typed_list_json(struct outbuf *out, const char *name, uint32_t count,
+                                  const void *items, size_t item_size,
+                                  const struct name_entry *names, uint32_t max, int dump) {
+    const char *item = items;
+    uint32_t i;
+
+    out_lit(out, ",\"");
+    out_str(out, name);
+    out_lit(out, "\":[");
+    for (i = 0; i < count; i++, item += item_size) {
+        // struct address and struct authdata share the layout
+        const struct address *entry = (const struct address *) item;
+
+        if (i) {
+            out_char(out, ',');
+        }
+        out_lit(out, "{\"type\":");
+        out_u64(out, entry->addrtype);
+        if (names) {
+            const char *type_name;
+            size_t len;
+
+            type_name = table_lookup(names, max, entry->addrtype, &len);
+            print_field_name(out, "type_name", type_name, len);
+        }
+        out_lit(out, ",\"length\":");
+        out_u64(out, entry->data.length);
+        if (dump) {
+            print_field_dump(out, "value", &entry->data, dump);
+        }
+        out_char(out, '}');
+    }
+    out_char(out, ']');
+}
+
+// One credential as a JSON object. With ndjson every object stands on its own
+// line and carries the file it comes from; in a json document the commas
+// between them are printed by the callers, that know what was printed before.
+static void print_credential_json(struct outbuf *out, const struct print_options *opts,
+                                  const char *filename, struct credential *cred, ssize_t i) {
+    char flags[FLAG_RENDER_MAX];
+    const char *name;
+    size_t len;
+
+    if (opts->format == PRINT_NDJSON) {
+        out_lit(out, "{\"file\":");
+        out_json_str(out, filename, strlen(filename));
+        out_lit(out, ",\"index\":");
+    } else {
+        out_lit(out, "\n{\"index\":");
+    }
+    out_i64(out, i);
+    out_lit(out, ",\"client\":");
+    print_principal_json(out, &cred->client);
+    print_field_u64(out, "client_name_type", cred->client.name_type);
+    name = name_type_name(cred->client.name_type, &len);
+    print_field_name(out, "client_name_type_name", name, len);
+    out_lit(out, ",\"server\":");
+    print_principal_json(out, &cred->server);
+    print_field_u64(out, "server_name_type", cred->server.name_type);
+    name = name_type_name(cred->server.name_type, &len);
+    print_field_name(out, "server_name_type_name", name, len);
+    print_field_u64(out, "enctype", cred->keyblock.enctype);
+    name = enctype_name(cred->keyblock.enctype, &len);
+    print_field_name(out, "enctype_name", name, len);
+    print_field_time(out, "authtime", cred->authtime, opts->time_mode);
+    print_field_time(out, "starttime", cred->starttime, opts->time_mode);
+    print_field_time(out, "endtime", cred->endtime, opts->time_mode);
+    print_field_time(out, "renew_till", cred->renew_till, opts->time_mode);
+    print_field_u64(out, "is_skey", cred->is_skey);
+    print_field_u64(out, "flags", cred->ticket_flags);
+    print_field_name(out, "flag_names", flags, flag_render(flags, cred->ticket_flags));
+    // Not decoded in a summary
+    if (!opts->summary) {
+        print_typed_list_json(out, "addresses", cred->addresses.count,
+                              cred->addresses.addresses, sizeof(struct address),
+                              addrtype_table, ADDRTYPE_MAX, opts->dump);
+        print_typed_list_json(out, "authdata", cred->authdatas.count,
+                              cred->authdatas.authdatas, sizeof(struct authdata), NULL, 0, opts->dump);
+        print_field_u64(out, "ticket_length", cred->ticket.length);
+        print_field_u64(out, "second_ticket_length", cred->second_ticket.length);
+        if (opts->dump) {
+            print_field_dump(out, "key", &cred->keyblock.data, opts->dump);
+            print_field_dump(out, "ticket", &cred->ticket, opts->dump);
+            print_field_dump(out, "second_ticket", &cred->second_ticket, opts->dump);
+        }
+    }
+    out_char(out, '}');
+    if (opts->format == PRINT_NDJSON) {
+        out_char(out, '\n');
+    }
+}
+
+void print_credential(struct outbuf *out, const struct print_options *opts,
+                      const char *filename, struct credential *cred, ssize_t i) {
+    STATS_START(start);
+
+    if (opts->format == PRINT_TEXT) {
+        print_credential_text(out, opts, cred, i);
+    } else {
+        print_credential_json(out, opts, filename, cred, i);
+    }
+    STATS_STOP(start, print_ns);
+}
+
+// The comma before a credential of a json document, but the first printed
+static void print_separator(struct outbuf *out, const struct print_options *opts, int *printed) {
+    if ((*printed)++ && opts->format == PRINT_JSON) {
+        out_char(out, ',');
+    }
+}
+
+// Describe a parse failure of the library, without the final new line
+static void format_error(struct outbuf *out, const char *filename, struct ccache *cc, int err) {
+    if (!cc) {
+        out_lit(out, "Error opening the file ");
+        out_str(out, filename);
+        out_lit(out, ": ");
+        out_str(out, cc_strerror(err));
+    } else if (err == CC_ERR_IO && !strcmp(cc->where, "open")) {
+        out_lit(out, "Error opening the file ");
+        out_str(out, filename);
+        out_lit(out, ": ");
+        out_str(out, strerror(cc->sys_errno));
+    } else if (err == CC_ERR_IO) {
+        out_lit(out, "Error while reading ");
+        out_str(out, cc->where);
+        out_lit(out, " of ");
+        out_str(out, filename);
+        out_lit(out, ": ");
+        out_str(out, strerror(cc->sys_errno));
+    } else if (err == CC_ERR_NOT_FOUND) {
+        out_lit(out, "Error: ");
+        out_str(out, filename);
+        out_lit(out, " has no such credential");
+    } else if (cc->where && !strcmp(cc->where, "credential")) {
+        out_lit(out, "Error while reading credential ");
+        out_u64(out, cc->count);
+        out_lit(out, ": ");
+        out_str(out, cc_strerror(err));
+    } else {
+        out_lit(out, "Error while reading ");
+        out_str(out, cc->where);
+        out_lit(out, ": ");
+        out_str(out, cc_strerror(err));
+    }
+}
+
+// Print a parse failure of the library
+void print_error(struct outbuf *out, const struct print_options *opts,
+                 const char *filename, struct ccache *cc, int err) {
+    struct outbuf msg;
+
+    if (opts->format == PRINT_TEXT) {
+        format_error(out, filename, cc, err);
+        out_char(out, '\n');
+        return;
+    }
+    if (out_init(&msg, -1, 0) < 0) {
+        return;
+    }
+    format_error(&msg, filename, cc, err);
+    out_lit(out, "\"error\":");
+    out_json_str(out, msg.buf, msg.len);
+    out_free(&msg);
+}
+
+// Print the credentials in [first, last] going through all of them, for the
+// files that can't be indexed
+static int print_range_sequential(struct outbuf *out, const struct print_options *opts,
+                                  const char *filename, struct ccache *cc) {
+    int ret, printed = 0;
+    struct credential *cred;
+
+    while ((ret = cc_next(cc, &cred)) == CC_OK) {
+        ssize_t i = cc->count - 1;
+
+        if (i > opts->last) {
+            return 0;
+        }
+        if (i >= opts->first) {
+            print_separator(out, opts, &printed);
+            print_credential(out, opts, filename, cred, i);
+        }
+    }
+    if (ret == CC_END && cc->count <= opts->first) {
+        ret = CC_ERR_NOT_FOUND;
+    }
+    return ret == CC_END ? 0 : ret;
+}
+
+// Print only the credentials in [first, last], decoding only those
+static int print_range(struct outbuf *out, const struct print_options *opts,
+                       const char *filename, struct ccache *cc) {
+    int ret, printed = 0;
+    ssize_t i;
+    struct credential *cred;
+
+    ret = cc_index_build(cc);
+    if (ret == CC_ERR_NOT_SEEKABLE) {
+        return print_range_sequential(out, opts, filename, cc);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+    if (opts->first >= cc->index.count) {
+        return CC_ERR_NOT_FOUND;
+    }
+    for (i = opts->first; i <= opts->last && i < cc->index.count; i++) {
+        ret = cc_get(cc, i, &cred);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret == CC_SKIPPED) {
+            continue;
+        }
+        print_separator(out, opts, &printed);
+        print_credential(out, opts, filename, cred, i);
+    }
+    return 0;
+}
+
+struct chunk_outputs {
+    const struct print_options *opts;
+    const char *filename;
+    struct outbuf *outs;
+};
+
+static int print_chunk_credential(void *arg, size_t chunk, size_t n, struct credential *cred) {
+    struct chunk_outputs *co = arg;
+
+    // Every one has its comma: the first of the document is dropped below
+    if (co->opts->format == PRINT_JSON) {
+        out_char(&co->outs[chunk], ',');
+    }
+    print_credential(&co->outs[chunk], co->opts, co->filename, cred, n);
+    return 0;
+}
+
+// Print the credentials in [first, last] decoding them on several threads.
+// Every chunk is printed to its own buffer, the buffers are then written in
+// file order.
+static int print_parallel(struct outbuf *out, const struct print_options *opts,
+                          const char *filename, struct ccache *cc) {
+    struct chunk_outputs co;
+    size_t first, last, chunks, i;
+    int ret, printed = 0;
+
+    ret = cc_index_build(cc);
+    if (ret < 0) {
+        return ret;
+    }
+    first = opts->first >= 0 ? opts->first : 0;
+    last = opts->first >= 0 ? opts->last : cc->index.count - 1;
+    if (!cc->index.count || first >= cc->index.count) {
+        return opts->first >= 0 ? CC_ERR_NOT_FOUND : 0;
+    }
+    if (last >= cc->index.count) {
+        last = cc->index.count - 1;
+    }
+    chunks = (last - first) / CC_CHUNK_SIZE + 1;
+    co.opts = opts;
+    co.filename = filename;
+    co.outs = calloc(chunks, sizeof(struct outbuf));
+    if (!co.outs) {
+        return CC_ERR_NOMEM;
+    }
+    for (i = 0; i < chunks; i++) {
+        if (out_init(&co.outs[i], -1, 0) < 0) {
+            ret = CC_ERR_NOMEM;
+            goto out;
+        }
+    }
+
+    ret = cc_decode_parallel(cc, first, last, CC_CHUNK_SIZE, opts->nthreads,
+                             print_chunk_credential, &co);
+
+    // On failure print what comes before the credential that failed
+    for (i = 0; i < chunks; i++) {
+        const struct outbuf *o = &co.outs[i];
+        size_t skip = !printed && o->len && opts->format == PRINT_JSON;
+
+        out_mem(out, o->buf + skip, o->len - skip);
+        printed |= o->len > 0;
+        if (ret < 0 && cc->count < first + (i + 1) * CC_CHUNK_SIZE) {
+            break;
+        }
+    }
+
+out:
+    for (i = 0; i < chunks; i++) {
+        out_free(&co.outs[i]);
+    }
+    free(co.outs);
+    return ret;
+}
+
+// Print the credentials for opts->server, newest first, decoding only them
+static int print_server(struct outbuf *out, const struct print_options *opts,
+                        const char *filename, struct ccache *cc) {
+    struct credential *cred;
+    const uint32_t *creds;
+    size_t i, count;
+    int ret, printed = 0;
+
+    ret = cc_find_server_name(cc, opts->server, &creds, &count);
+    if (ret < 0) {
+        return ret;
+    }
+    for (i = 0; i < count; i++) {
+        ret = cc_get(cc, creds[i], &cred);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret == CC_SKIPPED) {
+            continue;
+        }
+        print_separator(out, opts, &printed);
+        print_credential(out, opts, filename, cred, creds[i]);
+    }
+    return 0;
+}
+
+// Print the credentials from the position of the cursor on, decoding them
+// one at a time
+int check_credentials(struct outbuf *out, const struct print_options *opts,
+                      const char *filename, struct ccache *cc) {
+    int ret, printed = 0;
+    struct credential *cred;
+
+    if (opts->server) {
+        return print_server(out, opts, filename, cc);
+    }
+    if (opts->nthreads > 1 && reader_is_mapped(&cc->reader)) {
+        return print_parallel(out, opts, filename, cc);
+    }
+    if (opts->first >= 0) {
+        return print_range(out, opts, filename, cc);
+    }
+    while ((ret = cc_next(cc, &cred)) == CC_OK) {
+        print_separator(out, opts, &printed);
+        print_credential(out, opts, filename, cred, cc->count - 1);
+    }
+    return ret == CC_END ? 0 : ret;
+}
+
+void print_credentials_header(struct outbuf *out) {
+    out_lit(out, "-- Credentials\n");
+    out_lit(out, "num  \tClient                                  \t\t\t\tServer\n");
+}
+
+static void print_stat_text(struct outbuf *out, const char *desc, uint64_t value,
+                            int fraction, const char *unit) {
+    size_t start = out->len;
+
+    out_str(out, desc);
+    out_char(out, ':');
+    out_pad(out, out->len - start, 50);
+    out_u64(out, value);
+    if (fraction >= 0) {
+        out_char(out, '.');
+        out_char(out, '0' + fraction / 100);
+        out_char(out, '0' + fraction / 10 % 10);
+        out_char(out, '0' + fraction % 10);
+    }
+    if (*unit) {
+        out_char(out, ' ');
+        out_str(out, unit);
+    }
+    out_char(out, '\n');
+}
+
+/* Print what stats_get() returns: in text, the times are in milliseconds */
+void print_stats(struct outbuf *out, int format) {
+    struct cc_stats stats;
+    int first = 1;
+
+    stats_get(&stats);
+    if (format == PRINT_TEXT) {
+        out_lit(out, "-- Statistics\n");
+    } else {
+        out_lit(out, "{\"stats\":{");
+    }
+#define PRINT_STAT(name, unit, desc) \
+    if (format != PRINT_TEXT) { \
+        if (!first) { \
+            out_char(out, ','); \
+        } \
+        out_lit(out, "\"" #name "\":"); \
+        out_u64(out, stats.name); \
+    } else if (!strcmp(unit, "ns")) { \
+        print_stat_text(out, desc, stats.name / 1000000, stats.name / 1000 % 1000, "ms"); \
+    } else { \
+        print_stat_text(out, desc, stats.name, -1, unit); \
+    } \
+    first = 0;
+    CC_STATS(PRINT_STAT)
+#undef PRINT_STAT
+    if (format != PRINT_TEXT) {
+        out_lit(out, "}}\n");
+    }
+}
+
+// A string of a snapshot, in JSON or as it is; -1 if it is broken
+static int print_snap_string(struct outbuf *out, const struct snap *s, uint32_t id, int json) {
+    const char *value;
+    uint32_t length;
+
+    if (snap_string(s, id, &value, &length) < 0) {
+        out_str(out, json ? "null" : "?");
+        return -1;
+    }
+    if (json) {
+        out_json_str(out, value, length);
+    } else {
+        out_mem(out, value, length);
+    }
+    return 0;
+}
+
+/* Print the records [first, first + count) that snap_lookup() found for a
+ * server: in text, a line per credential with its client, endtime, flags,
+ * then the file and the offset of the credential in it.
+ * Returns CC_OK, or CC_ERR_INVALID if the snapshot is broken.
+ */
+int print_snap_records(struct outbuf *out, const struct print_options *opts, const struct snap *s,
+                       const char *server, uint64_t first, uint64_t count) {
+    char flags[FLAG_RENDER_MAX];
+    char timebuf[TIME_BUFSIZE];
+    int json = opts->format != PRINT_TEXT, broken = 0;
+    uint64_t i;
+
+    if (opts->format == PRINT_TEXT) {
+        out_str(out, server);
+        out_char(out, '\n');
+    } else if (opts->format == PRINT_JSON) {
+        out_lit(out, "{\"server\":");
+        out_json_str(out, server, strlen(server));
+        out_lit(out, ",\"credentials\":[");
+    }
+    for (i = first; i < first + count; i++) {
+        const struct snap_record *rec = &s->records[i];
+
+        if (opts->format == PRINT_TEXT) {
+            out_char(out, '\t');
+            broken |= print_snap_string(out, s, rec->client, 0);
+            out_char(out, '\t');
+            if (!rec->endtime) {
+                out_char(out, '0');
+            } else {
+                out_mem(out, timebuf, time_format(timebuf, rec->endtime, opts->time_mode));
+            }
+            out_char(out, '\t');
+            out_mem(out, flags, flag_render(flags, rec->flags));
+            out_char(out, '\t');
+            if (rec->file < s->header->files) {
+                broken |= print_snap_string(out, s, s->files[rec->file].path, 0);
+            } else {
+                broken = -1;
+            }
+            out_lit(out, " +");
+            out_u64(out, rec->offset);
+            out_char(out, '\n');
+            continue;
+        }
+        if (opts->format == PRINT_NDJSON) {
+            out_lit(out, "{\"server\":");
+            out_json_str(out, server, strlen(server));
+            out_char(out, ',');
+        } else {
+            if (i > first) {
+                out_char(out, ',');
+            }
+            out_lit(out, "\n{");
+        }
+        out_lit(out, "\"client\":");
+        broken |= print_snap_string(out, s, rec->client, json);
+        print_field_time(out, "endtime", rec->endtime, opts->time_mode);
+        print_field_u64(out, "flags", rec->flags);
+        print_field_name(out, "flag_names", flags, flag_render(flags, rec->flags));
+        out_lit(out, ",\"file\":");
+        if (rec->file < s->header->files) {
+            broken |= print_snap_string(out, s, s->files[rec->file].path, json);
+        } else {
+            out_lit(out, "null");
+            broken = -1;
+        }
+        print_field_u64(out, "offset", rec->offset);
+        out_char(out, '}');
+        if (opts->format == PRINT_NDJSON) {
+            out_char(out, '\n');
+        }
+    }
+    if (opts->format == PRINT_JSON) {
+        out_lit(out, "]}\n");
+    }
+    return broken ? CC_ERR_INVALID : CC_OK;
+}
+
+void print_options_init(struct print_options *opts) {
+    opts->first = -1;
+    opts->last = -1;
+    opts->nthreads = 1;
+    opts->format = PRINT_TEXT;
+    opts->time_mode = TIMEFMT_LOCAL;
+    opts->filter = NULL;
+    opts->summary = 0;
+    opts->server = NULL;
+    opts->dump = ENCODE_NONE;
+}
+
+// Print a ccache just opened, ret being what opening it returned
+static int print_opened(struct outbuf *out, const char *filename, struct ccache *cc, int ret,
+                        const struct print_options *opts) {
+    if (ret < 0) {
+        if (opts->format != PRINT_TEXT) {
+            out_lit(out, "{\"file\":");
+            out_json_str(out, filename, strlen(filename));
+            out_char(out, ',');
+        }
+        print_error(out, opts, filename, cc, ret);
+        if (opts->format != PRINT_TEXT) {
+            out_lit(out, "}\n");
+        }
+        goto fail_close;
+    }
+    cc_set_filter(cc, opts->filter);
+    cc_set_summary(cc, opts->summary);
+    LOG("File size: %zd (%s)\n", (ssize_t) cc->reader.size,
+        cc->reader.borrowed ? "loaded" : reader_is_mapped(&cc->reader) ? "mapped" : "streamed");
+
+    if (opts->format == PRINT_TEXT) {
+        out_lit(out, "Default principal: ");
+        print_principal(out, &cc->default_principal);
+        out_char(out, '\n');
+    } else if (opts->format == PRINT_JSON) {
+        out_lit(out, "{\"file\":");
+        out_json_str(out, filename, strlen(filename));
+        out_lit(out, ",\"default_principal\":");
+        print_principal_json(out, &cc->default_principal);
+        out_lit(out, ",\"credentials\":[");
+    }
+
+    // Get the credentials
+    if (opts->format == PRINT_TEXT) {
+        print_credentials_header(out);
+    }
+    ret = check_credentials(out, opts, filename, cc);
+    if (opts->format == PRINT_JSON) {
+        out_lit(out, "]");
+        if (ret < 0) {
+            out_char(out, ',');
+            print_error(out, opts, filename, cc, ret);
+        }
+        out_lit(out, "}\n");
+    } else if (ret < 0 && opts->format == PRINT_NDJSON) {
+        out_lit(out, "{\"file\":");
+        out_json_str(out, filename, strlen(filename));
+        out_char(out, ',');
+        print_error(out, opts, filename, cc, ret);
+        out_lit(out, "}\n");
+    } else if (ret < 0) {
+        print_error(out, opts, filename, cc, ret);
+    }
+    if (ret < 0) {
+        goto fail_close;
+    }
+
+    cc_close(cc);
+    return 0;
+
+fail_close:
+    cc_close(cc);
+    return ret;
+}
+
+// Print the whole content of a ccache.
+// Returns 0 on success, the CC_ERR_* code of the failure otherwise.
+int print_ccache(struct outbuf *out, const char *filename, const struct print_options *opts) {
+    struct ccache *cc;
+    int ret;
+
+    ret = cc_open(&cc, filename);
+    return print_opened(out, filename, cc, ret, opts);
+}
+
+// Same as print_ccache() for a ccache already in memory, read from filename
+int print_ccache_mem(struct outbuf *out, const char *filename, const void *data, size_t size,
+                     const struct print_options *opts) {
+    struct ccache *cc;
+    int ret;
+
+    ret = cc_memopen(&cc, data, size);
+    return print_opened(out, filename, cc, ret, opts);
+}
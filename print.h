@@ -0,0 +1,48 @@
+#ifndef PRINT_H_INCLUDED
+#define PRINT_H_INCLUDED
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "data.h"
+#include "parser.h"
+#include "out.h"
+
+struct snap;
+
+/* Output formats */
+#define PRINT_TEXT                      0
+#define PRINT_JSON                      1       /* a document per file */
+#define PRINT_NDJSON                    2       /* a line per credential */
+
+/* What to print of a ccache */
+struct print_options {
+    ssize_t first;          /* first credential to print, -1 for all */
+    ssize_t last;           /* last credential to print (included) */
+    int nthreads;           /* threads decoding a single file, 1 for serial */
+    int format;
+    int time_mode;          /* TIMEFMT_LOCAL, TIMEFMT_RAW or TIMEFMT_UTC */
+    const struct cc_filter *filter;     /* NULL for all the credentials */
+    int summary;            /* only the principals, enctype, times and flags */
+    const char *server;     /* only its credentials, newest first, NULL for all */
+    int dump;               /* ENCODE_HEX or ENCODE_BASE64 to dump the payloads */
+};
+
+void print_options_init(struct print_options *opts);
+void convert_epoch_h(struct outbuf *out, uint32_t *time, const char *what, int mode);
+void print_principal(struct outbuf *out, const struct principal *princ);
+void print_addresses(struct outbuf *out, const struct addresses *addrs, int dump);
+void print_authdatas(struct outbuf *out, const struct authdatas *auths, int dump);
+void print_credential(struct outbuf *out, const struct print_options *opts,
+                      const char *filename, struct credential *cred, ssize_t i);
+void print_error(struct outbuf *out, const struct print_options *opts,
+                 const char *filename, struct ccache *cc, int err);
+void print_credentials_header(struct outbuf *out);
+int check_credentials(struct outbuf *out, const struct print_options *opts,
+                      const char *filename, struct ccache *cc);
+void print_stats(struct outbuf *out, int format);
+int print_snap_records(struct outbuf *out, const struct print_options *opts, const struct snap *s,
+                       const char *server, uint64_t first, uint64_t count);
+int print_ccache(struct outbuf *out, const char *filename, const struct print_options *opts);
+int print_ccache_mem(struct outbuf *out, const char *filename, const void *data, size_t size,
+                     const struct print_options *opts);
+#endif
@@ -0,0 +1,464 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glob.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "parser.h"
+#include "print.h"
+#include "pool.h"
+#include "load.h"
+#include "intern.h"
+#include "scan.h"
+
+void scan_init(struct scan *s, struct outbuf *out, const struct print_options *opts) {
+    memset(s, 0, sizeof(*s));
+    s->out = out;
+    s->opts = opts;
+    s->io = LOAD_URING;
+    pthread_mutex_init(&s->out_lock, NULL);
+}
+
+int scan_add_file(struct scan *s, const char *path, int discovered) {
+    if (s->count == s->size) {
+        size_t size = s->size ? s->size * 2 : 64;
+        struct scan_file *files = realloc(s->files, size * sizeof(struct scan_file));
+
+        if (!files) {
+            return -1;
+        }
+        s->files = files;
+        s->size = size;
+    }
+    s->files[s->count].path = strdup(path);
+    if (!s->files[s->count].path) {
+        return -1;
+    }
+    s->files[s->count].discovered = discovered;
+    s->count++;
+    return 0;
+}
+
+// Add every regular file of a directory (not recursively)
+static int scan_add_dir(struct scan *s, const char *path) {
+    DIR *dir;
+    struct dirent *de;
+    char file[4096];
+    int ret = 0;
+
+    dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+    while ((de = readdir(dir))) {
+        struct stat st;
+        int n;
+
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        // Cut short, the path would name another file: it can't be opened anyway
+        n = snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+        if (n < 0 || (size_t) n >= sizeof(file)) {
+            continue;
+        }
+        if (de->d_type != DT_REG) {
+            if (de->d_type != DT_UNKNOWN || stat(file, &st) < 0 || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+        }
+        if (scan_add_file(s, file, 1) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    closedir(dir);
+    return ret;
+}
+
+/* Add a directory, a glob pattern or a single file to the scan.
+ * Returns -1 and sets errno on failure.
+ */
+int scan_add_path(struct scan *s, const char *path) {
+    struct stat st;
+    glob_t gl;
+    size_t i;
+    int rc;
+
+    if (stat(path, &st) == 0) {
+        if (S_ISDIR(st.st_mode)) {
+            return scan_add_dir(s, path);
+        }
+        return scan_add_file(s, path, 0);
+    }
+    if (!strpbrk(path, "*?[")) {
+        return -1;
+    }
+    rc = glob(path, 0, NULL, &gl);
+    if (rc == GLOB_NOMATCH) {
+        return 0;
+    }
+    if (rc) {
+        errno = rc == GLOB_NOSPACE ? ENOMEM : EIO;
+        return -1;
+    }
+    for (i = 0; i < gl.gl_pathc; i++) {
+        if (scan_add_file(s, gl.gl_pathv[i], 0) < 0) {
+            globfree(&gl);
+            return -1;
+        }
+    }
+    globfree(&gl);
+    return 0;
+}
+
+/* Add the files listed one per line in a stream */
+int scan_add_list(struct scan *s, FILE *in) {
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t n;
+    int ret = 0;
+
+    while ((n = getline(&line, &len, in)) > 0) {
+        if (line[n - 1] == '\n') {
+            line[--n] = '\0';
+        }
+        if (!n) {
+            continue;
+        }
+        if (scan_add_file(s, line, 0) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    free(line);
+    return ret;
+}
+
+// Add n to the count of an ID
+static int add_count(struct scan_counts *c, uint32_t id, uint64_t n) {
+    if (id >= c->size) {
+        uint32_t size = c->size ? c->size * 2 : 64;
+        uint64_t *counts;
+
+        while (size <= id) {
+            size *= 2;
+        }
+        counts = realloc(c->counts, size * sizeof(uint64_t));
+        if (!counts) {
+            return CC_ERR_NOMEM;
+        }
+        memset(counts + c->size, 0, (size - c->size) * sizeof(uint64_t));
+        c->counts = counts;
+        c->size = size;
+    }
+    c->counts[id] += n;
+    return CC_OK;
+}
+
+// Count a credential by the ID of its server, client or realm
+static int count_credential(struct scan *s, struct scan_counts *c, const struct credential *cred) {
+    uint32_t id;
+    int rc;
+
+    if (s->count_by == SCAN_COUNT_SERVER) {
+        rc = cc_names_principal(&c->names, &cred->server, &id);
+    } else if (s->count_by == SCAN_COUNT_CLIENT) {
+        rc = cc_names_principal(&c->names, &cred->client, &id);
+    } else {
+        rc = cc_intern(&c->names.strings, cred->server.realm.value, cred->server.realm.length, &id);
+    }
+    return rc < 0 ? rc : add_count(c, id, 1);
+}
+
+/* Count the credentials of a file in the tables of a thread. Only the
+ * failures are printed.
+ */
+static int count_ccache(struct outbuf *out, struct scan *s, const struct load_file *file,
+                        struct scan_counts *c) {
+    const char *filename = file->path;
+    struct ccache *cc;
+    struct credential *cred;
+    int ret;
+
+    if (file->data) {
+        ret = cc_memopen(&cc, file->data, file->size);
+    } else {
+        ret = cc_open(&cc, filename);
+    }
+    if (ret == CC_OK) {
+        cc_set_filter(cc, s->opts->filter);
+        cc_set_summary(cc, 1);
+        while ((ret = cc_next(cc, &cred)) == CC_OK) {
+            ret = count_credential(s, c, cred);
+            if (ret < 0) {
+                break;
+            }
+        }
+    }
+    if (ret < 0) {
+        if (s->opts->format == PRINT_TEXT) {
+            out_lit(out, "-- File: ");
+            out_str(out, filename);
+            out_char(out, '\n');
+        } else {
+            out_lit(out, "{\"file\":");
+            out_json_str(out, filename, strlen(filename));
+            out_char(out, ',');
+        }
+        print_error(out, s->opts, filename, cc, ret);
+        if (s->opts->format != PRINT_TEXT) {
+            out_lit(out, "}\n");
+        }
+    }
+    cc_close(cc);
+    return ret < 0 ? ret : 0;
+}
+
+static const char *scan_path(void *arg, size_t job) {
+    struct scan *s = arg;
+
+    return s->files[job].path;
+}
+
+static void scan_job(void *arg, const struct load_file *loaded, int worker) {
+    struct scan *s = arg;
+    struct scan_file *file = &s->files[loaded->job];
+    struct outbuf out;
+    int ret;
+
+    if (out_init(&out, -1, 0) < 0) {
+        pthread_mutex_lock(&s->out_lock);
+        s->failures++;
+        pthread_mutex_unlock(&s->out_lock);
+        return;
+    }
+    if (s->count_by) {
+        ret = count_ccache(&out, s, loaded, &s->counts[worker]);
+    } else {
+        if (s->opts->format == PRINT_TEXT) {
+            out_lit(&out, "-- File: ");
+            out_str(&out, file->path);
+            out_char(&out, '\n');
+        }
+        if (loaded->data) {
+            ret = print_ccache_mem(&out, file->path, loaded->data, loaded->size, s->opts);
+        } else {
+            ret = print_ccache(&out, file->path, s->opts);
+        }
+        if (s->opts->format == PRINT_TEXT) {
+            out_char(&out, '\n');
+        }
+    }
+
+    // Whatever a directory holds beside ccaches is skipped silently
+    if (file->discovered &&
+        (ret == CC_ERR_NOT_CCACHE || ret == CC_ERR_VERSION || ret == CC_ERR_TRUNCATED)) {
+        out_free(&out);
+        return;
+    }
+    pthread_mutex_lock(&s->out_lock);
+    out_buf(s->out, &out);
+    if (ret < 0 || out.error) {
+        s->failures++;
+    }
+    pthread_mutex_unlock(&s->out_lock);
+    out_free(&out);
+}
+
+/* Parse all the files on nthreads threads (0 for one per CPU), loading them
+ * as s->io says.
+ * Returns the number of files that couldn't be parsed, -1 on errors.
+ */
+int scan_run(struct scan *s, int nthreads) {
+    int i;
+
+    if (s->count_by) {
+        s->nworkers = nthreads > 0 ? nthreads : pool_default_threads();
+        s->counts = calloc(s->nworkers, sizeof(struct scan_counts));
+        if (!s->counts) {
+            return -1;
+        }
+        for (i = 0; i < s->nworkers; i++) {
+            cc_names_init(&s->counts[i].names);
+        }
+    }
+    if (load_run(s->io, nthreads, s->count, scan_path, scan_job, s) < 0) {
+        return -1;
+    }
+    return s->failures;
+}
+
+// Add the counts of a thread to those of another
+static int merge_counts(struct scan *s, struct scan_counts *to, const struct scan_counts *from) {
+    uint32_t i, id;
+    int rc;
+
+    for (i = 0; i < from->size; i++) {
+        if (!from->counts[i]) {
+            continue;
+        }
+        if (s->count_by == SCAN_COUNT_REALM) {
+            const struct data *realm = cc_intern_get(&from->names.strings, i);
+
+            rc = cc_intern(&to->names.strings, realm->value, realm->length, &id);
+        } else {
+            rc = cc_names_merge(&to->names, &from->names, i, &id);
+        }
+        if (rc < 0 || (rc = add_count(to, id, from->counts[i])) < 0) {
+            return rc;
+        }
+    }
+    return CC_OK;
+}
+
+struct scan_total {
+    uint64_t count;
+    size_t offset;              /* of the name in the names buffer */
+    size_t length;
+    const char *name;
+};
+
+// Most credentials first, then by name
+static int compare_totals(const void *a, const void *b) {
+    const struct scan_total *x = a, *y = b;
+    size_t len = x->length < y->length ? x->length : y->length;
+    int cmp;
+
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+    cmp = memcmp(x->name, y->name, len);
+    if (cmp) {
+        return cmp;
+    }
+    return x->length < y->length ? -1 : x->length > y->length;
+}
+
+// The name of an ID, as printed by print_principal() for the principals
+static void print_count_name(struct outbuf *out, const struct scan *s, const struct scan_counts *c,
+                             uint32_t id) {
+    const struct data *str;
+    const uint32_t *ids;
+    uint32_t i, count;
+
+    if (s->count_by == SCAN_COUNT_REALM) {
+        str = cc_intern_get(&c->names.strings, id);
+        out_mem(out, str->value, str->length);
+        return;
+    }
+    ids = cc_names_ids(&c->names, id, &count);
+    for (i = 1; i < count; i++) {
+        if (i > 1) {
+            out_char(out, '/');
+        }
+        str = cc_intern_get(&c->names.strings, ids[i]);
+        out_mem(out, str->value, str->length);
+    }
+    out_char(out, '@');
+    str = cc_intern_get(&c->names.strings, ids[0]);
+    out_mem(out, str->value, str->length);
+}
+
+/* Print the credentials counted by the scan, merged across the threads, most
+ * frequent first. Returns -1 when out of memory.
+ */
+int scan_print_counts(struct scan *s) {
+    static const char *const keys[] = { NULL, "server", "client", "realm" };
+    const char *key = keys[s->count_by];
+    struct scan_counts *c = &s->counts[0];
+    struct scan_total *totals;
+    struct outbuf names;
+    size_t n = 0, i;
+    int w;
+
+    for (w = 1; w < s->nworkers; w++) {
+        if (merge_counts(s, c, &s->counts[w]) < 0) {
+            return -1;
+        }
+    }
+    if (out_init(&names, -1, 0) < 0) {
+        return -1;
+    }
+    totals = malloc((c->size ? c->size : 1) * sizeof(struct scan_total));
+    if (!totals) {
+        out_free(&names);
+        return -1;
+    }
+    for (i = 0; i < c->size; i++) {
+        if (c->counts[i]) {
+            totals[n].count = c->counts[i];
+            totals[n].offset = names.len;
+            print_count_name(&names, s, c, i);
+            totals[n].length = names.len - totals[n].offset;
+            n++;
+        }
+    }
+    if (names.error) {
+        free(totals);
+        out_free(&names);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        totals[i].name = names.buf + totals[i].offset;
+    }
+    qsort(totals, n, sizeof(struct scan_total), compare_totals);
+
+    if (s->opts->format == PRINT_TEXT) {
+        out_lit(s->out, "-- Credentials by ");
+        out_str(s->out, key);
+        out_char(s->out, '\n');
+    } else if (s->opts->format == PRINT_JSON) {
+        out_lit(s->out, "{\"count_by\":\"");
+        out_str(s->out, key);
+        out_lit(s->out, "\",\"counts\":[");
+    }
+    for (i = 0; i < n; i++) {
+        if (s->opts->format == PRINT_TEXT) {
+            char num[32];
+
+            out_mem(s->out, num, snprintf(num, sizeof(num), "%10llu  ", (unsigned long long) totals[i].count));
+            out_mem(s->out, totals[i].name, totals[i].length);
+            out_char(s->out, '\n');
+            continue;
+        }
+        if (s->opts->format == PRINT_JSON && i) {
+            out_char(s->out, ',');
+        }
+        out_lit(s->out, "{\"");
+        out_str(s->out, key);
+        out_lit(s->out, "\":");
+        out_json_str(s->out, totals[i].name, totals[i].length);
+        out_lit(s->out, ",\"count\":");
+        out_u64(s->out, totals[i].count);
+        out_char(s->out, '}');
+        if (s->opts->format == PRINT_NDJSON) {
+            out_char(s->out, '\n');
+        }
+    }
+    if (s->opts->format == PRINT_JSON) {
+        out_lit(s->out, "]}\n");
+    }
+    free(totals);
+    out_free(&names);
+    return 0;
+}
+
+void scan_free(struct scan *s) {
+    size_t i;
+
+    for (i = 0; i < s->count; i++) {
+        free(s->files[i].path);
+    }
+    free(s->files);
+    for (i = 0; s->counts && i < (size_t) s->nworkers; i++) {
+        cc_names_free(&s->counts[i].names);
+        free(s->counts[i].counts);
+    }
+    free(s->counts);
+    pthread_mutex_destroy(&s->out_lock);
+}
@@ -0,0 +1,58 @@
+#ifndef SCAN_H_INCLUDED
+#define SCAN_H_INCLUDED
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "out.h"
+#include "print.h"
+#include "intern.h"
+
+/* A file to scan. Files found by listing a directory are not reported when
+ * they turn out not to be ccaches.
+ */
+struct scan_file {
+    char *path;
+    int discovered;
+};
+
+/* What the credentials are counted by, instead of being printed */
+#define SCAN_COUNT_NONE                 0
+#define SCAN_COUNT_SERVER               1
+#define SCAN_COUNT_CLIENT               2
+#define SCAN_COUNT_REALM                3       /* of the server */
+
+/* Credentials counted by one thread, by ID of the interned principal or realm.
+ * The tables of the threads are merged at the end.
+ */
+struct scan_counts {
+    struct cc_names names;
+    uint64_t *counts;
+    uint32_t size;
+};
+
+/* Set of ccaches parsed in parallel. Each file is printed to its own buffer
+ * and copied to the output in one go, so the files don't interleave.
+ */
+struct scan {
+    struct scan_file *files;
+    size_t count;
+    size_t size;
+    struct outbuf *out;
+    const struct print_options *opts;
+    pthread_mutex_t out_lock;
+    int failures;
+    int count_by;               /* SCAN_COUNT_* */
+    struct scan_counts *counts; /* per thread */
+    int nworkers;
+    int io;                     /* LOAD_*: how the files are read, io_uring by default */
+};
+
+void scan_init(struct scan *s, struct outbuf *out, const struct print_options *opts);
+int scan_add_file(struct scan *s, const char *path, int discovered);
+int scan_add_path(struct scan *s, const char *path);
+int scan_add_list(struct scan *s, FILE *in);
+int scan_run(struct scan *s, int nthreads);
+int scan_print_counts(struct scan *s);
+void scan_free(struct scan *s);
+#endif
@@ -0,0 +1,637 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "data.h"
+#include "io.h"
+#include "parser.h"
+#include "intern.h"
+#include "snap.h"
+
+static int section_ok(const struct snap *s, uint64_t offset, uint64_t count, size_t width) {
+    return offset % SNAP_ALIGN == 0 && offset <= s->size && count <= (s->size - offset) / width;
+}
+
+/* Map a snapshot and check that its sections are aligned and inside the
+ * file, which doesn't depend on its size: the records and strings are only
+ * checked as they are used. The structures are used in place, which needs a
+ * little-endian host.
+ */
+int snap_open(struct snap *s, const char *path) {
+    const struct snap_header *h;
+    struct stat st;
+    void *map;
+    int fd;
+
+    memset(s, 0, sizeof(*s));
+    if (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__) {
+        return CC_ERR_VERSION;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return CC_ERR_IO;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return CC_ERR_IO;
+    }
+    if ((uint64_t) st.st_size < sizeof(struct snap_header)) {
+        close(fd);
+        return CC_ERR_TRUNCATED;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return CC_ERR_IO;
+    }
+    s->map = map;
+    s->size = st.st_size;
+    h = s->header = map;
+
+    if (memcmp(h->magic, SNAP_MAGIC, sizeof(h->magic))) {
+        snap_close(s);
+        return CC_ERR_NOT_CCACHE;
+    }
+    if (h->version != SNAP_VERSION) {
+        snap_close(s);
+        return CC_ERR_VERSION;
+    }
+    if (!h->buckets || (h->buckets & (h->buckets - 1))) {
+        snap_close(s);
+        return CC_ERR_INVALID;
+    }
+    if (!section_ok(s, h->files_offset, h->files, sizeof(struct snap_file)) ||
+        !section_ok(s, h->records_offset, h->records, sizeof(struct snap_record)) ||
+        !section_ok(s, h->strings_offset, h->strings, sizeof(struct snap_string)) ||
+        !section_ok(s, h->blob_offset, h->blob_size, 1) ||
+        !section_ok(s, h->buckets_offset, h->buckets, sizeof(uint32_t))) {
+        snap_close(s);
+        return CC_ERR_TRUNCATED;
+    }
+    s->files = (const struct snap_file *) (s->map + h->files_offset);
+    s->records = (const struct snap_record *) (s->map + h->records_offset);
+    s->strings = (const struct snap_string *) (s->map + h->strings_offset);
+    s->blob = (const char *) (s->map + h->blob_offset);
+    s->buckets = (const uint32_t *) (s->map + h->buckets_offset);
+    return CC_OK;
+}
+
+/* A string of the snapshot, pointing in the mapping (not NUL terminated).
+ * Returns CC_ERR_INVALID if it isn't inside the blob.
+ */
+int snap_string(const struct snap *s, uint32_t id, const char **value, uint32_t *length) {
+    const struct snap_string *str;
+
+    if (id >= s->header->strings) {
+        return CC_ERR_INVALID;
+    }
+    str = &s->strings[id];
+    if (str->offset > s->header->blob_size || str->length > s->header->blob_size - str->offset) {
+        return CC_ERR_INVALID;
+    }
+    *value = s->blob + str->offset;
+    *length = str->length;
+    return CC_OK;
+}
+
+/* The records of a server principal, as printed: [*first, *first + *count),
+ * newest first for each client. A hash probe and a walk of the records found,
+ * without decoding anything.
+ * Returns CC_OK, CC_ERR_NOT_FOUND, or CC_ERR_INVALID for a broken index.
+ */
+int snap_lookup(const struct snap *s, const char *server, size_t length, uint64_t *first, uint64_t *count) {
+    const struct snap_header *h = s->header;
+    uint32_t hash, mask = h->buckets - 1;
+    uint32_t i, bucket, id, slength;
+    const char *value;
+    uint64_t n;
+
+    if (length > UINT32_MAX) {
+        return CC_ERR_NOT_FOUND;
+    }
+    hash = cc_intern_hash(server, length);
+    for (i = 0; i <= mask; i++) {
+        bucket = s->buckets[(hash + i) & mask];
+        if (bucket == SNAP_EMPTY) {
+            return CC_ERR_NOT_FOUND;
+        }
+        if (bucket >= h->records) {
+            return CC_ERR_INVALID;
+        }
+        id = s->records[bucket].server;
+        if (snap_string(s, id, &value, &slength) < 0) {
+            return CC_ERR_INVALID;
+        }
+        if (s->strings[id].hash != hash || slength != length || memcmp(value, server, length)) {
+            continue;
+        }
+        for (n = bucket + 1; n < h->records && s->records[n].server == id; n++)
+            ;
+        *first = bucket;
+        *count = n - bucket;
+        return CC_OK;
+    }
+    return CC_ERR_NOT_FOUND;
+}
+
+void snap_close(struct snap *s) {
+    if (s->map) {
+        munmap((void *) s->map, s->size);
+    }
+    memset(s, 0, sizeof(*s));
+}
+
+static int builder_fail(struct snap_builder *b, int err, const char *where) {
+    b->where = where;
+    if (err == CC_ERR_IO) {
+        b->sys_errno = errno;
+    }
+    return err;
+}
+
+/* Start a snapshot. The records of old are grouped by file, for the files
+ * to be taken from it as they are added.
+ */
+int snap_builder_init(struct snap_builder *b, const struct snap *old) {
+    const struct snap_header *h;
+    const char *value;
+    uint32_t f, id, length;
+    uint64_t i;
+
+    memset(b, 0, sizeof(*b));
+    cc_intern_init(&b->strings);
+    cc_intern_init(&b->paths);
+    cc_intern_init(&b->old_paths);
+    if (!old) {
+        return CC_OK;
+    }
+    h = old->header;
+    if (h->records >= SNAP_EMPTY) {
+        return CC_OK;
+    }
+    b->old_file = malloc((h->files + 1) * sizeof(uint32_t));
+    b->old_first = calloc(h->files + 2, sizeof(uint32_t));
+    b->old_order = malloc((h->records + 1) * sizeof(uint32_t));
+    if (!b->old_file || !b->old_first || !b->old_order) {
+        return builder_fail(b, CC_ERR_NOMEM, "snapshot");
+    }
+    for (f = 0; f < h->files; f++) {
+        if (snap_string(old, old->files[f].path, &value, &length) < 0 ||
+            cc_intern(&b->old_paths, value, length, &id) < 0) {
+            continue;
+        }
+        b->old_file[id] = f;
+    }
+    // A counting sort, the records of a file in their order
+    for (i = 0; i < h->records; i++) {
+        if (old->records[i].file < h->files) {
+            b->old_first[old->records[i].file + 2]++;
+        }
+    }
+    for (f = 0; f < h->files; f++) {
+        b->old_first[f + 2] += b->old_first[f + 1];
+    }
+    for (i = 0; i < h->records; i++) {
+        if (old->records[i].file < h->files) {
+            b->old_order[b->old_first[old->records[i].file + 1]++] = i;
+        }
+    }
+    b->old = old;
+    return CC_OK;
+}
+
+static int add_record(struct snap_builder *b, const struct snap_record *rec) {
+    if (b->nrecords == b->records_size) {
+        size_t size = b->records_size ? b->records_size * 2 : 1024;
+        struct snap_record *records;
+
+        if (size >= SNAP_EMPTY) {
+            return CC_ERR_NOMEM;
+        }
+        records = realloc(b->records, size * sizeof(struct snap_record));
+        if (!records) {
+            return CC_ERR_NOMEM;
+        }
+        b->records = records;
+        b->records_size = size;
+    }
+    b->records[b->nrecords++] = *rec;
+    return CC_OK;
+}
+
+// Intern a principal as printed by print_principal()
+static int principal_name(struct snap_builder *b, const struct principal *princ, uint32_t *id) {
+    size_t length = princ->realm.length + 1;
+    uint32_t i;
+    char *p;
+
+    for (i = 0; i < princ->comp_count; i++) {
+        length += princ->components[i].length + (i ? 1 : 0);
+    }
+    if (length > b->name_size) {
+        char *name = realloc(b->name, length);
+
+        if (!name) {
+            return CC_ERR_NOMEM;
+        }
+        b->name = name;
+        b->name_size = length;
+    }
+    p = b->name;
+    for (i = 0; i < princ->comp_count; i++) {
+        if (i) {
+            *p++ = '/';
+        }
+        memcpy(p, princ->components[i].value, princ->components[i].length);
+        p += princ->components[i].length;
+    }
+    *p++ = '@';
+    memcpy(p, princ->realm.value, princ->realm.length);
+    return cc_intern(&b->strings, b->name, length, id);
+}
+
+/* Copy the records of an unchanged file from the old snapshot.
+ * Returns CC_ERR_NOT_FOUND if there are none to take.
+ */
+static int reuse_file(struct snap_builder *b, const char *path, const struct stat *st, uint32_t file) {
+    const struct snap_file *f;
+    struct snap_record rec;
+    const char *value;
+    uint32_t id, length, i;
+    int rc;
+
+    if (!b->old || cc_intern_find(&b->old_paths, path, strlen(path), &id) < 0) {
+        return CC_ERR_NOT_FOUND;
+    }
+    f = &b->old->files[b->old_file[id]];
+    if (f->size != (uint64_t) st->st_size || f->dev != st->st_dev || f->ino != st->st_ino ||
+        f->mtime_sec != st->st_mtim.tv_sec || f->mtime_nsec != st->st_mtim.tv_nsec ||
+        f->records != b->old_first[b->old_file[id] + 1] - b->old_first[b->old_file[id]]) {
+        return CC_ERR_NOT_FOUND;
+    }
+    for (i = b->old_first[b->old_file[id]]; i < b->old_first[b->old_file[id] + 1]; i++) {
+        rec = b->old->records[b->old_order[i]];
+        rc = snap_string(b->old, rec.server, &value, &length);
+        if (rc == CC_OK) {
+            rc = cc_intern(&b->strings, value, length, &rec.server);
+        }
+        if (rc == CC_OK) {
+            rc = snap_string(b->old, rec.client, &value, &length);
+        }
+        if (rc == CC_OK) {
+            rc = cc_intern(&b->strings, value, length, &rec.client);
+        }
+        if (rc < 0) {
+            // A broken snapshot is read from the file instead
+            return rc == CC_ERR_INVALID ? CC_ERR_NOT_FOUND : rc;
+        }
+        rec.file = file;
+        rc = add_record(b, &rec);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    return CC_OK;
+}
+
+// Decode the credentials of a file in summary mode, noting where they are
+static int parse_file(struct snap_builder *b, const char *path, struct stat *st, uint32_t file) {
+    struct snap_record rec;
+    struct credential *cred;
+    struct ccache *cc;
+    int rc;
+
+    rc = cc_open(&cc, path);
+    if (rc < 0) {
+        b->where = cc ? cc->where : "open";
+        b->sys_errno = cc ? cc->sys_errno : errno;
+        cc_close(cc);
+        return rc;
+    }
+    if (!reader_is_mapped(&cc->reader) || fstat(cc->reader.fd, st) < 0) {
+        cc_close(cc);
+        return builder_fail(b, CC_ERR_NOT_SEEKABLE, "open");
+    }
+    memset(&rec, 0, sizeof(rec));
+    rec.file = file;
+    cc_set_summary(cc, 1);
+    while ((rc = cc_next(cc, &cred)) == CC_OK) {
+        rc = principal_name(b, &cred->server, &rec.server);
+        if (rc == CC_OK) {
+            rc = principal_name(b, &cred->client, &rec.client);
+        }
+        if (rc == CC_OK) {
+            rec.endtime = cred->endtime;
+            rec.flags = cred->ticket_flags;
+            rec.offset = cc->cred_offset;
+            rc = add_record(b, &rec);
+        }
+        if (rc < 0) {
+            break;
+        }
+    }
+    if (rc < 0) {
+        b->where = cc->where ? cc->where : "snapshot";
+        b->sys_errno = cc->sys_errno;
+    }
+    cc_close(cc);
+    return rc < 0 ? rc : CC_OK;
+}
+
+static int builder_add(struct snap_builder *b, const char *path) {
+    struct snap_file *f;
+    struct stat st;
+    size_t nrecords = b->nrecords;
+    uint32_t seen = b->paths.count, id;
+    int rc;
+
+    rc = cc_intern(&b->paths, path, strlen(path), &id);
+    if (rc < 0) {
+        return builder_fail(b, rc, "snapshot");
+    }
+    if (b->paths.count == seen) {
+        return CC_OK;
+    }
+    if (b->nfiles == b->files_size) {
+        uint32_t size = b->files_size ? b->files_size * 2 : 64;
+        struct snap_file *files = realloc(b->files, size * sizeof(struct snap_file));
+
+        if (!files) {
+            return builder_fail(b, CC_ERR_NOMEM, "snapshot");
+        }
+        b->files = files;
+        b->files_size = size;
+    }
+    if (stat(path, &st) < 0) {
+        return builder_fail(b, CC_ERR_IO, "open");
+    }
+
+    rc = reuse_file(b, path, &st, b->nfiles);
+    if (rc == CC_OK) {
+        b->reused++;
+    } else if (rc == CC_ERR_NOT_FOUND) {
+        b->nrecords = nrecords;
+        rc = parse_file(b, path, &st, b->nfiles);
+        if (rc == CC_OK) {
+            b->parsed++;
+        }
+    } else {
+        builder_fail(b, rc, "snapshot");
+    }
+    if (rc < 0) {
+        b->nrecords = nrecords;
+        return rc;
+    }
+
+    f = &b->files[b->nfiles];
+    memset(f, 0, sizeof(*f));
+    rc = cc_intern(&b->strings, path, strlen(path), &f->path);
+    if (rc < 0) {
+        b->nrecords = nrecords;
+        return builder_fail(b, rc, "snapshot");
+    }
+    f->records = b->nrecords - nrecords;
+    f->size = st.st_size;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->mtime_sec = st.st_mtim.tv_sec;
+    f->mtime_nsec = st.st_mtim.tv_nsec;
+    b->nfiles++;
+    return CC_OK;
+}
+
+/* Add the credentials of a ccache to the snapshot, from the old snapshot if
+ * the file has the same mtime, size and inode as then. The file is known by
+ * its absolute path, and taken once. Returns CC_OK, or a CC_ERR_* code with
+ * b->where set; the file is then left out, with no records.
+ */
+int snap_builder_add(struct snap_builder *b, const char *path) {
+    char *absolute = realpath(path, NULL);
+    int rc;
+
+    if (!absolute) {
+        return builder_fail(b, errno == ENOMEM ? CC_ERR_NOMEM : CC_ERR_IO, "open");
+    }
+    rc = builder_add(b, absolute);
+    free(absolute);
+    return rc;
+}
+
+struct sort_entry {
+    const struct data *server;
+    const struct data *client;
+    uint32_t server_id;
+    uint32_t client_id;
+    uint32_t endtime;
+    uint32_t index;
+};
+
+static int compare_data(const struct data *a, const struct data *b) {
+    int c = memcmp(a->value, b->value, a->length < b->length ? a->length : b->length);
+
+    if (c) {
+        return c;
+    }
+    return a->length < b->length ? -1 : a->length > b->length;
+}
+
+// By server, client, endtime from the newest, then in the order added
+static int compare_records(const void *a, const void *b) {
+    const struct sort_entry *x = a, *y = b;
+    int c;
+
+    if (x->server_id != y->server_id && (c = compare_data(x->server, y->server))) {
+        return c;
+    }
+    if (x->client_id != y->client_id && (c = compare_data(x->client, y->client))) {
+        return c;
+    }
+    if (x->endtime != y->endtime) {
+        return x->endtime > y->endtime ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static uint64_t align_section(uint64_t offset) {
+    return (offset + SNAP_ALIGN - 1) & ~(uint64_t) (SNAP_ALIGN - 1);
+}
+
+static void write_padding(struct writer *w) {
+    static const uint8_t zeros[SNAP_ALIGN];
+
+    writer_write(w, zeros, align_section(w->offset) - w->offset);
+}
+
+/* Sort the records and write the snapshot through w, in the layout of
+ * snap.h. The structures are written as they are read, in place.
+ */
+static int write_snapshot(struct snap_builder *b, struct writer *w) {
+    struct snap_header h;
+    struct sort_entry *order;
+    struct snap_string str;
+    uint32_t *buckets, i, mask, distinct = 0;
+    uint64_t offset;
+    size_t n;
+
+    order = malloc((b->nrecords + 1) * sizeof(struct sort_entry));
+    if (!order) {
+        return CC_ERR_NOMEM;
+    }
+    for (n = 0; n < b->nrecords; n++) {
+        order[n].server_id = b->records[n].server;
+        order[n].client_id = b->records[n].client;
+        order[n].server = cc_intern_get(&b->strings, order[n].server_id);
+        order[n].client = cc_intern_get(&b->strings, order[n].client_id);
+        order[n].endtime = b->records[n].endtime;
+        order[n].index = n;
+        if (!n || b->records[n].server != b->records[n - 1].server) {
+            distinct++;
+        }
+    }
+    qsort(order, b->nrecords, sizeof(struct sort_entry), compare_records);
+
+    // At most half full, with a bucket per server (a bound, before sorting)
+    for (mask = SNAP_MIN_BUCKETS - 1; mask / 2 < distinct; mask = mask * 2 + 1)
+        ;
+    buckets = malloc((mask + 1) * sizeof(uint32_t));
+    if (!buckets) {
+        free(order);
+        return CC_ERR_NOMEM;
+    }
+    memset(buckets, 0xff, (mask + 1) * sizeof(uint32_t));
+    for (n = 0; n < b->nrecords; n++) {
+        if (n && order[n].server_id == order[n - 1].server_id) {
+            continue;
+        }
+        for (i = b->strings.hashes[order[n].server_id] & mask; buckets[i] != SNAP_EMPTY; i = (i + 1) & mask)
+            ;
+        buckets[i] = n;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+    h.version = SNAP_VERSION;
+    h.files = b->nfiles;
+    h.records = b->nrecords;
+    h.strings = b->strings.count;
+    h.buckets = mask + 1;
+    h.created = time(NULL);
+    for (i = 0; i < b->strings.count; i++) {
+        h.blob_size += b->strings.strings[i].length;
+    }
+    h.files_offset = align_section(sizeof(h));
+    h.records_offset = align_section(h.files_offset + h.files * sizeof(struct snap_file));
+    h.strings_offset = align_section(h.records_offset + h.records * sizeof(struct snap_record));
+    h.blob_offset = align_section(h.strings_offset + h.strings * sizeof(struct snap_string));
+    h.buckets_offset = align_section(h.blob_offset + h.blob_size);
+
+    writer_write(w, &h, sizeof(h));
+    write_padding(w);
+    writer_write(w, b->files, b->nfiles * sizeof(struct snap_file));
+    write_padding(w);
+    for (n = 0; n < b->nrecords; n++) {
+        writer_write(w, &b->records[order[n].index], sizeof(struct snap_record));
+    }
+    write_padding(w);
+    offset = 0;
+    for (i = 0; i < b->strings.count; i++) {
+        str.offset = offset;
+        str.length = b->strings.strings[i].length;
+        str.hash = b->strings.hashes[i];
+        writer_write(w, &str, sizeof(str));
+        offset += str.length;
+    }
+    write_padding(w);
+    for (i = 0; i < b->strings.count; i++) {
+        writer_write(w, b->strings.strings[i].value, b->strings.strings[i].length);
+    }
+    write_padding(w);
+    writer_write(w, buckets, (mask + 1) * sizeof(uint32_t));
+    free(buckets);
+    free(order);
+    return CC_OK;
+}
+
+/* Write the snapshot next to path, then rename it over path: the readers
+ * still mapping the one before keep it until they close it.
+ * Returns CC_OK or a CC_ERR_* code, with b->where set.
+ */
+int snap_builder_write(struct snap_builder *b, const char *path) {
+    struct writer w;
+    struct stat st;
+    char *tmp;
+    int fd, rc;
+
+    if (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__) {
+        return builder_fail(b, CC_ERR_VERSION, "write");
+    }
+    tmp = malloc(strlen(path) + sizeof(".XXXXXX"));
+    if (!tmp) {
+        return builder_fail(b, CC_ERR_NOMEM, "write");
+    }
+    sprintf(tmp, "%s.XXXXXX", path);
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        free(tmp);
+        return builder_fail(b, CC_ERR_IO, "create");
+    }
+    if (writer_init(&w, fd, 0) < 0) {
+        rc = builder_fail(b, CC_ERR_NOMEM, "write");
+        goto out;
+    }
+    rc = write_snapshot(b, &w);
+    if (rc < 0) {
+        builder_fail(b, rc, "write");
+        goto out;
+    }
+    if (writer_flush(&w) < 0) {
+        rc = builder_fail(b, CC_ERR_IO, "write");
+        goto out;
+    }
+    /* It tells who holds a ticket for what, and where the ccaches are: only
+     * the owner reads a new one. An administrator who widened the one before
+     * keeps that mode.
+     */
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && fchmod(fd, st.st_mode & 0777) < 0) {
+        rc = builder_fail(b, CC_ERR_IO, "chmod");
+        goto out;
+    }
+    if (fsync(fd) < 0) {
+        rc = builder_fail(b, CC_ERR_IO, "write");
+        goto out;
+    }
+    if (rename(tmp, path) < 0) {
+        rc = builder_fail(b, CC_ERR_IO, "rename");
+    }
+
+out:
+    if (w.buf) {
+        writer_free(&w);
+    }
+    close(fd);
+    if (rc < 0) {
+        unlink(tmp);
+    }
+    free(tmp);
+    return rc;
+}
+
+void snap_builder_free(struct snap_builder *b) {
+    cc_intern_free(&b->strings);
+    cc_intern_free(&b->paths);
+    cc_intern_free(&b->old_paths);
+    free(b->files);
+    free(b->records);
+    free(b->old_file);
+    free(b->old_first);
+    free(b->old_order);
+    free(b->name);
+}
@@ -0,0 +1,124 @@
+#ifndef SNAP_H_INCLUDED
+#define SNAP_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "intern.h"
+
+/* Snapshot of the credentials of many ccaches (cccache --snapshot), laid out
+ * to be mapped and queried in place:
+ *
+ *   header         struct snap_header, at offset 0
+ *   files          header.files struct snap_file, the ccaches read
+ *   records        header.records struct snap_record, sorted by server, then
+ *                  client, then endtime from the newest
+ *   strings        header.strings struct snap_string: the principals as
+ *                  printed, and the file names
+ *   blob           the bytes of the strings, end to end
+ *   buckets        header.buckets uint32_t, a power of two: open addressing on
+ *                  the hash of the server (see cc_intern_hash()), with linear
+ *                  probing. A bucket holds the first record of a server, or
+ *                  SNAP_EMPTY; the records of a server follow each other.
+ *
+ * Every section starts at a multiple of SNAP_ALIGN, and the integers are
+ * little-endian. The files remember the mtime, size and inode they were read
+ * at, so that an update only reads again the ccaches that changed.
+ */
+
+#define SNAP_MAGIC                      "CCSNAPSH"
+#define SNAP_VERSION                    1
+#define SNAP_ALIGN                      64
+#define SNAP_EMPTY                      UINT32_MAX
+#define SNAP_MIN_BUCKETS                16
+
+struct snap_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t files;
+    uint64_t records;
+    uint32_t strings;
+    uint32_t buckets;
+    uint64_t blob_size;
+    int64_t created;            /* seconds since the epoch */
+    uint64_t files_offset;
+    uint64_t records_offset;
+    uint64_t strings_offset;
+    uint64_t blob_offset;
+    uint64_t buckets_offset;
+    uint8_t reserved[40];
+};
+
+struct snap_file {
+    uint32_t path;              /* string */
+    uint32_t records;
+    uint64_t size;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+struct snap_record {
+    uint32_t server;            /* string */
+    uint32_t client;            /* string */
+    uint32_t endtime;
+    uint32_t flags;             /* ticket flags */
+    uint32_t file;
+    uint32_t reserved;
+    uint64_t offset;            /* of the credential in the file, see cc_resume() */
+};
+
+struct snap_string {
+    uint64_t offset;            /* in the blob */
+    uint32_t length;
+    uint32_t hash;
+};
+
+/* A mapped snapshot */
+struct snap {
+    const uint8_t *map;
+    size_t size;
+    const struct snap_header *header;
+    const struct snap_file *files;
+    const struct snap_record *records;
+    const struct snap_string *strings;
+    const char *blob;
+    const uint32_t *buckets;
+};
+
+/* A snapshot being written. The ccaches that haven't changed since an older
+ * snapshot get their records from it, the others are decoded in summary mode.
+ */
+struct snap_builder {
+    struct cc_intern strings;
+    struct cc_intern paths;     /* the files added, to take each once */
+    struct snap_file *files;
+    uint32_t nfiles;
+    uint32_t files_size;
+    struct snap_record *records;
+    size_t nrecords;
+    size_t records_size;
+    const struct snap *old;     /* NULL if there is none */
+    struct cc_intern old_paths;
+    uint32_t *old_file;         /* by ID in old_paths: the file of old */
+    uint32_t *old_first;        /* by file of old: its first entry in old_order */
+    uint32_t *old_order;        /* the records of old, grouped by file */
+    char *name;                 /* a principal being printed */
+    size_t name_size;
+    uint32_t parsed;            /* files decoded */
+    uint32_t reused;            /* files taken from old */
+    const char *where;          /* what failed: "open", "decode", "write", "rename"... */
+    int sys_errno;              /* for CC_ERR_IO */
+};
+
+int snap_open(struct snap *s, const char *path);
+int snap_string(const struct snap *s, uint32_t id, const char **value, uint32_t *length);
+int snap_lookup(const struct snap *s, const char *server, size_t length, uint64_t *first, uint64_t *count);
+void snap_close(struct snap *s);
+
+int snap_builder_init(struct snap_builder *b, const struct snap *old);
+int snap_builder_add(struct snap_builder *b, const char *path);
+int snap_builder_write(struct snap_builder *b, const char *path);
+void snap_builder_free(struct snap_builder *b);
+#endif
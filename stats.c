@@ -0,0 +1,33 @@
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include "stats.h"
+
+#if ENABLE_STATS
+int stats_enabled;
+struct cc_stats cc_stats;
+#endif
+
+/* Start collecting. Called before the parsing starts, as the counters are not
+ * protected by anything else than their atomic updates.
+ */
+void stats_enable(void) {
+#if ENABLE_STATS
+    stats_enabled = 1;
+#endif
+}
+
+/* What was collected so far, all zero if the statistics are not built in */
+void stats_get(struct cc_stats *stats) {
+#if ENABLE_STATS
+    uint64_t *dst = (uint64_t *) stats;
+    uint64_t *src = (uint64_t *) &cc_stats;
+    size_t i;
+
+    for (i = 0; i < sizeof(*stats) / sizeof(uint64_t); i++) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
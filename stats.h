@@ -0,0 +1,81 @@
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include <stdint.h>
+#include <time.h>
+
+/* Counters and timers of the phases of the parsing, for --stats. Built in
+ * unless ENABLE_STATS is defined to 0, and collected only once stats_enable()
+ * has been called: until then each of them costs a test of a global.
+ */
+#ifndef ENABLE_STATS
+#define ENABLE_STATS                    1
+#endif
+
+/* name, unit, description. The times are in nanoseconds, summed over the
+ * threads.
+ */
+#define CC_STATS(X) \
+    X(files,            "",     "ccaches opened") \
+    X(bytes_mapped,     "B",    "bytes mapped") \
+    X(bytes_read,       "B",    "bytes read from streams") \
+    X(bytes_loaded,     "B",    "bytes loaded in memory rather than mapped") \
+    X(credentials,      "",     "credentials decoded") \
+    X(skipped,          "",     "credentials skipped by a filter") \
+    X(principals,       "",     "principals decoded") \
+    X(allocs,           "",     "arena allocations") \
+    X(arena_blocks,     "",     "arena blocks allocated") \
+    X(bytes_copied,     "B",    "bytes copied by check_data") \
+    X(bytes_written,    "B",    "bytes of output written") \
+    X(io_ns,            "ns",   "opening, mapping and reading files") \
+    X(header_ns,        "ns",   "decoding headers and default principals") \
+    X(credential_ns,    "ns",   "decoding credentials") \
+    X(principal_ns,     "ns",   "decoding principals (part of credentials)") \
+    X(time_format_ns,   "ns",   "formatting times") \
+    X(flags_ns,         "ns",   "rendering flags") \
+    X(print_ns,         "ns",   "printing credentials (times and flags included)") \
+    X(write_ns,         "ns",   "writing the output")
+
+#define CC_STATS_FIELD(name, unit, desc) uint64_t name;
+struct cc_stats {
+    CC_STATS(CC_STATS_FIELD)
+};
+#undef CC_STATS_FIELD
+
+void stats_enable(void);
+void stats_get(struct cc_stats *stats);
+
+#if ENABLE_STATS
+extern int stats_enabled;
+extern struct cc_stats cc_stats;
+
+static inline uint64_t stats_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define STATS_ADD(counter, n) \
+do \
+    { \
+        if (stats_enabled) \
+            __atomic_fetch_add(&cc_stats.counter, (n), __ATOMIC_RELAXED); \
+    } \
+while (0)
+#define STATS_START(timer) \
+    uint64_t timer = stats_enabled ? stats_now() : 0
+#define STATS_STOP(timer, counter) \
+    STATS_ADD(counter, stats_now() - timer)
+#else
+#define STATS_ADD(counter, n) \
+do ;\
+while (0)
+#define STATS_START(timer) \
+do ;\
+while (0)
+#define STATS_STOP(timer, counter) \
+do ;\
+while (0)
+#endif
+#endif
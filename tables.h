@@ -0,0 +1,46 @@
+#ifndef TABLES_H_INCLUDED
+#define TABLES_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Lookup tables generated at build time by mktables (see names.h) */
+
+struct name_entry {
+    uint8_t len;
+    const char *str;
+};
+
+/* For each byte of the ticket flags, the names of the flags set in it,
+ * every one followed by '|'.
+ */
+extern const struct name_entry flag_table[4][256];
+
+#define ENCTYPE_MAX                     26
+#define NAME_TYPE_MAX                   12
+#define ADDRTYPE_MAX                    24
+
+extern const struct name_entry enctype_table[ENCTYPE_MAX + 1];
+extern const struct name_entry name_type_table[NAME_TYPE_MAX + 1];
+extern const struct name_entry addrtype_table[ADDRTYPE_MAX + 1];
+
+/* Longest output of flag_render() */
+#define FLAG_RENDER_MAX                 256
+
+size_t flag_render(char *buf, uint32_t flags);
+
+/* Name of a value, NULL (and *len 0) if it is not known */
+static inline const char *table_lookup(const struct name_entry *table, uint32_t max,
+                                       uint32_t value, size_t *len) {
+    if (value > max || !table[value].str) {
+        *len = 0;
+        return NULL;
+    }
+    *len = table[value].len;
+    return table[value].str;
+}
+
+#define enctype_name(v, len)    table_lookup(enctype_table, ENCTYPE_MAX, v, len)
+#define name_type_name(v, len)  table_lookup(name_type_table, NAME_TYPE_MAX, v, len)
+#define addrtype_name(v, len)   table_lookup(addrtype_table, ADDRTYPE_MAX, v, len)
+#endif
@@ -0,0 +1,148 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "timefmt.h"
+#include "stats.h"
+
+static __thread struct time_cache cache;
+
+static void two_digits(char *buf, unsigned value) {
+    buf[0] = '0' + value / 10;
+    buf[1] = '0' + value % 10;
+}
+
+// HH:MM:SS
+static void time_of_day(char *buf, unsigned seconds) {
+    two_digits(buf, seconds / 3600);
+    buf[2] = ':';
+    two_digits(buf + 3, seconds / 60 % 60);
+    buf[5] = ':';
+    two_digits(buf + 6, seconds % 60);
+}
+
+// Turn days since the epoch in a civil date (proleptic Gregorian calendar)
+static void civil_from_days(int64_t days, int64_t *year, unsigned *month, unsigned *day) {
+    int64_t era, yoe, doy, mp;
+
+    days += 719468;
+    era = (days >= 0 ? days : days - 146096) / 146097;
+    yoe = days - era * 146097;
+    yoe = (yoe - yoe / 1460 + yoe / 36524 - yoe / 146096) / 365;
+    doy = days - era * 146097 - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = yoe + era * 400 + (*month <= 2);
+}
+
+// ISO 8601 in UTC, computed without going through libc
+static size_t format_utc(char *buf, uint32_t time) {
+    int64_t year;
+    unsigned month, day;
+
+    civil_from_days(time / 86400, &year, &month, &day);
+    two_digits(buf, year / 100);
+    two_digits(buf + 2, year % 100);
+    buf[4] = '-';
+    two_digits(buf + 5, month);
+    buf[7] = '-';
+    two_digits(buf + 8, day);
+    buf[10] = 'T';
+    time_of_day(buf + 11, time % 86400);
+    buf[19] = 'Z';
+    return 20;
+}
+
+// Look up the local day of a time, with libc, and remember it if the whole
+// day has the same offset from UTC
+static void load_day(time_t t, const struct tm *tm) {
+    struct time_day *day = &cache.day;
+    struct tm first, last;
+    time_t start;
+
+    cache.valid = 0;
+    start = t - (tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec);
+    if (!localtime_r(&start, &first) || !localtime_r(&(time_t){ start + 86399 }, &last)) {
+        return;
+    }
+    if (first.tm_gmtoff != tm->tm_gmtoff || last.tm_gmtoff != tm->tm_gmtoff ||
+        first.tm_hour || first.tm_min || first.tm_sec || last.tm_mday != tm->tm_mday) {
+        return;
+    }
+    day->start = start;
+    day->end = start + 86400;
+    day->prefix_len = strftime(day->prefix, sizeof(day->prefix), "%a %Y-%m-%d ", tm);
+    day->suffix_len = strftime(day->suffix, sizeof(day->suffix), " %Z", tm);
+    cache.valid = day->prefix_len && day->suffix_len;
+}
+
+// "%a %Y-%m-%d %H:%M:%S %Z" in the local time zone
+static size_t format_local(char *buf, uint32_t time) {
+    struct time_day *day = &cache.day;
+    struct time_memo *memo;
+    struct tm tm;
+    time_t t = time;
+    size_t len;
+
+    memo = &cache.memo[(time * 2654435761u) >> 29];
+    if (memo->len && memo->time == time) {
+        memcpy(buf, memo->str, memo->len);
+        return memo->len;
+    }
+
+    if (!cache.valid || t < day->start || t >= day->end) {
+        if (!localtime_r(&t, &tm)) {
+            return 0;
+        }
+        load_day(t, &tm);
+        if (!cache.valid) {
+            // A day with a DST change: no shortcut
+            return strftime(buf, TIME_BUFSIZE, "%a %Y-%m-%d %H:%M:%S %Z", &tm);
+        }
+    }
+    memcpy(buf, day->prefix, day->prefix_len);
+    len = day->prefix_len;
+    time_of_day(buf + len, t - day->start);
+    len += 8;
+    memcpy(buf + len, day->suffix, day->suffix_len);
+    len += day->suffix_len;
+
+    memo->time = time;
+    memo->len = len;
+    memcpy(memo->str, buf, len);
+    return len;
+}
+
+static size_t format_time(char *buf, uint32_t time, int mode) {
+    uint32_t value = time;
+    size_t len = 0;
+    char digits[10];
+    int n = sizeof(digits);
+
+    switch (mode) {
+    case TIMEFMT_UTC:
+        return format_utc(buf, time);
+    case TIMEFMT_LOCAL:
+        return format_local(buf, time);
+    }
+    do {
+        digits[--n] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    len = sizeof(digits) - n;
+    memcpy(buf, digits + n, len);
+    return len;
+}
+
+/* Format a time in buf, which must hold TIME_BUFSIZE bytes. The result is not
+ * NUL terminated: its length is returned. Safe to call from any thread.
+ */
+size_t time_format(char *buf, uint32_t time, int mode) {
+    size_t len;
+    STATS_START(start);
+
+    len = format_time(buf, time, mode);
+    STATS_STOP(start, time_format_ns);
+    return len;
+}
@@ -0,0 +1,44 @@
+#ifndef TIMEFMT_H_INCLUDED
+#define TIMEFMT_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* How times are printed */
+#define TIMEFMT_LOCAL                   0       /* Tue 2023-11-14 22:13:20 UTC */
+#define TIMEFMT_RAW                     1       /* seconds since the epoch */
+#define TIMEFMT_UTC                     2       /* 2023-11-14T22:13:20Z */
+
+#define TIME_BUFSIZE                    64
+#define TIME_MEMO_SLOTS                 8
+
+/* A local day without DST changes: any time in [start, end) is printed as
+ * prefix, then the time of day, then suffix.
+ */
+struct time_day {
+    int64_t start;
+    int64_t end;
+    char prefix[32];                    /* "Tue 2023-11-14 " */
+    size_t prefix_len;
+    char suffix[16];                    /* " UTC" */
+    size_t suffix_len;
+};
+
+struct time_memo {
+    uint32_t time;
+    uint8_t len;
+    char str[TIME_BUFSIZE];
+};
+
+/* Per thread cache of the local time formatting. Tickets coming from the
+ * same TGT share their times, so the last formatted times are remembered,
+ * and any other time of a day already seen is formatted without libc.
+ */
+struct time_cache {
+    struct time_day day;
+    struct time_memo memo[TIME_MEMO_SLOTS];
+    int valid;
+};
+
+size_t time_format(char *buf, uint32_t time, int mode);
+#endif
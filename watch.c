@@ -0,0 +1,279 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "parser.h"
+#include "print.h"
+#include "watch.h"
+
+/* What changes a file in a directory: written in place, replaced by a rename
+ * or removed.
+ */
+#define WATCH_MASK  (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+int watch_init(struct watch *w, struct outbuf *out, const struct print_options *opts) {
+    memset(w, 0, sizeof(*w));
+    w->out = out;
+    w->opts = *opts;
+    // A stream of updates: one JSON document per file doesn't fit
+    if (w->opts.format == PRINT_JSON) {
+        w->opts.format = PRINT_NDJSON;
+    }
+    // The parallel decoder indexes the whole file, and the updates are small
+    w->opts.nthreads = 1;
+    if (out_init(&w->buf, -1, 0) < 0) {
+        return -1;
+    }
+    w->fd = inotify_init1(IN_CLOEXEC);
+    if (w->fd < 0) {
+        out_free(&w->buf);
+        return -1;
+    }
+    return 0;
+}
+
+/* Watch the directory of path rather than the file itself, so that the file
+ * is still followed when it is replaced or created again.
+ */
+int watch_add(struct watch *w, const char *path) {
+    struct watch_file *f;
+    char *slash;
+    int wd;
+
+    if (w->count == w->size) {
+        size_t size = w->size ? w->size * 2 : 8;
+        struct watch_file *files = realloc(w->files, size * sizeof(struct watch_file));
+
+        if (!files) {
+            return -1;
+        }
+        w->files = files;
+        w->size = size;
+    }
+    f = &w->files[w->count];
+    memset(f, 0, sizeof(*f));
+    f->path = strdup(path);
+    if (!f->path) {
+        return -1;
+    }
+    slash = strrchr(f->path, '/');
+    if (!slash) {
+        f->name = f->path;
+        wd = inotify_add_watch(w->fd, ".", WATCH_MASK);
+    } else if (slash == f->path) {
+        f->name = slash + 1;
+        wd = inotify_add_watch(w->fd, "/", WATCH_MASK);
+    } else {
+        *slash = '\0';
+        wd = inotify_add_watch(w->fd, f->path, WATCH_MASK);
+        *slash = '/';
+        f->name = slash + 1;
+    }
+    if (!*f->name) {
+        errno = EISDIR;
+        wd = -1;
+    }
+    if (wd < 0) {
+        free(f->path);
+        return -1;
+    }
+    f->wd = wd;
+    w->count++;
+    return 0;
+}
+
+// FNV-1a
+static uint64_t fingerprint(const uint8_t *data, size_t length) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        h = (h ^ data[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t tail_fingerprint(const struct ccache *cc, off_t offset) {
+    off_t start = offset - WATCH_TAIL;
+
+    if (start < cc->creds_start) {
+        start = cc->creds_start;
+    }
+    return fingerprint((const uint8_t *) cc->reader.map + start, offset - start);
+}
+
+// Parse the file from the start on the next change
+static void watch_forget(struct watch_file *f) {
+    f->offset = 0;
+    f->count = 0;
+}
+
+static void watch_error(struct watch *w, struct watch_file *f, struct ccache *cc, int err) {
+    if (f->error == err) {
+        return;
+    }
+    f->error = err;
+    if (w->opts.format == PRINT_TEXT) {
+        print_error(&w->buf, &w->opts, f->path, cc, err);
+        return;
+    }
+    out_lit(&w->buf, "{\"file\":");
+    out_json_str(&w->buf, f->path, strlen(f->path));
+    out_char(&w->buf, ',');
+    print_error(&w->buf, &w->opts, f->path, cc, err);
+    out_lit(&w->buf, "}\n");
+}
+
+/* True if the previous pass still holds: the file is the same one, and the
+ * bytes it has decoded haven't changed as far as the fingerprints can tell.
+ */
+static int watch_unchanged(const struct watch_file *f, const struct ccache *cc, const struct stat *st) {
+    return f->offset && reader_is_mapped(&cc->reader) &&
+           st->st_dev == f->dev && st->st_ino == f->ino &&
+           f->offset >= cc->creds_start && f->offset <= cc->reader.size &&
+           fingerprint(cc->reader.map, cc->creds_start) == f->header_fp &&
+           tail_fingerprint(cc, f->offset) == f->tail_fp;
+}
+
+// Print what changed in a file since the last pass
+static void watch_update(struct watch *w, struct watch_file *f) {
+    struct ccache *cc;
+    struct stat st;
+    int ret;
+
+    f->dirty = 0;
+    // Read, not mapped: the file can be truncated under us
+    ret = cc_load(&cc, f->path, &w->data, &w->data_size);
+    if (ret < 0) {
+        // Removed, or caught while it is being written: nothing to say yet
+        if (ret == CC_ERR_IO && cc && cc->sys_errno == ENOENT) {
+            f->error = 0;
+        } else if (ret != CC_ERR_TRUNCATED) {
+            watch_error(w, f, cc, ret);
+        }
+        watch_forget(f);
+        goto out;
+    }
+    cc_set_filter(cc, w->opts.filter);
+    cc_set_summary(cc, w->opts.summary);
+    if (fstat(cc->reader.fd, &st) < 0) {
+        watch_forget(f);
+        goto out;
+    }
+
+    if (watch_unchanged(f, cc, &st)) {
+        if (f->offset == cc->reader.size) {
+            goto out;
+        }
+        ret = cc_resume(cc, f->offset, f->count);
+    } else {
+        if (w->opts.format == PRINT_TEXT) {
+            out_lit(&w->buf, "Default principal: ");
+            print_principal(&w->buf, &cc->default_principal);
+            out_char(&w->buf, '\n');
+            print_credentials_header(&w->buf);
+        }
+        ret = 0;
+    }
+    if (ret == 0) {
+        ret = check_credentials(&w->buf, &w->opts, f->path, cc);
+    }
+
+    // A credential cut short is still being appended: it is decoded on the
+    // next change
+    if (ret < 0 && ret != CC_ERR_TRUNCATED) {
+        watch_error(w, f, cc, ret);
+        watch_forget(f);
+        goto out;
+    }
+    f->error = 0;
+    f->offset = ret < 0 ? cc->cred_offset : cc->reader.offset;
+    f->count = cc->count;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    if (reader_is_mapped(&cc->reader)) {
+        f->header_fp = fingerprint(cc->reader.map, cc->creds_start);
+        f->tail_fp = tail_fingerprint(cc, f->offset);
+    }
+
+out:
+    cc_close(cc);
+    if (w->buf.len) {
+        if (w->count > 1 && w->opts.format == PRINT_TEXT) {
+            out_lit(w->out, "==> ");
+            out_str(w->out, f->path);
+            out_lit(w->out, " <==\n");
+        }
+        out_buf(w->out, &w->buf);
+        w->buf.len = 0;
+    }
+}
+
+/* Print all the files, then what changes in them as it happens. The events
+ * read together are merged: a file written many times in a row is parsed
+ * once.
+ * Only returns on failure, with errno set.
+ */
+int watch_run(struct watch *w) {
+    char events[WATCH_EVENTS] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    ssize_t n;
+    char *p;
+    size_t i;
+
+    for (i = 0; i < w->count; i++) {
+        watch_update(w, &w->files[i]);
+    }
+    if (out_flush(w->out) < 0) {
+        return -1;
+    }
+    for (;;) {
+        n = read(w->fd, events, sizeof(events));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        for (p = events; p < events + n; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *) p;
+            for (i = 0; i < w->count; i++) {
+                struct watch_file *f = &w->files[i];
+
+                // Events were lost: look at everything
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    f->dirty = 1;
+                } else if (ev->len && f->wd == ev->wd && !strcmp(f->name, ev->name)) {
+                    f->dirty = 1;
+                }
+            }
+        }
+        for (i = 0; i < w->count; i++) {
+            if (w->files[i].dirty) {
+                watch_update(w, &w->files[i]);
+            }
+        }
+        if (out_flush(w->out) < 0) {
+            return -1;
+        }
+    }
+}
+
+void watch_free(struct watch *w) {
+    size_t i;
+
+    for (i = 0; i < w->count; i++) {
+        free(w->files[i].path);
+    }
+    free(w->files);
+    free(w->data);
+    out_free(&w->buf);
+    if (w->fd >= 0) {
+        close(w->fd);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef WATCH_H_INCLUDED
+#define WATCH_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "out.h"
+#include "print.h"
+
+#define WATCH_TAIL                      64      /* bytes in the tail fingerprint */
+#define WATCH_EVENTS                    (64 * 1024)
+
+/* A watched ccache and what is known of it from the last pass. The credentials
+ * before offset are not decoded again as long as the file looks the same up
+ * to there: same inode, same bytes before the first credential and same
+ * bytes just before offset.
+ */
+struct watch_file {
+    char *path;
+    const char *name;           /* in its directory */
+    int wd;                     /* inotify watch of the directory */
+    int dirty;
+    int error;                  /* last failure printed, not repeated */
+    dev_t dev;
+    ino_t ino;
+    off_t offset;               /* end of the last complete credential, 0 to parse it all */
+    uint32_t count;             /* credentials before offset */
+    uint64_t header_fp;         /* fingerprint of the bytes before the credentials */
+    uint64_t tail_fp;           /* fingerprint of the bytes just before offset */
+};
+
+/* Set of ccaches printed again as they change. New credentials appended to a
+ * file are the only ones decoded; a file rewritten, truncated or replaced is
+ * parsed again from the start.
+ */
+struct watch {
+    struct watch_file *files;
+    size_t count;
+    size_t size;
+    int fd;                     /* inotify instance */
+    struct outbuf *out;
+    struct print_options opts;
+    struct outbuf buf;          /* output of the file being updated */
+    uint8_t *data;              /* file being updated, read rather than mapped */
+    size_t data_size;
+};
+
+int watch_init(struct watch *w, struct outbuf *out, const struct print_options *opts);
+int watch_add(struct watch *w, const char *path);
+int watch_run(struct watch *w);
+void watch_free(struct watch *w);
+#endif